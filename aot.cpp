@@ -0,0 +1,528 @@
+#include "aot.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <set>
+
+#include "op.h"
+
+namespace asmvm {
+
+namespace {
+
+void Append(std::string* out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// Lines longer than the buffer, such as long PRINT literals, are formatted
+// again at their full size.
+void Append(std::string* out, const char* format, ...) {
+  char buffer[512];
+  va_list args;
+  va_start(args, format);
+  va_list again;
+  va_copy(again, args);
+  int size = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (size > 0 && size < int(sizeof(buffer))) {
+    out->append(buffer, size);
+  } else if (size > 0) {
+    size_t start = out->size();
+    out->resize(start + size + 1);
+    vsnprintf(&(*out)[start], size + 1, format, again);
+    out->resize(start + size);
+  }
+  va_end(again);
+}
+
+// C++ literal of value, valid for INT32_MIN too.
+std::string IntLiteral(int64_t value) {
+  char buffer[32];
+  if (value == INT32_MIN) return "(-2147483647 - 1)";
+  snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+  return buffer;
+}
+
+std::string StringLiteral(const std::string& str) {
+  std::string out = "\"";
+  for (size_t i = 0; i < str.size(); ++i) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c < 0x20 || c >= 0x7f) {
+      char octal[8];
+      snprintf(octal, sizeof(octal), "\\%03o", c);
+      out += octal;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+const char* const kRegisterNames[] = {"r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "st"};
+
+class Translator {
+ public:
+  Translator(AsmMachine& vm, std::string* out) : vm_(vm), out_(out), writes_pc_(false) {}
+  bool Translate(const std::string& source_name);
+
+ private:
+  // Expressions for operands of the instruction at pc.
+  std::string Register(uint32_t rindex, uint32_t pc) const {
+    return rindex == kRegisterIndexPc ? IntLiteral(pc) : kRegisterNames[rindex];
+  }
+  std::string SourceExpr(const Source* src, uint32_t pc) const;
+  // Expressions for addresses; constant ones are folded into *value.
+  std::string AddressExpr(const Address* address, uint32_t pc, bool* is_constant,
+                          uint32_t* value) const;
+  std::string BaseExpr(const BaseAddress* base, uint32_t pc, bool* is_constant,
+                       uint32_t* value) const;
+
+  // Statement storing value in a register. Writing PC jumps past the
+  // address written, as in the interpreter.
+  std::string Assign(uint32_t rindex, const std::string& value);
+  // Statement ending the program as if the instruction returned next_pc.
+  static std::string Halt(const std::string& next_pc) {
+    return "{ next = " + next_pc + "; goto stop; }";
+  }
+
+  bool Check();
+  void EmitBody(std::string* body);
+  void EmitInstruction(uint32_t pc);
+  void EmitLoad(uint32_t pc, const OpLoad& op, const char* type, uint32_t size);
+  void EmitStore(uint32_t pc, const OpStore& op, const char* type, uint32_t size);
+  void EmitAtomic(uint32_t pc, const Address* address, const std::string& body);
+  void EmitPrint(uint32_t pc, const OpPrint& op);
+  void EmitSysCall(uint32_t pc, const OpSysCall& op);
+  // Condition for size bytes at address being past the memory.
+  std::string OutOfMemory(const char* address, uint32_t size);
+  void EmitCall(const std::string& function);
+
+  AsmMachine& vm_;
+  std::string* out_;
+  // Instructions reached by goto, and by the switch on the PC.
+  std::set<uint32_t> labels_;
+  std::set<uint32_t> dispatch_;
+  bool writes_pc_;
+  // Host functions bound by the program, in the order of functions_.
+  std::vector<const HostFunction*> functions_;
+};
+
+std::string Translator::SourceExpr(const Source* src, uint32_t pc) const {
+  if (const RegisterSource* reg = dynamic_cast<const RegisterSource*>(src)) {
+    return Register(reg->rindex(), pc);
+  }
+  // Numbers, variable addresses and label indices are known after linking.
+  return IntLiteral(src->value(vm_));
+}
+
+std::string Translator::BaseExpr(const BaseAddress* base, uint32_t pc, bool* is_constant,
+                                 uint32_t* value) const {
+  const BaseAddressRegister* reg = dynamic_cast<const BaseAddressRegister*>(base);
+  *is_constant = reg == NULL || reg->rindex() == kRegisterIndexPc;
+  if (!*is_constant) return "uint32_t(" + Register(reg->rindex(), pc) + ")";
+  *value = reg != NULL ? pc : base->base_address(vm_);
+  return IntLiteral(*value) + "U";
+}
+
+std::string Translator::AddressExpr(const Address* address, uint32_t pc, bool* is_constant,
+                                    uint32_t* value) const {
+  std::string base = BaseExpr(address->base(), pc, is_constant, value);
+  const Source* offset = address->offset();
+  if (offset == NULL) return base;
+  const RegisterSource* reg = dynamic_cast<const RegisterSource*>(offset);
+  if (*is_constant && (reg == NULL || reg->rindex() == kRegisterIndexPc)) {
+    *value += reg != NULL ? pc : offset->value(vm_);
+    return IntLiteral(*value) + "U";
+  }
+  *is_constant = false;
+  return "(" + base + " + uint32_t(" + SourceExpr(offset, pc) + "))";
+}
+
+std::string Translator::Assign(uint32_t rindex, const std::string& value) {
+  if (rindex == kRegisterIndexPc) {
+    writes_pc_ = true;
+    return "{ pc = int32_t(" + value + ") + 1; goto dispatch; }";
+  }
+  return std::string(kRegisterNames[rindex]) + " = " + value + ";";
+}
+
+void Translator::EmitCall(const std::string& function) {
+  Append(out_, "    rt.vm().%s;\n", function.c_str());
+}
+
+std::string Translator::OutOfMemory(const char* address, uint32_t size) {
+  // A miss takes another look, for the heap grown by another thread.
+  std::string check;
+  Append(&check, "(%s > mem - %uU && (mem = rt.vm().memory_size(), %s > mem - %uU))",
+         address, size, address, size);
+  return check;
+}
+
+void Translator::EmitLoad(uint32_t pc, const OpLoad& op, const char* type, uint32_t size) {
+  bool is_constant;
+  uint32_t value;
+  std::string address = AddressExpr(op.address(), pc, &is_constant, &value);
+  if (is_constant && value <= vm_.memory_size() - size) {
+    Append(out_, "    %s\n", Assign(op.rindex(), std::string("asmvm::aot::Load<") + type +
+                                      ">(m + " + address + ")").c_str());
+    return;
+  }
+  Append(out_, "    { int32_t a = int32_t(%s);\n", address.c_str());
+  Append(out_, "      if (a < 0 || %s) { rt.vm().Print(\"Invalid address [%%d]. Default memory size = %%d.\\n\", a, int32_t(mem)); %s }\n",
+         OutOfMemory("uint32_t(a)", size).c_str(), Assign(op.rindex(), "0").c_str());
+  Append(out_, "      else %s }\n", Assign(op.rindex(), std::string("asmvm::aot::Load<") + type + ">(m + a)").c_str());
+}
+
+void Translator::EmitStore(uint32_t pc, const OpStore& op, const char* type, uint32_t size) {
+  bool is_constant;
+  uint32_t constant;
+  std::string address = AddressExpr(op.address(), pc, &is_constant, &constant);
+  std::string value = SourceExpr(op.src(), pc);
+  if (is_constant && constant <= vm_.memory_size() - size) {
+    Append(out_, "    asmvm::aot::Store<%s>(m + %s, %s(%s));\n", type, address.c_str(), type, value.c_str());
+    return;
+  }
+  Append(out_, "    { uint32_t a = %s;\n", address.c_str());
+  Append(out_, "      if (%s) rt.vm().Print(\"Invalid address [%%d]. Default memory size = %%d.\\n\", int32_t(a), int32_t(mem));\n",
+         OutOfMemory("a", size).c_str());
+  Append(out_, "      else asmvm::aot::Store<%s>(m + a, %s(%s)); }\n", type, type, value.c_str());
+}
+
+void Translator::EmitAtomic(uint32_t pc, const Address* address, const std::string& body) {
+  bool is_constant;
+  uint32_t constant;
+  Append(out_, "    { uint32_t a = %s;\n", AddressExpr(address, pc, &is_constant, &constant).c_str());
+  Append(out_, "      if (a %% 4 != 0 || %s) rt.vm().Print(\"Invalid atomic address [%%d]. Atomic words are 4-byte aligned within the %%d bytes of memory.\\n\", int32_t(a), int32_t(mem));\n",
+         OutOfMemory("a", 4).c_str());
+  Append(out_, "      else { int32_t* w = reinterpret_cast<int32_t*>(m + a); %s } }\n", body.c_str());
+}
+
+void Translator::EmitPrint(uint32_t pc, const OpPrint& op) {
+  // Runs of constant text become one write.
+  std::string text;
+  for (uint32_t i = 0; i <= op.printable_count(); ++i) {
+    const Printable* printable = i < op.printable_count() ? op.printables()[i] : NULL;
+    const RegisterSource* reg = dynamic_cast<const RegisterSource*>(printable);
+    const SymbolString* var = dynamic_cast<const SymbolString*>(printable);
+    if (printable != NULL && reg == NULL && var == NULL) {
+      text += printable->str(vm_);
+      continue;
+    }
+    if (!text.empty()) {
+      Append(out_, "    rt.vm().Write(%s, %zu);\n", StringLiteral(text).c_str(), text.size());
+      text.clear();
+    }
+    if (reg != NULL) {
+      EmitCall("Print(\"%d\", " + Register(reg->rindex(), pc) + ")");
+    } else if (var != NULL) {
+      int32_t address = 0;
+      vm_.ResolveSymbol(var->symbol(), Symbol::kSymbolVar, &address);
+      Append(out_, "    { const char* s = reinterpret_cast<const char*>(m + %d); rt.vm().Write(s, strlen(s)); }\n", address);
+    }
+  }
+  EmitCall("Flush()");
+}
+
+void Translator::EmitSysCall(uint32_t pc, const OpSysCall& op) {
+  std::string call = "{ int32_t regs[asmvm::aot::kSysCallRegisters] = {r1, r2, r3, r4, r5, r6, r7, r8, st};\n";
+  if (op.function() != NULL) {
+    size_t index = 0;
+    while (index < functions_.size() && functions_[index] != op.function()) ++index;
+    if (index == functions_.size()) functions_.push_back(op.function());
+    Append(&call, "      int32_t status = rt.SysCall(*function%zu, regs);\n", index);
+  } else {
+    Append(&call, "      const asmvm::HostFunction* function = rt.vm().host_functions().Find(%s);\n",
+           SourceExpr(op.src(), pc).c_str());
+    call += "      int32_t status = function == NULL ? 1 : rt.SysCall(*function, regs);\n";
+  }
+  call += "      r1 = regs[0]; r2 = regs[1]; r3 = regs[2]; r4 = regs[3];\n"
+          "      r5 = regs[4]; r6 = regs[5]; r7 = regs[6]; r8 = regs[7]; st = regs[8];\n"
+          "      mem = rt.vm().memory_size();\n";
+  Append(out_, "    %s      %s }\n", call.c_str(), Assign(op.rindex(), "status").c_str());
+}
+
+void Translator::EmitInstruction(uint32_t pc) {
+  const Instruction* ins = vm_.program()[pc];
+  const char* op = NULL;
+  switch (ins->opcode()) {
+  case Instruction::kOpAdd: op = "uint32_t(%s) + uint32_t(%s)"; break;
+  case Instruction::kOpSub: op = "uint32_t(%s) - uint32_t(%s)"; break;
+  case Instruction::kOpMul: op = "uint32_t(%s) * uint32_t(%s)"; break;
+  case Instruction::kOpDiv: op = "%s / %s"; break;
+  case Instruction::kOpMod: op = "%s %% %s"; break;
+  case Instruction::kOpAnd: op = "%s & %s"; break;
+  case Instruction::kOpOr: op = "%s | %s"; break;
+  case Instruction::kOpXor: op = "%s ^ %s"; break;
+  // Shift counts are masked as x86 does for the interpreter.
+  case Instruction::kOpShl: op = "uint32_t(%s) << (%s & 31)"; break;
+  case Instruction::kOpShr: op = "%s >> (%s & 31)"; break;
+  default: break;
+  }
+  if (op != NULL) {
+    const TernaryInstruction* t = static_cast<const TernaryInstruction*>(ins);
+    std::string expr;
+    Append(&expr, op, SourceExpr(t->param1(), pc).c_str(), SourceExpr(t->param2(), pc).c_str());
+    Append(out_, "    %s\n", Assign(t->output_rindex(), "int32_t(" + expr + ")").c_str());
+    return;
+  }
+
+  switch (ins->opcode()) {
+  case Instruction::kOpNot: {
+      const OpNot* n = static_cast<const OpNot*>(ins);
+      Append(out_, "    %s\n", Assign(n->rindex2(), "~" + Register(n->rindex1(), pc)).c_str());
+    }
+    break;
+  case Instruction::kOpJmp:
+    Append(out_, "    goto L%d;\n", static_cast<const OpJmp*>(ins)->target());
+    break;
+  case Instruction::kOpJz:
+  case Instruction::kOpJnz: {
+      const ConditionalJump* j = static_cast<const ConditionalJump*>(ins);
+      Append(out_, "    if (%s %s 0) goto L%d;\n", Register(j->rindex(), pc).c_str(),
+             ins->opcode() == Instruction::kOpJz ? "==" : "!=", j->target());
+    }
+    break;
+  case Instruction::kOpCall:
+    Append(out_, "    if (depth + 1 == %u) { rt.vm().Print(\"Call stack overflow. Maximum call depth = %%d.\\n\", %u); %s }\n",
+           kMaxCallDepth, kMaxCallDepth, Halt("-1").c_str());
+    Append(out_, "    ++depth; frames[depth].return_pc = %u; frames[depth].frame_base = asmvm::kNoFrame;\n", pc);
+    Append(out_, "    goto L%d;\n", static_cast<const OpCall*>(ins)->target());
+    break;
+  case Instruction::kOpRet:
+    Append(out_, "    if (frames[depth].frame_base != asmvm::kNoFrame) { rt.vm().Print(\"RET with an open frame. Missing LEAVE?\\n\"); %s }\n",
+           Halt("-1").c_str());
+    Append(out_, "    if (depth == 0) { rt.vm().Print(\"Invalid RET operation. Call stack is empty.\\n\"); %s }\n",
+           Halt("-1").c_str());
+    Append(out_, "    pc = frames[depth--].return_pc + 1;\n    goto dispatch;\n");
+    break;
+  case Instruction::kOpMov: {
+      const OpMov* mov = static_cast<const OpMov*>(ins);
+      Append(out_, "    %s\n", Assign(mov->rindex_dst(), SourceExpr(mov->src(), pc)).c_str());
+    }
+    break;
+  case Instruction::kOpPush:
+    Append(out_, "    if (uint32_t(st) + 4 >= %u) { rt.vm().Print(\"Stack overflow. Default memory size = %%d.\", %u); %s }\n",
+           vm_.stack_end(), vm_.stack_end(), Halt("-1").c_str());
+    Append(out_, "    asmvm::aot::Store<int32_t>(m + st, %s); st += 4;\n",
+           SourceExpr(static_cast<const OpPush*>(ins)->src(), pc).c_str());
+    break;
+  case Instruction::kOpPop: {
+      const OpPop* pop = static_cast<const OpPop*>(ins);
+      Append(out_, "    { int32_t a = int32_t(uint32_t(st) - 4);\n");
+      Append(out_, "      if (a < 0) { rt.vm().Print(\"Invalid POP operation. Stack is empty.\"); %s }\n",
+             Halt("-1").c_str());
+      Append(out_, "      int32_t value = asmvm::aot::Load<int32_t>(m + a); st = a; (void)value;%s%s }\n",
+             pop->store_value() ? " " : "",
+             pop->store_value() ? Assign(pop->rindex(), "value").c_str() : "");
+    }
+    break;
+  case Instruction::kOpLd1:
+    EmitLoad(pc, *static_cast<const OpLoad*>(ins), "uint8_t", 1);
+    break;
+  case Instruction::kOpLd2:
+    EmitLoad(pc, *static_cast<const OpLoad*>(ins), "uint16_t", 2);
+    break;
+  case Instruction::kOpLd4:
+    EmitLoad(pc, *static_cast<const OpLoad*>(ins), "uint32_t", 4);
+    break;
+  case Instruction::kOpSt1:
+    EmitStore(pc, *static_cast<const OpStore*>(ins), "uint8_t", 1);
+    break;
+  case Instruction::kOpSt2:
+    EmitStore(pc, *static_cast<const OpStore*>(ins), "uint16_t", 2);
+    break;
+  case Instruction::kOpSt4:
+    EmitStore(pc, *static_cast<const OpStore*>(ins), "int32_t", 4);
+    break;
+  case Instruction::kOpExit: {
+      std::string code = SourceExpr(static_cast<const OpExit*>(ins)->code(), pc);
+      EmitCall("Print(\"\\nProgram exit with code %d.\\n\", " + code + ")");
+      Append(out_, "    %s\n", Halt(code + " < 0 ? -1 : -1 - " + code).c_str());
+    }
+    break;
+  case Instruction::kOpInc:
+  case Instruction::kOpDec: {
+      uint32_t rindex = ins->opcode() == Instruction::kOpInc ? static_cast<const OpInc*>(ins)->rindex() :
+          static_cast<const OpDec*>(ins)->rindex();
+      Append(out_, "    %s\n", Assign(rindex, "int32_t(uint32_t(" + Register(rindex, pc) +
+                                       (ins->opcode() == Instruction::kOpInc ? ") + 1)" : ") - 1)")).c_str());
+    }
+    break;
+  case Instruction::kOpPrint:
+    EmitPrint(pc, *static_cast<const OpPrint*>(ins));
+    break;
+  case Instruction::kOpSysCall:
+    EmitSysCall(pc, *static_cast<const OpSysCall*>(ins));
+    break;
+  case Instruction::kOpPushN:
+    Append(out_, "    st = int32_t(uint32_t(st) + %uU);\n", static_cast<const OpPushN*>(ins)->bytes());
+    break;
+  case Instruction::kOpPopN:
+    Append(out_, "    st = int32_t(uint32_t(st) - %uU);\n", static_cast<const OpPopN*>(ins)->bytes());
+    break;
+  case Instruction::kOpFprint:
+    Append(out_, "    { float f; int32_t bits = %s; memcpy(&f, &bits, sizeof(f)); rt.vm().Print(\"%%f\", f); }\n",
+           Register(static_cast<const OpFprint*>(ins)->rindex(), pc).c_str());
+    EmitCall("Flush()");
+    break;
+  case Instruction::kOpSprint: {
+      bool is_constant;
+      uint32_t constant;
+      Append(out_, "    { const char* s = reinterpret_cast<const char*>(m + %s); rt.vm().Write(s, strlen(s)); }\n",
+             BaseExpr(static_cast<const OpSprint*>(ins)->str(), pc, &is_constant, &constant).c_str());
+      EmitCall("Flush()");
+    }
+    break;
+  case Instruction::kOpEnter: {
+      const OpEnter* enter = static_cast<const OpEnter*>(ins);
+      Append(out_, "    if (frames[depth].frame_base != asmvm::kNoFrame) { rt.vm().Print(\"ENTER inside an open frame. Missing LEAVE?\\n\"); %s }\n",
+             Halt("-1").c_str());
+      Append(out_, "    if (uint32_t(st) >= %uU || %uU >= %uU - uint32_t(st)) { rt.vm().Print(\"Stack overflow. Default memory size = %%d.\\n\", %u); %s }\n",
+             vm_.stack_end(), enter->bytes(), vm_.stack_end(), vm_.stack_end(), Halt("-1").c_str());
+      Append(out_, "    { int32_t base = st; frames[depth].frame_base = base; st = int32_t(uint32_t(base) + %uU);%s%s }\n",
+             enter->bytes(), enter->rindex() == kRegisterIndexSt ? "" : " ",
+             enter->rindex() == kRegisterIndexSt ? "" : Assign(enter->rindex(), "base").c_str());
+    }
+    break;
+  case Instruction::kOpLeave:
+    Append(out_, "    if (frames[depth].frame_base == asmvm::kNoFrame) { rt.vm().Print(\"LEAVE without ENTER.\\n\"); %s }\n",
+           Halt("-1").c_str());
+    Append(out_, "    st = frames[depth].frame_base; frames[depth].frame_base = asmvm::kNoFrame;\n");
+    break;
+  case Instruction::kOpXadd: {
+      const OpXadd* xadd = static_cast<const OpXadd*>(ins);
+      EmitAtomic(pc, xadd->address(), Assign(xadd->rindex(), "__atomic_fetch_add(w, " +
+                                             Register(xadd->rindex(), pc) + ", __ATOMIC_SEQ_CST)"));
+    }
+    break;
+  case Instruction::kOpCas: {
+      const OpCas* cas = static_cast<const OpCas*>(ins);
+      EmitAtomic(pc, cas->address(), "int32_t e = " + Register(cas->rindex(), pc) +
+                 "; __atomic_compare_exchange_n(w, &e, " + Register(cas->desired(), pc) +
+                 ", false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); " + Assign(cas->rindex(), "e"));
+    }
+    break;
+  case Instruction::kOpLd4Acquire: {
+      const OpLd4Acquire* load = static_cast<const OpLd4Acquire*>(ins);
+      EmitAtomic(pc, load->address(), Assign(load->rindex(), "__atomic_load_n(w, __ATOMIC_ACQUIRE)"));
+    }
+    break;
+  case Instruction::kOpSt4Release: {
+      const OpSt4Release* store = static_cast<const OpSt4Release*>(ins);
+      EmitAtomic(pc, store->address(), "__atomic_store_n(w, " + SourceExpr(store->src(), pc) +
+                 ", __ATOMIC_RELEASE);");
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Collects jump targets and rejects what only the interpreter can run.
+bool Translator::Check() {
+  const std::vector<Instruction*>& program = vm_.program();
+  for (uint32_t pc = 0; pc < program.size(); ++pc) {
+    const Instruction* ins = program[pc];
+    switch (ins->opcode()) {
+    case Instruction::kOpJmp:
+      labels_.insert(static_cast<const OpJmp*>(ins)->target());
+      break;
+    case Instruction::kOpJz:
+    case Instruction::kOpJnz:
+      labels_.insert(static_cast<const ConditionalJump*>(ins)->target());
+      break;
+    case Instruction::kOpCall:
+      labels_.insert(static_cast<const OpCall*>(ins)->target());
+      dispatch_.insert(pc + 1);
+      break;
+    case Instruction::kOpSysCall: {
+        const HostFunction* function = static_cast<const OpSysCall*>(ins)->function();
+        if (function != NULL && function->name == "spawn") {
+          vm_.Diagnostic("SYSCALL \"spawn\" (instrução %u) precisa do interpretador.\n", pc);
+          return false;
+        }
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  labels_.insert(0);
+  return true;
+}
+
+void Translator::EmitBody(std::string* body) {
+  std::string* out = out_;
+  out_ = body;
+  body->clear();
+  functions_.clear();
+  for (uint32_t pc = 0; pc < vm_.program().size(); ++pc) {
+    if (labels_.count(pc) || dispatch_.count(pc)) Append(out_, "L%u:\n", pc);
+    EmitInstruction(pc);
+  }
+  out_ = out;
+}
+
+bool Translator::Translate(const std::string& source_name) {
+  if (!Check()) return false;
+  const std::vector<Instruction*>& program = vm_.program();
+
+  std::string body;
+  EmitBody(&body);
+  if (writes_pc_) {
+    // Any instruction can be the target of a write to PC.
+    for (uint32_t pc = 0; pc < program.size(); ++pc) dispatch_.insert(pc);
+    EmitBody(&body);
+  }
+
+  Append(out_, "// Translated from %s by asmvm aot. Build against libasmvm:\n", source_name.c_str());
+  Append(out_, "//   g++ -O2 -pthread prog.cpp -I/usr/local/include/asmvm /usr/local/lib/libasmvm.a\n");
+  Append(out_, "#include <string.h>\n\n#include \"aot_runtime.h\"\n\n");
+  Append(out_, "static const uint8_t kStaticData[%u] = {", vm_.static_data_size() + 1);
+  for (uint32_t i = 0; i < vm_.static_data_size(); ++i) {
+    Append(out_, "%s%u,", i % 16 == 0 ? "\n  " : "", vm_.data()[i]);
+  }
+  Append(out_, "\n};\n\n");
+  Append(out_, "static int32_t Run(asmvm::aot::Runtime& rt) {\n");
+  Append(out_, "  uint8_t* const m = rt.memory();\n");
+  for (size_t i = 0; i < functions_.size(); ++i) {
+    Append(out_, "  const asmvm::HostFunction* function%zu = rt.Find(%s);\n", i,
+           StringLiteral(functions_[i]->name).c_str());
+    Append(out_, "  if (function%zu == NULL) return 1;\n", i);
+  }
+  Append(out_, "  int32_t r1 = 0, r2 = 0, r3 = 0, r4 = 0, r5 = 0, r6 = 0, r7 = 0, r8 = 0;\n");
+  Append(out_, "  int32_t st = rt.vm().reg_ST();\n");
+  // Grows with the heap.
+  Append(out_, "  uint32_t mem = rt.vm().memory_size();\n");
+  Append(out_, "  asmvm::CallFrame frames[asmvm::kMaxCallDepth];\n");
+  Append(out_, "  uint32_t depth = 0;\n");
+  Append(out_, "  frames[0].frame_base = asmvm::kNoFrame;\n");
+  Append(out_, "  uint32_t pc = 0;\n  int32_t next = -1;\n");
+  Append(out_, "  goto L0;\n");
+  Append(out_, "dispatch:\n  switch (pc) {\n");
+  for (std::set<uint32_t>::const_iterator it = dispatch_.begin(); it != dispatch_.end(); ++it) {
+    if (*it < program.size()) Append(out_, "  case %u: goto L%u;\n", *it, *it);
+  }
+  Append(out_, "  default: goto stop;\n  }\n");
+  out_->append(body);
+  Append(out_, "stop:\n  return rt.Stop(next, depth);\n}\n\n");
+  Append(out_, "int main() {\n");
+  Append(out_, "  asmvm::aot::Runtime rt(kStaticData, %u, %u);\n", vm_.static_data_size(),
+         vm_.reserve_size());
+  Append(out_, "  return Run(rt);\n}\n");
+  return true;
+}
+
+} // namespace
+
+bool TranslateToCpp(AsmMachine& vm, const std::string& source_name, std::string* out) {
+  out->clear();
+  Translator translator(vm, out);
+  return translator.Translate(source_name);
+}
+
+} // namespace asmvm
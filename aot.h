@@ -0,0 +1,22 @@
+#ifndef ASMVM_AOT_H
+#define ASMVM_AOT_H
+
+#include <string>
+
+#include "asmvm.h"
+
+namespace asmvm {
+
+// Translates a linked program to a C++ translation unit with a main() that
+// runs it natively: one function with a label per jump target, registers in
+// locals, memory accessed through a plain uint8_t*, and SYSCALLs calling the
+// host functions of libasmvm through an aot::Runtime (see aot_runtime.h).
+// Returns and jumps to computed addresses go through a switch on the PC.
+// The output matches the interpreter's, error messages included. Fails,
+// after a diagnostic on vm, for programs that spawn threads, which need
+// the interpreter.
+bool TranslateToCpp(AsmMachine& vm, const std::string& source_name, std::string* out);
+
+} // namespace asmvm
+
+#endif
@@ -0,0 +1,33 @@
+#include "aot_runtime.h"
+
+namespace asmvm {
+namespace aot {
+
+Runtime::Runtime(const uint8_t* static_data, uint32_t size, uint32_t reserve_size) {
+  vm_.LoadStaticData(static_data, size, reserve_size);
+  vm_.Reset();
+}
+
+const HostFunction* Runtime::Find(const char* name) {
+  const HostFunction* function = vm_.host_functions().Find(name);
+  if (function == NULL) vm_.Diagnostic("SYSCALL \"%s\" não registrada.\n", name);
+  return function;
+}
+
+int32_t Runtime::SysCall(const HostFunction& function, int32_t* registers) {
+  for (uint32_t i = 0; i < kSysCallRegisters; ++i) vm_.set_register(i, registers[i]);
+  int32_t status = CallHostFunction(vm_, function);
+  for (uint32_t i = 0; i < kSysCallRegisters; ++i) registers[i] = vm_.get_register(i);
+  return status;
+}
+
+int32_t Runtime::Stop(int32_t next_pc, uint32_t call_depth) {
+  if (call_depth > 0) {
+    vm_.Print("A pilha de chamadas não está vazia. Cheque se há chamadas para a instrução RET" 
+              " em todas as funções.\n");
+  }
+  return -1 - next_pc;
+}
+
+} // namespace aot
+} // namespace asmvm
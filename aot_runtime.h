@@ -0,0 +1,58 @@
+#ifndef ASMVM_AOT_RUNTIME_H
+#define ASMVM_AOT_RUNTIME_H
+
+#include <string.h>
+#include <stdint.h>
+
+#include "asmvm.h"
+#include "host_functions.h"
+
+namespace asmvm {
+namespace aot {
+
+// Registers a translated program hands to SysCall: R1..R8, then ST.
+const uint32_t kSysCallRegisters = 9;
+
+// What a program translated by asmvm aot (see aot.h) needs at run time: the
+// data memory, output, files and host functions of a machine that has no
+// instructions of its own.
+class Runtime {
+ public:
+  Runtime(const uint8_t* static_data, uint32_t size, uint32_t reserve_size);
+
+  AsmMachine& vm() { return vm_; }
+  uint8_t* memory() { return vm_.data(); }
+
+  // Function a SYSCALL was bound to at translation time. Reports and returns
+  // NULL if it is not registered here.
+  const HostFunction* Find(const char* name);
+  // Calls function with the machine registers loaded from registers, and
+  // stores them back afterwards. Returns the SYSCALL status.
+  int32_t SysCall(const HostFunction& function, int32_t* registers);
+
+  // End of the program, as AsmMachine::Stop: next_pc is what the stopping
+  // instruction returned. Returns the exit code.
+  int32_t Stop(int32_t next_pc, uint32_t call_depth);
+
+ private:
+  Runtime(const Runtime&);
+  Runtime& operator = (const Runtime&);
+
+  AsmMachine vm_;
+};
+
+// Unaligned accesses to VM memory, as the interpreter does them.
+template <typename T> inline T Load(const uint8_t* address) {
+  T value;
+  memcpy(&value, address, sizeof(value));
+  return value;
+}
+
+template <typename T> inline void Store(uint8_t* address, T value) {
+  memcpy(address, &value, sizeof(value));
+}
+
+} // namespace aot
+} // namespace asmvm
+
+#endif
@@ -0,0 +1,47 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace asmvm {
+
+Arena::~Arena() {
+  for (size_t i = destructors_.size(); i > 0; --i) {
+    destructors_[i - 1].second(destructors_[i - 1].first);
+  }
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    free(blocks_[i]);
+  }
+}
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+  uintptr_t aligned = (uintptr_t(next_) + alignment - 1) & ~uintptr_t(alignment - 1);
+  if (next_ == NULL || aligned + size > uintptr_t(end_)) {
+    // Oversized requests get a block of their own so the current one keeps
+    // serving small objects.
+    size_t block_size = size + alignment > kBlockSize ? size + alignment : kBlockSize;
+    char* block = static_cast<char*>(malloc(block_size));
+    if (block == NULL) throw std::bad_alloc();
+    blocks_.push_back(block);
+    aligned = (uintptr_t(block) + alignment - 1) & ~uintptr_t(alignment - 1);
+    if (block_size == kBlockSize) {
+      end_ = block + block_size;
+    } else {
+      bytes_ += size;
+      return reinterpret_cast<void*>(aligned);
+    }
+  }
+  next_ = reinterpret_cast<char*>(aligned + size);
+  bytes_ += size;
+  return reinterpret_cast<void*>(aligned);
+}
+
+const char* Arena::StrDup(const char* str, size_t length) {
+  char* copy = static_cast<char*>(Allocate(length + 1, 1));
+  memcpy(copy, str, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+} // namespace asmvm
@@ -0,0 +1,63 @@
+#ifndef ASMVM_ARENA_H
+#define ASMVM_ARENA_H
+
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+
+namespace asmvm {
+
+// Bump allocator for objects that live as long as a program. Objects are
+// carved out of large blocks in allocation order and released all at once
+// when the arena is destroyed. Trivially destructible objects (every
+// instruction and operand) cost nothing at release; others get their
+// destructor recorded and run in reverse order.
+class Arena {
+ public:
+  static const size_t kBlockSize = 64 * 1024;
+
+  Arena() : next_(NULL), end_(NULL), bytes_(0) {}
+  ~Arena();
+
+  void* Allocate(size_t size, size_t alignment);
+
+  template <typename T, typename... Args> T* New(Args&&... args) {
+    T* object = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      destructors_.push_back(Destructor(object, &Destroy<T>));
+    }
+    return object;
+  }
+
+  template <typename T> T* NewArray(size_t count) {
+    static_assert(std::is_trivially_destructible<T>::value, "arrays are never destroyed");
+    return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+  }
+
+  const char* StrDup(const char* str, size_t length);
+  const char* StrDup(const std::string& str) { return StrDup(str.data(), str.size()); }
+
+  // Bytes handed out so far.
+  size_t bytes() const { return bytes_; }
+
+ private:
+  typedef std::pair<void*, void (*)(void*)> Destructor;
+
+  template <typename T> static void Destroy(void* object) { static_cast<T*>(object)->~T(); }
+
+  Arena(const Arena&);
+  Arena& operator = (const Arena&);
+
+  char* next_;
+  char* end_;
+  size_t bytes_;
+  std::vector<char*> blocks_;
+  std::vector<Destructor> destructors_;
+};
+
+} // namespace asmvm
+
+#endif
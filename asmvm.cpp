@@ -1,91 +1,535 @@
 #include "asmvm.h"
 
+#include <algorithm>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "host_functions.h"
+#include "op.h"
+#include "channel.h"
+#include "heap.h"
+#include "metrics.h"
+#include "threads.h"
 #include "params.h"
+#include "run_hooks.h"
 
 
 extern int yyparse();
 
 namespace asmvm {
 
-AsmMachine::AsmMachine() : static_data_end_addr_(0) {
+namespace {
+
+// Reserves the address space of a program and opens its first
+// kMaxMemorySize bytes. Untouched pages read as zero and take no memory.
+uint8_t* MapMemory() {
+  void* memory = mmap(NULL, kReservedMemorySize, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED || mprotect(memory, kMaxMemorySize, PROT_READ | PROT_WRITE) != 0) {
+    perror("mmap");
+    abort();
+  }
+  return static_cast<uint8_t*>(memory);
+}
+
+uint32_t PageSize() {
+  static const uint32_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+struct sigaction previous_fault_action;
+std::once_flag fault_handler_once;
+
+bool IsPowerOfTwo(int32_t value) {
+  return value > 0 && (value & (value - 1)) == 0;
+}
+
+uint32_t AlignUp(uint32_t value, uint32_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+AsmMachine::AsmMachine()
+  : data_memory_(MapMemory()), memory_(data_memory_), memory_size_(kDefaultMemorySize),
+    stack_end_(kDefaultMemorySize), guard_begin_(0), guard_end_(0),
+    static_data_end_addr_(0), reserve_end_addr_(0), data_alignment_(1),
+    reserve_alignment_(sizeof(int32_t)), fuel_(kUnlimitedFuel), block_start_(0),
+    resume_pc_(-1), exit_code_(0), instructions_(0), call_depth_(0),
+    host_functions_(&HostRegistry::Default()), output_(FileSink::Stdout()),
+    diagnostics_(FileSink::Stderr()), root_(this), threads_(NULL), channels_(NULL),
+    heap_(NULL), metrics_(NULL), syscall_log_(NULL), yield_on_block_(false), blocked_(false),
+    metered_(false) {
+  call_stack_[0].return_pc = 0;
+  call_stack_[0].frame_base = kNoFrame;
+  reset_registers();
+}
+
+AsmMachine::AsmMachine(AsmMachine* root)
+  : data_memory_(NULL), memory_(root->memory_), memory_size_(root->memory_size_),
+    // Thread stacks may be anywhere, the heap included.
+    stack_end_(root->memory_size_), guard_begin_(root->guard_begin_),
+    guard_end_(root->guard_end_),
+    program_(root->program_), static_data_end_addr_(root->static_data_end_addr_),
+    reserve_end_addr_(root->reserve_end_addr_), data_alignment_(root->data_alignment_),
+    reserve_alignment_(root->reserve_alignment_), fuel_(kUnlimitedFuel), block_start_(0),
+    resume_pc_(-1), exit_code_(0), instructions_(0), call_depth_(0),
+    host_functions_(root->host_functions_), output_(root->output_),
+    diagnostics_(root->diagnostics_), root_(root), threads_(NULL), channels_(NULL),
+    heap_(NULL), metrics_(root->metrics_), syscall_log_(root->syscall_log_),
+    yield_on_block_(false), blocked_(false), metered_(false) {
+  call_stack_[0].return_pc = 0;
+  call_stack_[0].frame_base = kNoFrame;
   reset_registers();
 }
 
 AsmMachine::~AsmMachine() {
-  for (SymbolTable::iterator i = symbol_table_.begin(); i != symbol_table_.end(); ++i) {
-    delete i->second;
-  }
-  for (int i=0; i < program_.size(); ++i) {
-    delete program_[i];
-  }
+  // Threads still running use the memory and files of this machine.
+  delete threads_;
+  delete channels_;
+  delete heap_;
+  if (root_ == this) delete metrics_;
+  // Instructions, operands and symbol values go away with the arenas.
   for (int i=0; i< open_files_.size(); ++i) {
     if (open_files_[i] != NULL) {
       ::fclose(open_files_[i]);
     }
   }
+  if (data_memory_ != NULL) munmap(data_memory_, kReservedMemorySize);
 }
 
-void AsmMachine::AddSymbol(const std::string& name, Value* value) {
-    if (value->kind() == Value::kValueKindVar) {
-      int32_t addr = -1;
-      if (value->type() == Value::kValueTypeInteger) {
-        int32_t* mem = reinterpret_cast<int32_t*>(data_memory_ + static_data_end_addr_);
-        IntegerValue* int_value = static_cast<IntegerValue*>(value);
-        *mem = int_value->value();
-        addr = static_data_end_addr_;
-        static_data_end_addr_ += sizeof(int32_t);
-      } else { // value->type() == Value::kValuTypeString
-        char* mem = reinterpret_cast<char*>(data_memory_ + static_data_end_addr_);
-        StringValue* str_value = static_cast<StringValue*>(value);
-        strcpy(mem, str_value->value().c_str());
-        addr = static_data_end_addr_; 
-        static_data_end_addr_ += str_value->value().length() + 1;
-      }
-      symbol_table_.insert(SymbolTable::value_type(name, new IntegerValue(Value::kValueKindVar, addr)));
-    } else {
-      symbol_table_.insert(SymbolTable::value_type(name, value));
+thread_local AsmMachine::FaultTrap* AsmMachine::current_trap_ = NULL;
+
+bool AsmMachine::EnableGuardPages() {
+  if (root_ != this || guarded() || heap_ != NULL) return false;
+  uint32_t page_size = PageSize();
+  uint32_t guard = AlignUp(reserve_end_addr_, page_size);
+  uint32_t stack = guard + page_size;
+  uint32_t end = stack + AlignUp(kDefaultMemorySize, page_size);
+  if (end > kMaxMemorySize) return false;
+  if (mprotect(memory_ + guard, page_size, PROT_NONE) != 0 ||
+      mprotect(memory_ + end, kMaxMemorySize - end, PROT_NONE) != 0) {
+    return false;
+  }
+  std::call_once(fault_handler_once, []() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = OnFault;
+    // Continue jumps out of the handler without restoring the signal mask.
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_fault_action);
+  });
+  guard_begin_ = guard;
+  guard_end_ = stack;
+  memory_size_ = end;
+  stack_end_ = end;
+  for (size_t i = 0; i < program_.size(); ++i) {
+    Instruction* unchecked = NewUncheckedInstruction(code_arena_, program_[i]);
+    if (unchecked != NULL) program_[i] = unchecked;
+  }
+  reset_registers();
+  return true;
+}
+
+void AsmMachine::EnterTrap(FaultTrap* trap) {
+  trap->vm = this;
+  trap->previous = current_trap_;
+  current_trap_ = trap;
+}
+
+void AsmMachine::LeaveTrap(FaultTrap* trap) {
+  current_trap_ = trap->previous;
+}
+
+void AsmMachine::OnFault(int signal, siginfo_t* info, void* context) {
+  const uint8_t* address = static_cast<const uint8_t*>(info->si_addr);
+  for (FaultTrap* trap = current_trap_; trap != NULL; trap = trap->previous) {
+    const uint8_t* memory = trap->vm->memory_;
+    if (address >= memory && uint64_t(address - memory) < kReservedMemorySize) {
+      trap->address = uint32_t(address - memory);
+      current_trap_ = trap;
+      siglongjmp(trap->jump, 1);
+    }
+  }
+  // Not VM memory: the instruction faults again under the previous action.
+  sigaction(SIGSEGV, &previous_fault_action, NULL);
+}
+
+AsmMachine::RunState AsmMachine::Fault(int64_t fuel, FaultTrap& trap) {
+  LeaveTrap(&trap);
+  Print("Invalid address [%d] at instruction %u. Memory fault.\n", int32_t(trap.address), reg_PC());
+  return Stop(fuel, -1);
+}
+
+ThreadGroup& AsmMachine::threads() {
+  AsmMachine* root = root_;
+  std::call_once(root->threads_once_, [root]() { root->threads_ = new ThreadGroup(root); });
+  return *root->threads_;
+}
+
+ChannelTable& AsmMachine::channels() {
+  AsmMachine* root = root_;
+  std::call_once(root->channels_once_, [root]() { root->channels_ = new ChannelTable(); });
+  return *root->channels_;
+}
+
+Heap& AsmMachine::heap() {
+  AsmMachine* root = root_;
+  std::call_once(root->heap_once_, [root]() { root->heap_ = new Heap(root); });
+  return *root->heap_;
+}
+
+Metrics& AsmMachine::EnableMetrics() {
+  if (metrics_ == NULL) metrics_ = new Metrics(*host_functions_);
+  return *metrics_;
+}
+
+void AsmMachine::RecordOpenFiles() {
+  uint32_t open = 0;
+  for (size_t i = 0; i < root_->open_files_.size(); ++i) {
+    if (root_->open_files_[i] != NULL) ++open;
+  }
+  metrics_->RecordOpenFiles(open);
+}
+
+uint32_t AsmMachine::heap_begin() const {
+  uint32_t page_size = PageSize();
+  return AlignUp(stack_end_, page_size) + (guarded() ? page_size : 0);
+}
+
+bool AsmMachine::GrowMemory(uint32_t size) {
+  if (root_ != this || size > kMaxMemorySize) return false;
+  if (size <= memory_size_) return true;
+  if (guarded()) {
+    // Only the pages past the last growth are closed.
+    uint32_t begin = std::max(memory_size_, heap_begin()) & ~(PageSize() - 1);
+    if (mprotect(memory_ + begin, AlignUp(size, PageSize()) - begin,
+                 PROT_READ | PROT_WRITE) != 0) {
+      return false;
+    }
+  }
+  // Threads pick the new size up in ReloadMemorySize.
+  __atomic_store_n(&memory_size_, size, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool AsmMachine::ReloadMemorySize(uint32_t address, uint32_t size) {
+  if (root_ == this) return false;
+  uint32_t memory_size = __atomic_load_n(&root_->memory_size_, __ATOMIC_ACQUIRE);
+  if (memory_size == memory_size_) return false;
+  memory_size_ = memory_size;
+  return address <= memory_size_ - size;
+}
+
+bool AsmMachine::CheckDataSize(uint32_t end, int32_t line) {
+  if (end <= kDefaultMemorySize) return true;
+  Diagnostic("Linha %d: .DATA excede os %u bytes de memória.\n", line, kDefaultMemorySize);
+  return false;
+}
+
+bool AsmMachine::AddSymbol(SymbolId symbol, Value* value, int32_t line) {
+  if (value->kind() != Value::kValueKindVar) return true;
+  int32_t addr = -1;
+  if (value->type() == Value::kValueTypeInteger) {
+    addr = AlignUp(static_data_end_addr_, sizeof(int32_t));
+    if (!CheckDataSize(addr + sizeof(int32_t), line)) return false;
+    data_alignment_ = std::max<uint32_t>(data_alignment_, sizeof(int32_t));
+    int32_t number = static_cast<IntegerValue*>(value)->value();
+    memcpy(memory_ + addr, &number, sizeof(number));
+    static_data_end_addr_ = addr + sizeof(int32_t);
+  } else { // value->type() == Value::kValuTypeString
+    const char* str = static_cast<StringValue*>(value)->value();
+    addr = static_data_end_addr_;
+    if (!CheckDataSize(addr + strlen(str) + 1, line)) return false;
+    strcpy(reinterpret_cast<char*>(memory_ + addr), str);
+    static_data_end_addr_ += strlen(str) + 1;
+  }
+  reserve_end_addr_ = static_data_end_addr_;
+  symbols_.Define(symbol, Symbol::kSymbolVar, addr, line);
+  return true;
+}
+
+bool AsmMachine::AddArrayElement(int32_t value, int32_t line) {
+  // The array so far ends the static data, already aligned.
+  if (!CheckDataSize(static_data_end_addr_ + sizeof(int32_t), line)) return false;
+  memcpy(memory_ + static_data_end_addr_, &value, sizeof(value));
+  static_data_end_addr_ += sizeof(int32_t);
+  reserve_end_addr_ = static_data_end_addr_;
+  return true;
+}
+
+bool AsmMachine::AlignData(int32_t alignment, int32_t line) {
+  if (!IsPowerOfTwo(alignment) || uint32_t(alignment) > kMaxDataAlignment) {
+    Diagnostic("Linha %d: alinhamento %d inválido (potência de 2 até %u).\n", line, alignment,
+               kMaxDataAlignment);
+    return false;
+  }
+  uint32_t end = AlignUp(static_data_end_addr_, alignment);
+  if (!CheckDataSize(end, line)) return false;
+  memset(memory_ + static_data_end_addr_, 0, end - static_data_end_addr_);
+  static_data_end_addr_ = end;
+  reserve_end_addr_ = end;
+  data_alignment_ = std::max<uint32_t>(data_alignment_, alignment);
+  return true;
+}
+
+bool AsmMachine::AlignReserve(int32_t alignment, int32_t line) {
+  if (!IsPowerOfTwo(alignment) || uint32_t(alignment) > kMaxDataAlignment) {
+    Diagnostic("Linha %d: alinhamento %d inválido (potência de 2 até %u).\n", line, alignment,
+               kMaxDataAlignment);
+    return false;
+  }
+  uint32_t end = AlignUp(reserve_end_addr_, alignment);
+  if (kDefaultMemorySize + (end - static_data_end_addr_) > kMaxMemorySize) {
+    Diagnostic("Linha %d: .BSS excede os %u bytes de memória.\n", line, kMaxMemorySize);
+    return false;
+  }
+  reserve_end_addr_ = end;
+  memory_size_ = kDefaultMemorySize + reserve_size();
+  stack_end_ = memory_size_;
+  reserve_alignment_ = std::max<uint32_t>(reserve_alignment_, alignment);
+  return true;
+}
+
+bool AsmMachine::AddReserve(SymbolId symbol, int32_t size, int32_t line) {
+  uint32_t addr = AlignUp(reserve_end_addr_, sizeof(int32_t));
+  if (size <= 0) {
+    Diagnostic("Linha %d: tamanho %d inválido.\n", line, size);
+    return false;
+  }
+  if (kDefaultMemorySize + (addr - static_data_end_addr_) + uint32_t(size) > kMaxMemorySize) {
+    Diagnostic("Linha %d: .BSS excede os %u bytes de memória.\n", line, kMaxMemorySize);
+    return false;
+  }
+  reserve_end_addr_ = addr + size;
+  memory_size_ = kDefaultMemorySize + reserve_size();
+  stack_end_ = memory_size_;
+  symbols_.Define(symbol, Symbol::kSymbolVar, addr, line);
+  return true;
+}
+
+bool AsmMachine::LoadStaticData(const uint8_t* data, uint32_t size, uint32_t reserve_size) {
+  if (size > kDefaultMemorySize || reserve_size > kMaxMemorySize - kDefaultMemorySize) return false;
+  memcpy(memory_, data, size);
+  static_data_end_addr_ = size;
+  reserve_end_addr_ = size + reserve_size;
+  memory_size_ = kDefaultMemorySize + reserve_size;
+  stack_end_ = memory_size_;
+  return true;
+}
+
+bool AsmMachine::AddImport(SymbolId module, int line) {
+  const char* name = symbols_[module].name;
+  if (strchr(name, '.') != NULL) {
+    Diagnostic("Linha %d: nome de módulo %s inválido.\n", line, name);
+    return false;
+  }
+  imports_.push_back(name);
+  return true;
+}
+
+bool AsmMachine::AppendModuleData(const std::string& module, const uint8_t* data, uint32_t size,
+                                  uint32_t data_alignment, uint32_t reserve_size,
+                                  uint32_t reserve_alignment, uint32_t* data_base,
+                                  uint32_t* reserve_base) {
+  uint32_t base = AlignUp(static_data_end_addr_, data_alignment);
+  if (size > kDefaultMemorySize || base > kDefaultMemorySize - size) {
+    Diagnostic("Módulo %s: .DATA excede os %u bytes de memória.\n", module.c_str(),
+               kDefaultMemorySize);
+    return false;
+  }
+  // The .BSS so far moves past the new data by a multiple of its alignment.
+  uint32_t old_end = static_data_end_addr_;
+  uint32_t shift = AlignUp(base + size - old_end, reserve_alignment_);
+  // Module .BSS addresses keep their offset from any multiple of its alignment.
+  uint32_t module_data_end = size;
+  uint32_t end = reserve_end_addr_ + shift;
+  uint32_t module_reserve = end + ((module_data_end - end) & (reserve_alignment - 1));
+  if (uint64_t(module_reserve) + reserve_size - (base + size) >
+      kMaxMemorySize - kDefaultMemorySize) {
+    Diagnostic("Módulo %s: .BSS excede os %u bytes de memória.\n", module.c_str(),
+               kMaxMemorySize);
+    return false;
+  }
+  for (SymbolId id = 0; id < symbols_.size(); ++id) {
+    Symbol& symbol = symbols_[id];
+    if (symbol.kind == Symbol::kSymbolVar && uint32_t(symbol.value) >= old_end) {
+      symbol.value += shift;
+    }
+  }
+  memset(memory_ + old_end, 0, base - old_end);
+  memcpy(memory_ + base, data, size);
+  static_data_end_addr_ = base + size;
+  reserve_end_addr_ = module_reserve + reserve_size;
+  memory_size_ = kDefaultMemorySize + this->reserve_size();
+  stack_end_ = memory_size_;
+  data_alignment_ = std::max(data_alignment_, data_alignment);
+  reserve_alignment_ = std::max(reserve_alignment_, reserve_alignment);
+  *data_base = base;
+  *reserve_base = module_reserve;
+  return true;
+}
+
+void AsmMachine::AddLabel(SymbolId label, int32_t line) {
+  symbols_.Define(label, Symbol::kSymbolLabel, program_.size(), line);
+}
+
+bool AsmMachine::Link() {
+  bool ok = true;
+  for (SymbolId id = 0; id < symbols_.size(); ++id) {
+    Symbol& symbol = symbols_[id];
+    if (symbol.redefined_line != 0) {
+      Diagnostic("Linha %d: símbolo %s redefinido (primeira definição na linha %d).\n",
+              symbol.redefined_line, symbol.name, symbol.line);
+      symbol.reported = true;
+      ok = false;
     }
   }
+  for (size_t i = 0; i < program_.size(); ++i) {
+    ok = program_[i]->Link(*this) && ok;
+  }
+  if (ok) EliminateTailCalls();
+  return ok;
+}
 
-void AsmMachine::add_labeled_instruction(const std::string& label, Instruction* instruction) {
-  AddSymbol(label, new IntegerValue(Value::kValueKindLabel, program_.size()));
-  add_instruction(instruction);
+void AsmMachine::EliminateTailCalls() {
+  // CALL f; RET returns to our caller as soon as f returns, so f can return
+  // there directly and reuse our return stack record. Any label on the RET
+  // still finds it in place.
+  for (size_t i = 0; i + 1 < program_.size(); ++i) {
+    if (program_[i]->opcode() != Instruction::kOpCall) continue;
+    if (program_[i + 1]->opcode() != Instruction::kOpRet) continue;
+    OpJmp* jmp = code_arena_.New<OpJmp>(static_cast<OpCall*>(program_[i])->label());
+    jmp->Link(*this);
+    program_[i] = jmp;
+  }
+}
+
+bool AsmMachine::ResolveSymbol(SymbolId id, Symbol::Kind kind, int32_t* out_value) {
+  Symbol& symbol = symbols_[id];
+  if (symbol.kind != Symbol::kSymbolUndefined && (kind == Symbol::kSymbolUndefined || symbol.kind == kind)) {
+    *out_value = symbol.value;
+    return true;
+  }
+  if (!symbol.reported) {
+    if (symbol.kind == Symbol::kSymbolUndefined) {
+      Diagnostic("Linha %d: símbolo %s não definido.\n", symbol.line, symbol.name);
+    } else {
+      Diagnostic("%s (definido na linha %d) não é %s.\n", symbol.name, symbol.line,
+              kind == Symbol::kSymbolLabel ? "um rótulo" : "uma variável");
+    }
+    symbol.reported = true;
+  }
+  return false;
 }
 
 void AsmMachine::reset_registers() {
   for(int i=0; i<10; ++i) {
     register_set_[i] = 0;
   }
-  register_set_[kRegisterIndexSt] = static_data_end_addr_;
+  register_set_[kRegisterIndexSt] = guarded() ? guard_end_ : reserve_end_addr_;
 }
 
 int32_t AsmMachine::Run() {
-  reset_registers();
-  Instruction *ins = program_[reg_PC()];
-  int32_t temp_PC;
-  //log_regs();
-  while ((temp_PC = ins->Exec(*this)) >= 0) {
-    ins = program_[temp_PC];
-    set_register(kRegisterIndexPc, temp_PC);
-    //log_regs();
-    //getchar();
+  Reset();
+  if (metrics_ != NULL) {
+    StackHighWater hooks(metrics_, reg_ST());
+    Continue(kUnlimitedFuel, hooks);
+  } else {
+    Continue(kUnlimitedFuel);
   }
-  if (!call_stack_.empty()) {
-    printf("A pilha de chamadas não está vazia. Cheque se há chamadas para a instrução RET" 
-           " em todas as funções.\n");
+  return exit_code_;
+}
+
+void AsmMachine::Reset() {
+  reset_registers();
+  call_depth_ = 0;
+  call_stack_[0].frame_base = kNoFrame;
+  call_stack_[1].return_pc = 0;
+  fuel_ = kUnlimitedFuel;
+  block_start_ = 0;
+  resume_pc_ = -1;
+  exit_code_ = 0;
+  instructions_ = 0;
+}
+
+AsmMachine::RunState AsmMachine::Continue(int64_t fuel) {
+  NoHooks hooks;
+  return Continue(fuel, hooks);
+}
+
+void AsmMachine::PrepareCall(int32_t entry) {
+  Reset();
+  set_register(kRegisterIndexPc, entry);
+  block_start_ = entry;
+  call_depth_ = 1;
+  call_stack_[1].return_pc = kHostReturnPc;
+  call_stack_[1].frame_base = kNoFrame;
+}
+
+namespace {
+
+void VPrint(OutputSink* sink, const char* format, va_list args) {
+  char buffer[256];
+  va_list copy;
+  va_copy(copy, args);
+  int size = vsnprintf(buffer, sizeof(buffer), format, copy);
+  va_end(copy);
+  if (size < 0) return;
+  if (size_t(size) < sizeof(buffer)) {
+    sink->Write(buffer, size);
+  } else {
+    std::string big(size + 1, '\0');
+    vsnprintf(&big[0], big.size(), format, args);
+    sink->Write(big.data(), size);
   }
-  return -1 - temp_PC;
 }
 
-bool AsmMachine::GetSymbolValue(const std::string& symbol, Value** out_value) {
-  auto itr = symbol_table_.find(symbol);
-  if (itr == symbol_table_.end()) {
-    return false;
+} // namespace
+
+void AsmMachine::Print(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  VPrint(output_, format, args);
+  va_end(args);
+}
+
+void AsmMachine::Diagnostic(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  VPrint(diagnostics_, format, args);
+  va_end(args);
+}
+
+AsmMachine::RunState AsmMachine::Stop(int64_t fuel, int32_t temp_PC) {
+  // An EXIT with code INT32_MAX also returns kPcSuspend; resume_pc_ tells
+  // them apart.
+  if (temp_PC == kPcSuspend && resume_pc_ >= 0) {
+    set_register(kRegisterIndexPc, resume_pc_);
+    instructions_ += fuel - fuel_;
+    return kRunSuspended;
   }
-  *out_value = itr->second;
-  return true;
+  // The last block ends at the instruction that stopped the machine.
+  fuel_ -= int64_t(reg_PC()) - block_start_ + 1;
+  instructions_ += fuel - fuel_;
+  if (temp_PC == kPcSuspend && resume_pc_ == kResumeHost) {
+    exit_code_ = get_register(0);
+    return kRunReturned;
+  }
+  // A program called by the host keeps the host frame until it returns.
+  uint32_t host_depth = call_stack_[1].return_pc == kHostReturnPc ? 1 : 0;
+  if (call_depth_ > host_depth) {
+    Print("A pilha de chamadas não está vazia. Cheque se há chamadas para a instrução RET" 
+          " em todas as funções.\n");
+  }
+  exit_code_ = -1 - temp_PC;
+  if (root_ == this && channels_ != NULL) channels_->ReleaseAll();
+  return kRunExited;
 }
 
 } // namespace asmvm
@@ -1,14 +1,27 @@
 #ifndef ASMVM_H
 #define ASMVM_H
 
-#include <map>
+#include <mutex>
 #include <vector>
 #include <string>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+#include "output_sink.h"
+#include "symbol_table.h"
 
 namespace asmvm {
 
 class AsmMachine;
+class HostRegistry;
+class ChannelTable;
+class Heap;
+class Metrics;
+class SysCallLog;
+class ThreadGroup;
 
 class Value {
  public:
@@ -22,7 +35,6 @@ class Value {
     kValueKindConst
   };
   explicit Value(ValueKind kind) : kind_(kind) {}
-  virtual ~Value() {}
   virtual ValueType type() const = 0;
   ValueKind kind() const { return kind_; }
  private:
@@ -32,29 +44,212 @@ class Value {
 
 class Instruction {
  public:
-  virtual ~Instruction() {}
+  enum Opcode {
+    kOpAdd,
+    kOpSub,
+    kOpMul,
+    kOpDiv,
+    kOpMod,
+    kOpAnd,
+    kOpOr,
+    kOpXor,
+    kOpShl,
+    kOpShr,
+    kOpNot,
+    kOpJmp,
+    kOpCall,
+    kOpRet,
+    kOpJz,
+    kOpJnz,
+    kOpMov,
+    kOpPush,
+    kOpPop,
+    kOpLd1,
+    kOpLd2,
+    kOpLd4,
+    kOpExit,
+    kOpInc,
+    kOpDec,
+    kOpPrint,
+    kOpSt1,
+    kOpSt2,
+    kOpSt4,
+    kOpSysCall,
+    kOpPushN,
+    kOpPopN,
+    kOpFprint,
+    kOpSprint,
+    kOpEnter,
+    kOpLeave,
+    kOpXadd,
+    kOpCas,
+    kOpLd4Acquire,
+    kOpSt4Release,
+    kOpStepJump,
+    kOpArithJump
+  };
   virtual int32_t Exec(AsmMachine& vm) = 0;
+  virtual Opcode opcode() const = 0;
+  // Resolves symbol references once the whole program is known.
+  virtual bool Link(AsmMachine& vm) { return true; }
 };
 
 const uint32_t kDefaultMemorySize = 2048; // 2KB
+// Memory a program can use. Pages are committed by the kernel as they are
+// first touched, so .BSS buffers cost nothing until used.
+const uint32_t kMaxMemorySize = 1 << 24; // 16MB
+// Address space reserved for each program: every 32 bit address, plus room
+// for the widest access at the last one. What is beyond the memory in use is
+// mapped PROT_NONE, so that stray accesses fault (see EnableGuardPages).
+const uint64_t kReservedMemorySize = (uint64_t(1) << 32) + 4096;
+const uint32_t kMaxDataAlignment = 4096;
 const uint32_t kRegisterIndexPc = 9;
 const uint32_t kRegisterIndexSt = 8;
+const uint32_t kMaxCallDepth = 1024;
+const int32_t kNoFrame = -1;
+// Return address of the frame of a function called by the host (see
+// AsmMachine::PrepareCall).
+const uint32_t kHostReturnPc = 0xFFFFFFFF;
+// Returned by Exec when the machine ran out of fuel (see AsmMachine::Branch).
+const int32_t kPcSuspend = INT32_MIN;
+const int64_t kUnlimitedFuel = INT64_MAX;
+const size_t kFileBufferSize = 1 << 16;
+
+// Return stack record of one active call.
+struct CallFrame {
+  uint32_t return_pc;  // The CALL instruction.
+  int32_t frame_base;  // ST at ENTER, or kNoFrame.
+};
 
 class AsmMachine {
  public:
-  typedef std::map<std::string, Value*> SymbolTable;
-  
+  enum RunState {
+    kRunExited,
+    kRunSuspended,
+    kRunReturned  // A function started with PrepareCall returned.
+  };
+
   AsmMachine();
+  // Machine for a thread of root's program (see threads.h). It shares the
+  // memory, program, host functions, files and output of root, and has
+  // registers and a call stack of its own.
+  explicit AsmMachine(AsmMachine* root);
   ~AsmMachine();
+
+  // Replaces the software bounds checks of loads, stores, PUSH and POP with
+  // PROT_NONE pages: one between the data (.DATA and .BSS) and the stack,
+  // which moves to pages of its own, and everything after the stack. An
+  // access that faults stops the machine with a message giving the address
+  // and instruction, instead of being reported and skipped. Installs a
+  // SIGSEGV handler that passes faults outside VM memory on to the previous
+  // one. Call on a loaded program, before running it, starting threads or
+  // using the heap. A guarded heap starts after another guard page.
+  bool EnableGuardPages();
+  bool guarded() const { return guard_end_ != 0; }
+  // End of the accessible memory containing address: the guard page before
+  // the stack or the heap, or memory_size(). address itself if it is not
+  // accessible.
+  uint32_t region_end(uint32_t address) {
+    if (!in_memory(address, 1)) return address;
+    if (!guarded()) return memory_size_;
+    if (address < guard_begin_) return guard_begin_;
+    if (address < guard_end_) return address;
+    if (address < stack_end_) return stack_end_;
+    if (address < heap_begin()) return address;
+    return memory_size_;
+  }
     
-  const uint8_t* data() const { return data_memory_; }
-  void AddSymbol(const std::string& name, Value* value);
+  uint8_t* data() { return memory_; }
+  const uint8_t* data() const { return memory_; }
+  // Bytes of memory the program may use: kDefaultMemorySize for .DATA and the
+  // stack, plus the .BSS section, plus the heap once it is used.
+  uint32_t memory_size() const { return memory_size_; }
+  // Where the stack of the program ends.
+  uint32_t stack_end() const { return stack_end_; }
+  // Whether the size bytes at address are in memory. The heap may have grown
+  // on another thread, so misses take another look at the root.
+  bool in_memory(uint32_t address, uint32_t size) {
+    return address <= memory_size_ - size || ReloadMemorySize(address, size);
+  }
+  // Aligned word of memory for the atomic instructions, or NULL if address
+  // is not a multiple of 4 or out of range.
+  int32_t* atomic_word(uint32_t address) {
+    if (address % sizeof(int32_t) != 0 || !in_memory(address, sizeof(int32_t))) return NULL;
+    return reinterpret_cast<int32_t*>(memory_ + address);
+  }
+  AsmMachine* root() { return root_; }
+  // Heap of the program (see heap.h), created on first use. Always that of
+  // the root.
+  Heap& heap();
+  // Where the heap starts: the page after the stack, or after its guard page.
+  uint32_t heap_begin() const;
+  // Extends the memory of the program to size bytes, for the heap. Root only.
+  bool GrowMemory(uint32_t size);
+  // Threads of the program, created on first use. Always those of the root.
+  ThreadGroup& threads();
+  // Channels of the program (see channel.h), created on first use. Always
+  // those of the root, whose exit releases their sending ends.
+  ChannelTable& channels();
+  // Starts collecting the metrics of the program (see metrics.h), before it
+  // runs. Root only.
+  Metrics& EnableMetrics();
+  // NULL unless enabled. Shared by the threads of the program.
+  Metrics* metrics() const { return metrics_; }
+  // Log the host dependent SYSCALLs are recorded to or replayed from (see
+  // syscall_log.h), NULL for none. Not owned. Set on the root before it runs;
+  // its threads share it.
+  SysCallLog* syscall_log() const { return syscall_log_; }
+  void set_syscall_log(SysCallLog* log) { syscall_log_ = log; }
+  uint32_t static_data_size() const { return static_data_end_addr_; }
+  // Zero-initialized bytes after the static data, up to where the stack starts.
+  uint32_t reserve_size() const { return reserve_end_addr_ - static_data_end_addr_; }
+  // Replaces the .DATA section with a previously built one, followed by
+  // reserve_size bytes of .BSS (see image.h).
+  bool LoadStaticData(const uint8_t* data, uint32_t size, uint32_t reserve_size);
+  // Lays a .DATA value out in the static data and binds symbol to its address.
+  // Integers are aligned to 4 bytes. False, after reporting, if it does not fit.
+  bool AddSymbol(SymbolId symbol, Value* value, int32_t line);
+  // Appends the next element of an integer array started by AddSymbol.
+  bool AddArrayElement(int32_t value, int32_t line);
+  // Pads the static data (.DATA) or the reserve (.BSS) to a multiple of
+  // alignment, a power of two up to kMaxDataAlignment.
+  bool AlignData(int32_t alignment, int32_t line);
+  bool AlignReserve(int32_t alignment, int32_t line);
+  // Binds symbol to size zeroed bytes of .BSS, aligned to 4 bytes. The
+  // reserve follows the static data, so .BSS comes after .DATA.
+  bool AddReserve(SymbolId symbol, int32_t size, int32_t line);
+  // Binds label to the next instruction added.
+  void AddLabel(SymbolId label, int32_t line);
+  // Alignment the static data and the .BSS need from where they are placed:
+  // the largest of their .ALIGNs and variables.
+  uint32_t data_alignment() const { return data_alignment_; }
+  uint32_t reserve_alignment() const { return reserve_alignment_; }
+  // Places a module's static data after the program's, and its .BSS, which
+  // is reserve_size bytes aligned to reserve_alignment that followed its
+  // data at data_end, after the program's .BSS, which moves up to make room.
+  // Stores where module address 0 and data_end went. False, after
+  // reporting, if they do not fit.
+  bool AppendModuleData(const std::string& module, const uint8_t* data, uint32_t size,
+                        uint32_t data_alignment, uint32_t reserve_size,
+                        uint32_t reserve_alignment, uint32_t* data_base,
+                        uint32_t* reserve_base);
+
+  // Modules of .IMPORT lines, linked in by parser::Parse (see module.h).
+  bool AddImport(SymbolId module, int line);
+  const std::vector<std::string>& imports() const { return imports_; }
   
+  // Operands, symbol values and strings of the program.
+  Arena& arena() { return arena_; }
+  // Instructions only, so they end up contiguous and in program order.
+  Arena& code_arena() { return code_arena_; }
+
   void add_instruction(Instruction* instruction) {
     program_.push_back(instruction);
   }
   
-  void add_labeled_instruction(const std::string& label, Instruction* instruction);
+  const std::vector<Instruction*>& program() const { return program_; }
+  // Replaces the instructions, which have to be linked again.
+  void set_program(const std::vector<Instruction*>& program) { program_ = program; }
   
   int32_t get_register(uint32_t rindex) const {
     return register_set_[rindex];
@@ -67,26 +262,111 @@ class AsmMachine {
   uint32_t reg_PC() const { return register_set_[kRegisterIndexPc]; }
   uint32_t reg_ST() const { return register_set_[kRegisterIndexSt]; }
   
+  // Runs the program from the start until it exits. Returns its exit code.
   int32_t Run();
+
+  // Resumable execution, for running untrusted programs under a budget.
+  // Reset() rewinds the machine to the first instruction; each Continue(fuel)
+  // then executes about fuel instructions more and either finishes or
+  // suspends at a block boundary, to be continued later.
+  void Reset();
+  RunState Continue(int64_t fuel);
+  // Same, calling back into a hooks policy as it goes (see run_hooks.h).
+  template <class Hooks> RunState Continue(int64_t fuel, Hooks& hooks);
+  // Exit code, or R1 for kRunReturned.
+  int32_t exit_code() const { return exit_code_; }
+  // Instructions executed since the last Reset().
+  uint64_t instructions() const { return instructions_; }
+  // Resets the machine to call the function at instruction entry on behalf
+  // of the host: its RET makes Continue return kRunReturned. The data memory
+  // keeps whatever previous runs left in it.
+  void PrepareCall(int32_t entry);
+  // For RET from the frame set up by PrepareCall.
+  int32_t ReturnToHost() {
+    resume_pc_ = kResumeHost;
+    return kPcSuspend;
+  }
+
+  // Where program output and diagnostics go, stdout and stderr by default.
+  // Sinks are not owned.
+  void set_output(OutputSink* sink) { output_ = sink; }
+  void set_diagnostics(OutputSink* sink) { diagnostics_ = sink; }
+  OutputSink* diagnostics() const { return diagnostics_; }
+  void Write(const char* data, size_t size) { output_->Write(data, size); }
+  void Flush() { output_->Flush(); }
+  void Print(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  void Diagnostic(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+  // Ends the basic block at the current instruction, moving on to target.
+  // Branches, calls and returns go through here, so fuel is charged a whole
+  // block at a time and the straight-line code in between runs unchecked.
+  // A run can overshoot its budget by at most one block.
+  int32_t Branch(int32_t target) {
+    fuel_ -= int64_t(reg_PC()) - block_start_ + 1;
+    block_start_ = target;
+    if (fuel_ > 0) return target;
+    resume_pc_ = target;
+    return kPcSuspend;
+  }
+  // For host functions that would block (see kHostWouldBlock): suspends
+  // before the current instruction, which runs again on the next Continue.
+  int32_t Yield() {
+    fuel_ -= int64_t(reg_PC()) - block_start_;
+    block_start_ = reg_PC();
+    resume_pc_ = reg_PC();
+    blocked_ = true;
+    return kPcSuspend;
+  }
+  // Set for machines run by a Scheduler, so a blocking host function gives
+  // the thread back to it instead of blocking the thread.
+  bool yield_on_block() const { return yield_on_block_; }
+  void set_yield_on_block(bool yield) { yield_on_block_ = yield; }
+  // Whether the last Continue suspended in Yield.
+  bool blocked() const { return blocked_; }
+  // Whether the current Continue runs on a budget of fuel, not kUnlimitedFuel.
+  bool metered() const { return metered_; }
   
-  SymbolTable& symbol_table() { return symbol_table_; }
-  const SymbolTable& symbol_table() const { return symbol_table_; }
-  bool GetSymbolValue(const std::string& symbol, Value** out_value);
+  SymbolTable& symbols() { return symbols_; }
+  const SymbolTable& symbols() const { return symbols_; }
 
-  void call_push() {
-    call_stack_.push_back(reg_PC());
+  // Links every instruction. Duplicate and undefined symbols are reported on
+  // stderr, once per symbol, and make the program unrunnable.
+  bool Link();
+  // For Instruction::Link. kind is the kind of symbol expected at the
+  // reference, or Symbol::kSymbolUndefined if any defined symbol will do.
+  bool ResolveSymbol(SymbolId id, Symbol::Kind kind, int32_t* out_value);
+  // Host functions SYSCALL instructions are bound to when linking. Defaults
+  // to HostRegistry::Default().
+  const HostRegistry& host_functions() const { return *host_functions_; }
+  void set_host_functions(const HostRegistry* registry) { host_functions_ = registry; }
+  // Rewrites CALL directly followed by RET into a JMP, so that tail
+  // recursion runs with a constant return stack. Part of Link().
+  void EliminateTailCalls();
+
+  // The return stack is preallocated and bounded. Record 0 is the root frame
+  // of the main program, so ENTER/LEAVE work outside functions too.
+  bool call_push() {
+    if (call_depth_ + 1 == kMaxCallDepth) return false;
+    ++call_depth_;
+    call_stack_[call_depth_].return_pc = reg_PC();
+    call_stack_[call_depth_].frame_base = kNoFrame;
+    return true;
   }
 
-  uint32_t call_pop() {
-    uint32_t last_call = call_stack_.back();
-    call_stack_.pop_back();
-    return last_call;
+  bool call_pop(uint32_t* return_pc) {
+    if (call_depth_ == 0) return false;
+    *return_pc = call_stack_[call_depth_].return_pc;
+    --call_depth_;
+    return true;
   }
 
+  uint32_t call_depth() const { return call_depth_; }
+  CallFrame& current_frame() { return call_stack_[call_depth_]; }
+
   bool push_reg(uint32_t rindex) {
-    if (reg_ST() + sizeof(uint32_t) >= kDefaultMemorySize) return false;
+    if (reg_ST() + sizeof(uint32_t) >= stack_end_) return false;
     
-    int32_t* mem = reinterpret_cast<int32_t*>(data_memory_ + reg_ST());
+    int32_t* mem = reinterpret_cast<int32_t*>(memory_ + reg_ST());
     *mem = register_set_[rindex];
     set_register(kRegisterIndexSt, reg_ST() + sizeof(uint32_t));
     return true;
@@ -94,9 +374,9 @@ class AsmMachine {
 
   // Usefull with int32_t, int16_t, int8_t and its unsigned counterparts.
   template <typename inttype> bool push_value(inttype value, uint32_t base_address, int32_t offset) {
-    if (reg_ST() + sizeof(inttype) >= kDefaultMemorySize) return false;
+    if (reg_ST() + sizeof(inttype) >= stack_end_) return false;
     
-    inttype* mem = reinterpret_cast<inttype*>(data_memory_ + base_address + offset);
+    inttype* mem = reinterpret_cast<inttype*>(memory_ + base_address + offset);
     *mem = value;
     set_register(kRegisterIndexSt, reg_ST() + sizeof(inttype));
     return true;
@@ -106,11 +386,29 @@ class AsmMachine {
     return push_value(value, reg_ST(), 0);
   }
 
+  // Accesses of guarded machines, left to the guard pages to check. Addresses
+  // wrap around within the reserved space.
+  template <typename inttype> inttype load_unchecked(uint32_t address) const {
+    inttype value;
+    memcpy(&value, memory_ + address, sizeof(value));
+    return value;
+  }
+  template <typename inttype> void store_unchecked(uint32_t address, inttype value) {
+    memcpy(memory_ + address, &value, sizeof(value));
+  }
+
+  // For ST1/ST2/ST4. Unlike push_value, leaves ST alone.
+  template <typename inttype> bool store_value(uint32_t address, inttype value) {
+    if (!in_memory(address, sizeof(inttype))) return false;
+    *reinterpret_cast<inttype*>(memory_ + address) = value;
+    return true;
+  }
+
   template <typename inttype> bool load_value(uint32_t base_address, int32_t offset, inttype* out_value) {
     int32_t addr = base_address + offset;
-    if (addr < 0) return false;
+    if (addr < 0 || !in_memory(addr, sizeof(inttype))) return false;
     if (out_value == NULL) return false;
-    *out_value = *reinterpret_cast<inttype*>(data_memory_ + addr);
+    *out_value = *reinterpret_cast<inttype*>(memory_ + addr);
     return true;
   }
 
@@ -118,34 +416,64 @@ class AsmMachine {
     int32_t addr = reg_ST() - sizeof(int32_t);
     if (addr < 0) return false;
     if (out != NULL) {
-      *out = *reinterpret_cast<int32_t*>(data_memory_ + addr);
+      *out = *reinterpret_cast<int32_t*>(memory_ + addr);
     }
     set_register(kRegisterIndexSt, addr);
     return true;
   }
 
+  // Open files belong to the root machine and are shared by its threads.
   uint32_t fopen(const char* filename, const char* mode) {
     FILE* f = ::fopen(filename, mode);
     if (!f) return 0;
-    open_files_.push_back(f);
-    return open_files_.size();
+    // Large reads keep read_numbers out of the kernel.
+    setvbuf(f, NULL, _IOFBF, kFileBufferSize);
+    std::lock_guard<std::mutex> lock(root_->files_mutex_);
+    root_->open_files_.push_back(f);
+    if (metrics_ != NULL) RecordOpenFiles();
+    return root_->open_files_.size();
   }
 
   void fclose(uint32_t handler) {
-    ::fclose(open_files_[handler-1]);
-    open_files_[handler-1] = NULL;
+    std::lock_guard<std::mutex> lock(root_->files_mutex_);
+    ::fclose(root_->open_files_[handler-1]);
+    root_->open_files_[handler-1] = NULL;
   }
 
   FILE* file(uint32_t handler) {
-    if (handler > open_files_.size()) {
+    std::lock_guard<std::mutex> lock(root_->files_mutex_);
+    if (handler > root_->open_files_.size()) {
       return NULL;
     } else {
-      return open_files_[handler-1];
+      return root_->open_files_[handler-1];
     }
   }
 
  private:
+  static const int32_t kResumeHost = -2;
+
+  // Open files high-water mark, for fopen with files_mutex_ held.
+  void RecordOpenFiles();
+
   inline void reset_registers();
+  bool CheckDataSize(uint32_t end, int32_t line);
+  // The parts of Continue that do not depend on the hooks policy.
+  template <class Hooks> void BeforeExec(Hooks& hooks, const Instruction& ins);
+  template <class Hooks> void AfterExec(Hooks& hooks, const Instruction& ins, int32_t next_pc);
+  RunState Stop(int64_t fuel, int32_t temp_PC);
+  bool ReloadMemorySize(uint32_t address, uint32_t size);
+  // Where Continue goes back to when a guarded machine faults.
+  struct FaultTrap {
+    sigjmp_buf jump;
+    const AsmMachine* vm;
+    uint32_t address;
+    FaultTrap* previous;
+  };
+  void EnterTrap(FaultTrap* trap);
+  void LeaveTrap(FaultTrap* trap);
+  RunState Fault(int64_t fuel, FaultTrap& trap);
+  static void OnFault(int signal, siginfo_t* info, void* context);
+  static thread_local FaultTrap* current_trap_;
   void log_regs() {
     for (int i=0; i<10; ++i) {
       if (i == kRegisterIndexPc) {
@@ -157,13 +485,46 @@ class AsmMachine {
       }
     }
   }
-  SymbolTable symbol_table_;
-  uint8_t data_memory_[kDefaultMemorySize];
+  Arena arena_;
+  Arena code_arena_;
+  SymbolTable symbols_;
+  uint8_t* data_memory_;  // kMaxMemorySize bytes mapped by the root, else NULL.
+  uint8_t* memory_;  // data_memory_ of the root machine.
+  uint32_t memory_size_;
+  uint32_t stack_end_;
+  uint32_t guard_begin_;  // The guard page below the stack of guarded machines.
+  uint32_t guard_end_;    // Where their stack starts. 0 when not guarded.
   std::vector<Instruction*> program_;
   int32_t register_set_[10]; // 8 general purpose registers + 2 specific: ST and PC.
   uint32_t static_data_end_addr_;
-  std::vector<uint32_t> call_stack_;
+  uint32_t reserve_end_addr_;  // Where the stack starts.
+  uint32_t data_alignment_;
+  uint32_t reserve_alignment_;
+  std::vector<std::string> imports_;
+  int64_t fuel_;
+  int32_t block_start_;
+  int32_t resume_pc_;
+  int32_t exit_code_;
+  uint64_t instructions_;
+  CallFrame call_stack_[kMaxCallDepth];
+  uint32_t call_depth_;
+  const HostRegistry* host_functions_;
+  OutputSink* output_;
+  OutputSink* diagnostics_;
   std::vector<FILE*> open_files_;
+  std::mutex files_mutex_;
+  AsmMachine* root_;
+  ThreadGroup* threads_;
+  std::once_flag threads_once_;
+  ChannelTable* channels_;
+  std::once_flag channels_once_;
+  Heap* heap_;
+  std::once_flag heap_once_;
+  Metrics* metrics_;
+  SysCallLog* syscall_log_;
+  bool yield_on_block_;
+  bool blocked_;
+  bool metered_;
 };
 
 } // namespace asmvm
@@ -2,7 +2,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <iostream>
-#include <list>
+#include <vector>
 #include "op.h"
 #include "asmvm.h"
 #include "params.h"
@@ -13,11 +13,20 @@ extern int yylex();
 extern int lineNumber;
 int yyerror(const char *msg)
 	{
-		fprintf(stderr, "Linha %d: %s\n", lineNumber+1, msg);	
+		asmvm::parser::StaticHolder::instance().vm().Diagnostic("Linha %d: %s\n", lineNumber+1, msg);	
 		return 1;
 		
 	}
 
+// Everything built while parsing lives in the arenas of the program being parsed.
+static asmvm::Arena& arena() {
+  return asmvm::parser::StaticHolder::instance().vm().arena();
+}
+
+static asmvm::Arena& code_arena() {
+  return asmvm::parser::StaticHolder::instance().vm().code_arena();
+}
+
 %}
 %token ADD
 %token SUB
@@ -53,6 +62,12 @@ int yyerror(const char *msg)
 %token POPN
 %token FPRINT
 %token SPRINT
+%token ENTER
+%token LEAVE
+%token XADD
+%token CAS
+%token LD4A
+%token ST4R
 %token REGISTER
 %token L_INT
 %token L_HEX
@@ -60,10 +75,14 @@ int yyerror(const char *msg)
 %token IDENTIFIER
 %token LABEL
 %token STATIC
+%token RESERVE
+%token ALIGN
+%token IMPORT
 %token CODE
 %token L_BRACKET
 %token R_BRACKET
 %token COLON
+%token COMMA
 %token ASSIGN
 
 %type <rindex> REGISTER
@@ -71,7 +90,7 @@ int yyerror(const char *msg)
 %type <int_value> L_HEX
 %type <int_value> IntValue 
 %type <str> L_STRING
-%type <str> IDENTIFIER
+%type <symbol> IDENTIFIER
 %type <value> Value
 %type <instruction> Instruction
 %type <ternary> TernaryInstructions
@@ -85,11 +104,12 @@ int yyerror(const char *msg)
 %type <address> Address
 %type <print_arg_list> PrintArgList
 %type <printable> PrintArg
-%type <str> LABEL
+%type <symbol> LABEL
 
 %union {
-	char *str;
+	const char *str;
   uint32_t rindex;
+  asmvm::SymbolId symbol;
   int32_t int_value;
   asmvm::Value* value;
   asmvm::Instruction* instruction;
@@ -97,13 +117,19 @@ int yyerror(const char *msg)
   asmvm::BaseAddress* base;
   asmvm::Source* source;
   asmvm::Address* address;
-  std::list<asmvm::Printable*> *print_arg_list;
+  std::vector<asmvm::Printable*> *print_arg_list;
   asmvm::Printable* printable;
 }
 %%
 
 File: 
-  DataSection CodeSection 
+  Imports DataSection ReserveSection CodeSection 
+  ;
+
+Imports:
+  | Imports IMPORT IDENTIFIER {
+    if (!asmvm::parser::StaticHolder::instance().vm().AddImport($3, lineNumber+1)) YYABORT;
+  }
   ;
 
 DataSection: 
@@ -111,14 +137,51 @@ DataSection:
   | STATIC Assignments
   ;
 
+// Left recursive lists keep the parser stack constant however long the
+// program is.
 Assignments: 
   Assignment
-  | Assignment Assignments 
+  | Assignments Assignment 
   ;
 
 Assignment: 
   IDENTIFIER ASSIGN Value {
-    asmvm::parser::StaticHolder::instance().vm().AddSymbol($1, $3);
+    if (!asmvm::parser::StaticHolder::instance().vm().AddSymbol($1, $3, lineNumber+1)) YYABORT;
+  }
+  | Integers
+  | ALIGN IntValue {
+    if (!asmvm::parser::StaticHolder::instance().vm().AlignData($2, lineNumber+1)) YYABORT;
+  }
+  ;
+
+// name = 1, 2, 3 lays out an int32 array; a single integer is an array of one.
+Integers:
+  IDENTIFIER ASSIGN IntValue {
+    asmvm::Value* value = arena().New<asmvm::IntegerValue>(asmvm::Value::kValueKindVar, $3);
+    if (!asmvm::parser::StaticHolder::instance().vm().AddSymbol($1, value, lineNumber+1)) YYABORT;
+  }
+  | Integers COMMA IntValue {
+    if (!asmvm::parser::StaticHolder::instance().vm().AddArrayElement($3, lineNumber+1)) YYABORT;
+  }
+  ;
+
+// Zero-initialized buffers, name [bytes]. They take no room in the image.
+ReserveSection:
+  | RESERVE
+  | RESERVE Reserves
+  ;
+
+Reserves:
+  Reserve
+  | Reserves Reserve
+  ;
+
+Reserve:
+  IDENTIFIER L_BRACKET IntValue R_BRACKET {
+    if (!asmvm::parser::StaticHolder::instance().vm().AddReserve($1, $3, lineNumber+1)) YYABORT;
+  }
+  | ALIGN IntValue {
+    if (!asmvm::parser::StaticHolder::instance().vm().AlignReserve($2, lineNumber+1)) YYABORT;
   }
   ;
 
@@ -128,24 +191,24 @@ CodeSection:
 
 Lines: 
   Line
-  | Line Lines 
+  | Lines Line 
   ;
 
 Line: 
   Instruction {
     asmvm::parser::StaticHolder::instance().vm().add_instruction($1);
   }
-  | LABEL Instruction {
-    asmvm::parser::StaticHolder::instance().vm().add_labeled_instruction($1, $2);
+  | LABEL {
+    // Runs before the instruction is read, so lineNumber is still the label's line.
+    asmvm::parser::StaticHolder::instance().vm().AddLabel($1, lineNumber+1);
+  } Instruction {
+    asmvm::parser::StaticHolder::instance().vm().add_instruction($3);
   }
   ;
 
 Value: 
   L_STRING {
-    $$ = new asmvm::StringValue(asmvm::Value::kValueKindVar, $1);
-  }
-  | IntValue {
-    $$ = new asmvm::IntegerValue(asmvm::Value::kValueKindVar, $1);
+    $$ = arena().New<asmvm::StringValue>(asmvm::Value::kValueKindVar, $1);
   }
   ;
 
@@ -163,40 +226,37 @@ Instruction:
     $$ = $1;
   }
   | NOT REGISTER REGISTER {
-    $$ = new asmvm::OpNot($2, $3);
+    $$ = code_arena().New<asmvm::OpNot>($2, $3);
   }
   | INC REGISTER {
-    $$ = new asmvm::OpInc($2);
+    $$ = code_arena().New<asmvm::OpInc>($2);
   }
   | DEC REGISTER {
-    $$ = new asmvm::OpDec($2);
+    $$ = code_arena().New<asmvm::OpDec>($2);
   }
   | JMP IDENTIFIER {
-    $$ = new asmvm::OpJmp($2);
+    $$ = code_arena().New<asmvm::OpJmp>($2);
   }
   | CALL IDENTIFIER {
-    $$ = new asmvm::OpCall($2);
+    $$ = code_arena().New<asmvm::OpCall>($2);
   }
   | RET {
-    $$ = new asmvm::OpRet();
+    $$ = code_arena().New<asmvm::OpRet>();
   }
   | JZ REGISTER IDENTIFIER {
-    $$ = new asmvm::OpJz($2, $3);
+    $$ = code_arena().New<asmvm::OpJz>($2, $3);
   }
   | JNZ REGISTER IDENTIFIER {
-    $$ = new asmvm::OpJnz($2, $3);
+    $$ = code_arena().New<asmvm::OpJnz>($2, $3);
   }
   | Move {
     $$ = $1;
   }
   | PUSH Source {
-    $$ = new asmvm::OpPush($2);
+    $$ = code_arena().New<asmvm::OpPush>($2);
   }
   | PUSH IDENTIFIER {
-    asmvm::Value* v = NULL;
-    asmvm::parser::StaticHolder::instance().vm().GetSymbolValue($2, &v);
-    asmvm::IntegerValue* iv = static_cast<asmvm::IntegerValue*>(v);
-    $$ = new asmvm::OpPush(new asmvm::IntegerValue(*iv));
+    $$ = code_arena().New<asmvm::OpPush>(arena().New<asmvm::SymbolSource>($2));
   }
   | Pop {
     $$ = $1;
@@ -208,51 +268,55 @@ Instruction:
     $$ = $1;
   }
   | EXIT Source {
-    $$ = new asmvm::OpExit($2);
+    $$ = code_arena().New<asmvm::OpExit>($2);
   }
   | Print {
     $$ = $1;
   }
   | FPRINT REGISTER {
-    $$ = new asmvm::OpFprint($2);
+    $$ = code_arena().New<asmvm::OpFprint>($2);
   }
   | SPRINT REGISTER {
-    $$ = new asmvm::OpSprint($2);
+    $$ = code_arena().New<asmvm::OpSprint>(arena().New<asmvm::BaseAddressRegister>($2));
   }
   | SPRINT IDENTIFIER {
-    asmvm::Value* v = NULL;
-    asmvm::AsmMachine& vm = asmvm::parser::StaticHolder::instance().vm();
-    vm.GetSymbolValue($2, &v);
-    asmvm::IntegerValue* iv = static_cast<asmvm::IntegerValue*>(v);
-    const char* str = reinterpret_cast<const char*>(vm.data() + iv->value(vm));
-    $$ = new asmvm::OpSprint(str);
+    $$ = code_arena().New<asmvm::OpSprint>(arena().New<asmvm::BaseAddressVar>($2));
   }
   | SYSCALL Source REGISTER {
-    $$ = new asmvm::OpSysCall($2, $3);
+    $$ = code_arena().New<asmvm::OpSysCall>($2, $3);
+  }
+  | SYSCALL L_STRING REGISTER {
+    $$ = code_arena().New<asmvm::OpSysCall>($2, $3);
   }
   | PUSHN Source {
-    $$ = new asmvm::OpPushN($2->value(asmvm::parser::StaticHolder::instance().vm()));
+    $$ = code_arena().New<asmvm::OpPushN>($2->value(asmvm::parser::StaticHolder::instance().vm()));
   }
   | POPN Source {
-    $$ = new asmvm::OpPopN($2->value(asmvm::parser::StaticHolder::instance().vm()));
+    $$ = code_arena().New<asmvm::OpPopN>($2->value(asmvm::parser::StaticHolder::instance().vm()));
+  }
+  | ENTER IntValue REGISTER {
+    $$ = code_arena().New<asmvm::OpEnter>($2, $3);
+  }
+  | LEAVE {
+    $$ = code_arena().New<asmvm::OpLeave>();
   }
   ;
 Move:
   MV REGISTER Source {
-    $$ = new asmvm::OpMov($2, $3);
+    $$ = code_arena().New<asmvm::OpMov>($2, $3);
   }
   ;
 Pop:
   POP {
-    $$ = new asmvm::OpPop();
+    $$ = code_arena().New<asmvm::OpPop>();
   }
   | POP REGISTER {
-    $$ = new asmvm::OpPop($2);
+    $$ = code_arena().New<asmvm::OpPop>($2);
   }
   ;
 Print:
   PRINT PrintArgList {
-    $$ = new asmvm::OpPrint(asmvm::parser::StaticHolder::instance().print_arg_list());
+    $$ = code_arena().New<asmvm::OpPrint>(arena(), asmvm::parser::StaticHolder::instance().print_arg_list());
     asmvm::parser::StaticHolder::instance().clear();
   }
   ;
@@ -261,104 +325,113 @@ PrintArgList:
     // Does not assign to $$. Recursive lists are not friends of unions. 
     asmvm::parser::StaticHolder::instance().add($1);
   }
-  | PrintArg { asmvm::parser::StaticHolder::instance().add($1); } PrintArgList {
-    // Does not assign to $$. Recursive lists are not friends of unions.     
+  | PrintArgList PrintArg {
+    asmvm::parser::StaticHolder::instance().add($2);
   }
   ;
 PrintArg:
   L_STRING {
-    $$ = new asmvm::StringValue(asmvm::Value::kValueKindConst, $1);
+    $$ = arena().New<asmvm::StringValue>(asmvm::Value::kValueKindConst, $1);
   }
   | Source {
     $$ = $1;
   }
   | IDENTIFIER {
-    asmvm::Value* v = NULL;
-    asmvm::parser::StaticHolder::instance().vm().GetSymbolValue($1, &v);
-    asmvm::IntegerValue* iv = static_cast<asmvm::IntegerValue*>(v);
-    $$ = new asmvm::StringValue(asmvm::Value::kValueKindConst, iv->value());
+    $$ = arena().New<asmvm::SymbolString>($1);
   }
   ;
   
 TernaryInstructions:
   ADD Source Source REGISTER {
-    $$ = new asmvm::OpAdd($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpAdd>($2, $3, $4);
   }
   | SUB Source Source REGISTER {
-    $$ = new asmvm::OpSub($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpSub>($2, $3, $4);
   }
   | MUL Source Source REGISTER {
-    $$ = new asmvm::OpMul($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpMul>($2, $3, $4);
   }
   | DIV Source Source REGISTER {
-    $$ = new asmvm::OpDiv($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpDiv>($2, $3, $4);
   }
   | MOD Source Source REGISTER {
-    $$ = new asmvm::OpMod($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpMod>($2, $3, $4);
   }
   | AND Source Source REGISTER {
-    $$ = new asmvm::OpAnd($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpAnd>($2, $3, $4);
   }
   | OR Source Source REGISTER {
-    $$ = new asmvm::OpOr($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpOr>($2, $3, $4);
   }
   | XOR Source Source REGISTER {
-    $$ = new asmvm::OpXor($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpXor>($2, $3, $4);
   }
   | SHR Source Source REGISTER {
-    $$ = new asmvm::OpShr($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpShr>($2, $3, $4);
   }
   | SHL Source Source REGISTER {
-    $$ = new asmvm::OpShl($2, $3, $4);
+    $$ = code_arena().New<asmvm::OpShl>($2, $3, $4);
   }
   ;
 Load:
   LD1 REGISTER Address {
-    $$ = new asmvm::OpLd1($2, $3);
+    $$ = code_arena().New<asmvm::OpLd1>($2, $3);
   }
   | LD2 REGISTER Address {
-    $$ = new asmvm::OpLd2($2, $3);
+    $$ = code_arena().New<asmvm::OpLd2>($2, $3);
   }
   | LD4 REGISTER Address {
-    $$ = new asmvm::OpLd4($2, $3);
+    $$ = code_arena().New<asmvm::OpLd4>($2, $3);
+  }
+  | LD4A REGISTER Address {
+    $$ = code_arena().New<asmvm::OpLd4Acquire>($2, $3);
+  }
+  | XADD REGISTER Address {
+    $$ = code_arena().New<asmvm::OpXadd>($2, $3);
+  }
+  | CAS REGISTER REGISTER Address {
+    $$ = code_arena().New<asmvm::OpCas>($2, $3, $4);
   }
   ;
 Source:
   REGISTER {
-    $$ = new asmvm::RegisterSource($1);
+    $$ = arena().New<asmvm::RegisterSource>($1);
   }
   | IntValue {
-    $$ = new asmvm::IntegerValue(asmvm::Value::kValueKindConst, $1);
+    $$ = arena().New<asmvm::IntegerValue>(asmvm::Value::kValueKindConst, $1);
   }
   ;
 Address:
   Base {
-    $$ = new asmvm::Address($1, NULL);
+    $$ = arena().New<asmvm::Address>($1);
   }
   | Base L_BRACKET Source R_BRACKET {
-    $$ = new asmvm::Address($1, $3);
+    $$ = arena().New<asmvm::Address>($1, $3);
   }
   ;
 Base:
   REGISTER {
-    $$ = new asmvm::BaseAddressRegister($1);
+    $$ = arena().New<asmvm::BaseAddressRegister>($1);
   }
   | L_HEX {
-    $$ = new asmvm::BaseAddressHex($1);
+    $$ = arena().New<asmvm::BaseAddressHex>($1);
   }
   | IDENTIFIER {
-    $$ = new asmvm::BaseAddressVar($1);
+    $$ = arena().New<asmvm::BaseAddressVar>($1);
   }
   ;
 
 Store:
   ST1 Source Address {
-    $$ = new asmvm::OpSt1($2, $3);
+    $$ = code_arena().New<asmvm::OpSt1>($2, $3);
   }
   | ST2 Source Address {
-    $$ = new asmvm::OpSt2($2, $3);
+    $$ = code_arena().New<asmvm::OpSt2>($2, $3);
   }
   | ST4 Source Address {
-    $$ = new asmvm::OpSt4($2, $3);
+    $$ = code_arena().New<asmvm::OpSt4>($2, $3);
+  }
+  | ST4R Source Address {
+    $$ = code_arena().New<asmvm::OpSt4Release>($2, $3);
   }
   ;
\ No newline at end of file
@@ -0,0 +1,61 @@
+// Latency of calling an asmvm function through libasmvm, as an embedder on a
+// request path would: the program is loaded once and a labeled function is
+// called many times with arguments in registers.
+//
+//   make bench-embed
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../libasmvm.h"
+
+namespace {
+
+const char kProgram[] =
+    ".DATA\n"
+    "calls = 0\n"
+    ".CODE\n"
+    "PRINT \"not a library entry point\\n\"\n"
+    "EXIT 1\n"
+    "; R1 = R1 * R2 + calls, counting calls in memory.\n"
+    "muladd: LD4 R3 calls\n"
+    "INC R3\n"
+    "ST4 R3 calls\n"
+    "MUL R1 R2 R1\n"
+    "ADD R1 R3 R1\n"
+    "RET\n";
+
+const int kCalls = 1000000;
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+} // namespace
+
+int main() {
+  asmvm::Vm vm;
+  asmvm::StringSink out;
+  vm.set_output(&out);
+  if (!vm.LoadString(kProgram)) return 1;
+
+  int32_t entry = vm.Label("muladd");
+  int32_t result = 0;
+  int32_t args[2] = {6, 7};
+  double start = now_seconds();
+  for (int i = 0; i < kCalls; ++i) {
+    if (!vm.Call(entry, args, 2, &result)) {
+      fprintf(stderr, "Call falhou: %s\n", out.str().c_str());
+      return 1;
+    }
+  }
+  double elapsed = now_seconds() - start;
+
+  int32_t calls = 0;
+  vm.Read(vm.Address("calls"), &calls, sizeof(calls));
+  fprintf(stderr, "%d chamadas em %.3f s (%.3f us/chamada), último resultado %d, calls = %d\n",
+          kCalls, elapsed, elapsed * 1e6 / kCalls, result, calls);
+  return 0;
+}
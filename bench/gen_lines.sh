@@ -0,0 +1,25 @@
+#!/bin/sh
+# Prints a synthetic straight-line program of about N lines (default 1000000),
+# used to measure parser throughput: sh bench/gen_lines.sh | ./asmvm_out ...
+N=${1:-1000000}
+awk -v n="$N" 'BEGIN {
+  print ".DATA"
+  print "v = 0"
+  print "msg = \"done\""
+  print ".CODE"
+  blocks = int(n / 10)
+  for (i = 0; i < blocks; i++) {
+    printf "l%d: MV R1 %d\n", i, i
+    print "ADD R1 3 R2"
+    print "SUB R2 R1 R3"
+    print "LD4 R4 v"
+    print "XOR R2 R4 R8"
+    print "PUSH R2"
+    print "POP R5"
+    printf "JNZ R3 l%d ; always taken\n", i + 1
+    print "MUL R2 2 R6"
+    print "AND R6 0xFF R7"
+  }
+  printf "l%d: PRINT msg \"\\n\"\n", blocks
+  print "EXIT 0"
+}'
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Prints a program that sums 1..(W/T) on each of T threads (default T=4,
+# W=40000000) and adds the partial sums to a shared word with XADD:
+#   sh bench/gen_parallel_sum.sh 4 > sum.asmvm
+T=${1:-4}
+W=${2:-40000000}
+awk -v t="$T" -v w="$W" 'BEGIN {
+  print ".DATA"
+  print "total = 0"
+  print ".CODE"
+  # One 64 byte stack per worker, its thread id pushed right after it.
+  printf "MV R5 %d\n", t
+  print "spawn: MV R3 ST"
+  print "PUSHN 64"
+  print "PUSH worker"
+  print "POP R1"
+  printf "MV R2 %d\n", int(w / t)
+  print "SYSCALL \"spawn\" R8"
+  print "PUSH R1"
+  print "DEC R5"
+  print "JNZ R5 spawn"
+  printf "MV R5 %d\n", t
+  print "join: POP R1"
+  print "SYSCALL \"join\" R8"
+  print "POPN 64"
+  print "DEC R5"
+  print "JNZ R5 join"
+  print "LD4A R1 total"
+  print "PRINT R1 \"\\n\""
+  print "EXIT 0"
+  print "worker: MV R2 0"
+  print "loop: ADD R2 R1 R2"
+  print "DEC R1"
+  print "JNZ R1 loop"
+  print "XADD R2 total"
+  print "MV R1 0"
+  print "RET"
+}'
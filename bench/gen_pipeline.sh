@@ -0,0 +1,83 @@
+#!/bin/sh
+# Writes the S stages (default 4) of a pipeline to PREFIX_1.asmvm ...
+# PREFIX_S.asmvm. The first stage produces 1..N (default 200000, a multiple of
+# 16), every stage does W/S (default W=64) increments on each value, and the
+# last one prints the sum. Values move between stages 16 at a time with
+# chan_recv_batch/chan_send_batch:
+#   sh bench/gen_pipeline.sh 4 /tmp/p && ./asmvm_out pipe /tmp/p_*.asmvm
+S=${1:-4}
+PREFIX=${2:-bench/pipe}
+N=${3:-200000}
+W=${4:-64}
+k=1
+while [ $k -le $S ]; do
+  awk -v s="$S" -v k="$k" -v n="$N" -v w="$W" 'BEGIN {
+    print ".DATA"
+    for (i = 0; i < 16; i++) printf "buf%d = 0\n", i
+    printf "left = %d\n", n / 16
+    print "counter = 0"
+    print "count = 0"
+    print ".CODE"
+    print "MV R7 0 ; sum, in the last stage"
+    if (k == 1) {
+      print "next: LD4 R1 left"
+      print "JZ R1 done"
+      print "DEC R1"
+      print "ST4R R1 left"
+      print "MV R5 16"
+      print "MV R6 0"
+      print "fill: LD4 R1 counter"
+      print "INC R1"
+      print "ST4R R1 counter"
+      print "ST4R R1 buf0[R6]"
+      print "ADD R6 4 R6"
+      print "DEC R5"
+      print "JNZ R5 fill"
+      print "MV R5 16"
+    } else {
+      print "next: MV R1 1"
+      print "PUSH buf0"
+      print "POP R2"
+      print "MV R3 16"
+      print "MV R4 4"
+      print "SYSCALL \"chan_recv_batch\" R8"
+      print "JZ R1 done ; closed"
+      print "MV R5 R1"
+    }
+    print "ST4R R5 count"
+    print "MV R6 0"
+    print "item: LD4 R2 buf0[R6]"
+    printf "MV R3 %d\n", int(w / s)
+    print "work: INC R2"
+    print "DEC R3"
+    print "JNZ R3 work"
+    if (k == s) {
+      print "ADD R7 R2 R7"
+    } else {
+      print "ST4R R2 buf0[R6]"
+    }
+    print "ADD R6 4 R6"
+    print "DEC R5"
+    print "JNZ R5 item"
+    if (k < s) {
+      # A batch can go out in pieces when the channel is nearly full.
+      print "LD4 R5 count"
+      print "PUSH buf0"
+      print "POP R6"
+      print "send: MV R1 2"
+      print "MV R2 R6"
+      print "MV R3 R5"
+      print "MV R4 4"
+      print "SYSCALL \"chan_send_batch\" R8"
+      print "SUB R5 R1 R5"
+      print "SHL R1 2 R1"
+      print "ADD R6 R1 R6"
+      print "JNZ R5 send"
+    }
+    print "JMP next"
+    if (k == s) print "done: PRINT R7 \"\\n\""
+    else print "done: EXIT 0"
+    if (k == s) print "EXIT 0"
+  }' > ${PREFIX}_$k.asmvm
+  k=$((k + 1))
+done
@@ -0,0 +1,101 @@
+#!/bin/sh
+# Prints a program running T/2 producer/consumer pairs (default T=4), each
+# passing 1..N (default 200000) through its own 8 slot ring with LD4A/ST4R,
+# sleeping on futex_wait when the ring is full or empty. Consumers add what
+# they receive to a shared word with XADD:
+#   sh bench/gen_prodcons.sh 4 > pc.asmvm
+T=${1:-4}
+N=${2:-200000}
+awk -v t="$T" -v n="$N" 'BEGIN {
+  pairs = int(t / 2)
+  if (pairs < 1) pairs = 1
+  print ".DATA"
+  print "total = 0"
+  # Ring of pair p at r<p>_head: head (consumed), tail (produced), 8 slots.
+  for (p = 0; p < pairs; p++) {
+    printf "r%d_head = 0\nr%d_tail = 0\n", p, p
+    for (s = 0; s < 8; s++) printf "r%d_s%d = 0\n", p, s
+  }
+  print ".CODE"
+  for (p = 0; p < pairs; p++) {
+    print "MV R3 ST"
+    print "PUSHN 64"
+    print "PUSH producer"
+    print "POP R1"
+    printf "PUSH r%d_head\n", p
+    print "POP R2"
+    print "SYSCALL \"spawn\" R8"
+    print "PUSH R1"
+    print "MV R3 ST"
+    print "PUSHN 64"
+    print "PUSH consumer"
+    print "POP R1"
+    printf "PUSH r%d_head\n", p
+    print "POP R2"
+    print "SYSCALL \"spawn\" R8"
+    print "PUSH R1"
+  }
+  printf "MV R5 %d\n", 2 * pairs
+  print "join: POP R1"
+  print "SYSCALL \"join\" R8"
+  print "POPN 64"
+  print "DEC R5"
+  print "JNZ R5 join"
+  print "LD4A R1 total"
+  print "PRINT R1 \"\\n\""
+  print "EXIT 0"
+
+  # R6 ring, R4 tail, R5 next value, R7 values left.
+  print "producer: MV R6 R1"
+  print "MV R4 0"
+  print "MV R5 1"
+  printf "MV R7 %d\n", n
+  print "ploop: LD4A R2 R6[0]"
+  print "SUB R4 R2 R3"
+  print "SUB R3 8 R3"
+  print "JNZ R3 put"
+  print "MV R1 R6"
+  print "SYSCALL \"futex_wait\" R8 ; full until head moves from R2"
+  print "JMP ploop"
+  print "put: AND R4 7 R3"
+  print "SHL R3 2 R3"
+  print "ADD R3 8 R3"
+  print "ST4R R5 R6[R3]"
+  print "INC R4"
+  print "ST4R R4 R6[4]"
+  print "ADD R6 4 R1"
+  print "MV R2 1"
+  print "SYSCALL \"futex_wake\" R8"
+  print "INC R5"
+  print "DEC R7"
+  print "JNZ R7 ploop"
+  print "MV R1 0"
+  print "RET"
+
+  # R6 ring, R4 head, R5 sum, R7 values left.
+  print "consumer: MV R6 R1"
+  print "MV R4 0"
+  print "MV R5 0"
+  printf "MV R7 %d\n", n
+  print "cloop: LD4A R2 R6[4]"
+  print "SUB R2 R4 R3"
+  print "JNZ R3 get"
+  print "ADD R6 4 R1"
+  print "SYSCALL \"futex_wait\" R8 ; empty until tail moves from R2"
+  print "JMP cloop"
+  print "get: AND R4 7 R3"
+  print "SHL R3 2 R3"
+  print "ADD R3 8 R3"
+  print "LD4 R3 R6[R3]"
+  print "ADD R5 R3 R5"
+  print "INC R4"
+  print "ST4R R4 R6[0]"
+  print "MV R1 R6"
+  print "MV R2 1"
+  print "SYSCALL \"futex_wake\" R8"
+  print "DEC R7"
+  print "JNZ R7 cloop"
+  print "XADD R5 total"
+  print "MV R1 0"
+  print "RET"
+}'
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Wall time of a load/store/PUSH/POP heavy loop with the software bounds
+# checks and with --guard-pages. Both runs print the same sum.
+ASMVM=${ASMVM:-./asmvm_out}
+N=${1:-20000000}
+cat > bench/guard.asmvm <<END
+.BSS
+buf [65536]
+.CODE
+MV R7 $N
+MV R6 0
+loop: AND R7 16383 R1
+SHL R1 2 R1
+LD4 R2 buf[R1]
+ADD R2 R7 R2
+ST4 R2 buf[R1]
+PUSH R2
+POP R3
+ADD R6 R3 R6
+DEC R7
+JNZ R7 loop
+PRINT R6 "\n"
+EXIT 0
+END
+for mode in "" --guard-pages; do
+  start=$(date +%s%N)
+  sum=$($ASMVM --no-cache $mode bench/guard.asmvm | head -n 1)
+  end=$(date +%s%N)
+  echo "${mode:-checked}  sum=$sum  $(( (end - start) / 1000000 )) ms"
+done
+rm -f bench/guard.asmvm
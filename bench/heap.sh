@@ -0,0 +1,38 @@
+#!/bin/sh
+# Wall time of N alloc/free pairs over a ring of 256 live blocks of 8 to
+# 4100 bytes, with the heap statistics at exit.
+ASMVM=${ASMVM:-./asmvm_out}
+N=${1:-2000000}
+cat > bench/heap.asmvm <<END
+.BSS
+ring [1024]
+.CODE
+MV R7 $N
+MV R6 0
+loop: AND R7 255 R2
+SHL R2 2 R2
+LD4 R1 ring[R2]
+JZ R1 empty
+LD4 R3 R1
+ADD R6 R3 R6
+SYSCALL "free" R8
+empty: MUL R7 40503 R1
+SHR R1 4 R1
+AND R1 4095 R1
+ADD R1 8 R1
+SYSCALL "alloc" R8
+JNZ R8 fail
+ST4 R7 R1
+ST4 R1 ring[R2]
+DEC R7
+JNZ R7 loop
+PRINT R6 "\n"
+EXIT 0
+fail: PRINT "alloc failed\n"
+EXIT 1
+END
+start=$(date +%s%N)
+sum=$($ASMVM --no-cache --heap-stats bench/heap.asmvm | head -n 1)
+end=$(date +%s%N)
+echo "$N alloc/free  sum=$sum  $(( (end - start) / 1000000 )) ms"
+rm -f bench/heap.asmvm
@@ -0,0 +1,119 @@
+// Measures what the hooks policy of AsmMachine::Continue costs: the loop
+// instantiated with NoHooks against a hand-written copy of the dispatch loop
+// without any hook points, and against a policy that counts every event.
+//
+//   make bench-hooks
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../asmvm.h"
+#include "../parser_aid.h"
+#include "../run_hooks.h"
+#include "../source_buffer.h"
+
+namespace {
+
+const char kProgram[] =
+    ".DATA\n"
+    "v = 0\n"
+    ".CODE\n"
+    "MV R1 5000000\n"
+    "loop: LD4 R2 v\n"
+    "ADD R2 R1 R2\n"
+    "PUSH R2\n"
+    "POP R3\n"
+    "CALL f\n"
+    "DEC R1\n"
+    "JNZ R1 loop\n"
+    "EXIT 0\n"
+    "f: XOR R3 R2 R4\n"
+    "RET\n";
+
+const int kRepetitions = 15;
+
+struct CountingHooks : public asmvm::NoHooks {
+  static const bool kInstructionHooks = true;
+  static const bool kControlHooks = true;
+  static const bool kMemoryHooks = true;
+  static const bool kSyscallHooks = true;
+
+  CountingHooks() : instructions(0), branches(0), calls(0), memory(0) {}
+  void on_instruction(asmvm::AsmMachine& vm, uint32_t pc, const asmvm::Instruction& ins) { ++instructions; }
+  void on_branch(asmvm::AsmMachine& vm, uint32_t pc, int32_t target) { ++branches; }
+  void on_call(asmvm::AsmMachine& vm, uint32_t pc, int32_t target) { ++calls; }
+  void on_ret(asmvm::AsmMachine& vm, uint32_t pc, int32_t target) { ++calls; }
+  void on_memory_access(asmvm::AsmMachine& vm, uint32_t pc, uint32_t address, uint32_t size, bool write) {
+    ++memory;
+  }
+
+  uint64_t instructions;
+  uint64_t branches;
+  uint64_t calls;
+  uint64_t memory;
+};
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The dispatch loop as it was before hooks existed.
+void RunPlain(asmvm::AsmMachine& vm) {
+  vm.Reset();
+  asmvm::Instruction* ins = vm.program()[vm.reg_PC()];
+  int32_t temp_PC;
+  while ((temp_PC = ins->Exec(vm)) >= 0) {
+    ins = vm.program()[temp_PC];
+    vm.set_register(asmvm::kRegisterIndexPc, temp_PC);
+  }
+}
+
+void RunNoHooks(asmvm::AsmMachine& vm) {
+  vm.Reset();
+  vm.Continue(asmvm::kUnlimitedFuel);
+}
+
+void RunCounting(asmvm::AsmMachine& vm) {
+  CountingHooks hooks;
+  vm.Reset();
+  vm.Continue(asmvm::kUnlimitedFuel, hooks);
+}
+
+// Runs the variants in turns so that they share any frequency scaling or
+// noise from other processes, and keeps the best time of each.
+void Measure(asmvm::AsmMachine& vm, double* plain, double* no_hooks, double* counting) {
+  void (*runs[])(asmvm::AsmMachine&) = {RunPlain, RunNoHooks, RunCounting};
+  double* best[] = {plain, no_hooks, counting};
+  for (int i = 0; i < kRepetitions; ++i) {
+    for (int r = 0; r < 3; ++r) {
+      double start = now_seconds();
+      runs[r](vm);
+      double elapsed = now_seconds() - start;
+      if (i == 0 || elapsed < *best[r]) *best[r] = elapsed;
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  asmvm::SourceBuffer source;
+  source.Assign(kProgram, strlen(kProgram));
+  asmvm::AsmMachine vm;
+  if (!asmvm::parser::Parse(source, &vm)) return 1;
+
+  // EXIT prints a line per run; results go to stderr.
+  if (freopen("/dev/null", "w", stdout) == NULL) return 1;
+  double plain, no_hooks, counting;
+  Measure(vm, &plain, &no_hooks, &counting);
+
+  fprintf(stderr, "%llu instruções por execução, melhor de %d\n",
+         (unsigned long long)vm.instructions(), kRepetitions);
+  fprintf(stderr, "laço sem ganchos  %8.3f s\n", plain);
+  fprintf(stderr, "NoHooks           %8.3f s (%+.1f%%)\n", no_hooks, (no_hooks / plain - 1) * 100);
+  fprintf(stderr, "CountingHooks     %8.3f s (%+.1f%%)\n", counting, (counting / plain - 1) * 100);
+  return 0;
+}
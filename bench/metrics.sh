@@ -0,0 +1,29 @@
+#!/bin/sh
+# Wall time of N hash SYSCALLs without metrics and with them, and the
+# metrics exported.
+ASMVM=${ASMVM:-./asmvm_out}
+N=${1:-2000000}
+cat > bench/metrics.asmvm <<END
+.DATA
+buf = "metrics"
+.CODE
+MV R7 $N
+loop: PUSH buf
+POP R1
+MV R2 7
+SYSCALL "hash" R8
+DEC R7
+JNZ R7 loop
+PRINT R1 "\n"
+EXIT 0
+END
+time_run() {
+  start=$(date +%s%N)
+  $ASMVM --no-cache "$@" bench/metrics.asmvm > /dev/null
+  end=$(date +%s%N)
+  echo "$N syscalls $*  $(( (end - start) / 1000000 )) ms"
+}
+time_run
+time_run --metrics bench/metrics.json
+cat bench/metrics.json
+rm -f bench/metrics.asmvm bench/metrics.json
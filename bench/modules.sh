@@ -0,0 +1,32 @@
+#!/bin/sh
+# Load time of a program importing a module of N lines, compiled ahead to
+# an object and parsed from source.
+ASMVM=${ASMVM:-./asmvm_out}
+N=${1:-50000}
+awk -v n=$N 'BEGIN {
+  print ".DATA"
+  print "total = 0"
+  print ".CODE"
+  print "sum: MV R1 0"
+  for (i = 0; i < n - 6; ++i) print "ADD R1 " i % 7 " R1"
+  print "ST4R R1 total"
+  print "RET"
+}' > bench/modlib.asmvm
+cat > bench/modmain.asmvm <<END
+.IMPORT modlib
+.CODE
+CALL modlib.sum
+LD4 R2 modlib.total
+PRINT R2 "\n"
+EXIT 0
+END
+time_run() {
+  start=$(date +%s%N)
+  out=$(ASMVM_PATH=bench $ASMVM --no-cache bench/modmain.asmvm | head -n 1)
+  end=$(date +%s%N)
+  echo "$1  out=$out  $(( (end - start) / 1000000 )) ms"
+}
+time_run "source"
+$ASMVM module bench/modlib.asmvm || exit 1
+time_run "object"
+rm -f bench/modlib.asmvm bench/modlib.asmo bench/modmain.asmvm
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Wall time of the same work split across pipelines of 1, 2 and 4 stages
+# connected by channels, one scheduler thread per stage.
+ASMVM=${ASMVM:-./asmvm_out}
+for s in 1 2 4; do
+  sh bench/gen_pipeline.sh $s bench/pipe$s
+  start=$(date +%s%N)
+  $ASMVM pipe bench/pipe${s}_*.asmvm > /dev/null
+  end=$(date +%s%N)
+  echo "pipeline stages=$s  $(( (end - start) / 1000000 )) ms"
+  rm -f bench/pipe${s}_*.asmvm
+done
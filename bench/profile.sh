@@ -0,0 +1,29 @@
+#!/bin/sh
+# Wall time of a loop of N iterations as it is and laid out and fused after
+# a profile of it (see profile.h).
+ASMVM=${ASMVM:-./asmvm_out}
+N=${1:-30000000}
+cat > bench/profile.asmvm <<END
+.CODE
+MV R1 $N
+MV R2 0
+loop: AND R1 7 R3
+JNZ R3 common
+ADD R2 3 R2
+JMP next
+common: INC R2
+next: DEC R1
+JNZ R1 loop
+PRINT R2 "\n"
+EXIT 0
+END
+time_run() {
+  start=$(date +%s%N)
+  $ASMVM --no-cache "$@" bench/profile.asmvm > /dev/null
+  end=$(date +%s%N)
+  echo "$N iterations $*  $(( (end - start) / 1000000 )) ms"
+}
+time_run --profile-out bench/profile.txt
+time_run
+time_run --profile bench/profile.txt
+rm -f bench/profile.asmvm bench/profile.txt
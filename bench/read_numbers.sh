@@ -0,0 +1,66 @@
+#!/bin/sh
+# Sums N (default 1000000) integers from a text file twice: one read_int
+# SYSCALL per value, then read_numbers filling a 256 entry buffer per call.
+# Both programs print the same sum. Values are separated by whitespace only,
+# since read_int (fscanf) stops at commas.
+ASMVM=${ASMVM:-./asmvm_out}
+N=${1:-1000000}
+awk -v n="$N" 'BEGIN {
+  for (i = 1; i <= n; i++) {
+    printf "%d", (i * 7919) % 2001 - 1000
+    printf (i % 10 == 0 ? "\n" : " ")
+  }
+}' > bench/numbers.txt
+cat > bench/read_int.asmvm <<'END'
+.DATA
+filename = "bench/numbers.txt"
+.CODE
+MV R7 0
+PUSH 1
+PUSH filename
+SYSCALL 0 R2
+POP R1
+next: PUSH R1
+SYSCALL 4 R2
+POP R3
+JNZ R2 done
+ADD R7 R3 R7
+JMP next
+done: PRINT R7 "\n"
+EXIT 0
+END
+awk 'BEGIN {
+  print ".DATA"
+  print "filename = \"bench/numbers.txt\""
+  for (i = 0; i < 256; i++) printf "buf%d = 0\n", i
+  print ".CODE"
+  print "MV R7 0"
+  print "PUSH 1"
+  print "PUSH filename"
+  print "SYSCALL 0 R2"
+  print "POP R6"
+  print "next: MV R1 R6"
+  print "MV R2 1 ; int32"
+  print "PUSH buf0"
+  print "POP R3"
+  print "MV R4 256"
+  print "SYSCALL \"read_numbers\" R5"
+  print "MV R4 R1"
+  print "MV R3 0"
+  print "JZ R4 done"
+  print "sum: LD4 R2 buf0[R3]"
+  print "ADD R7 R2 R7"
+  print "ADD R3 4 R3"
+  print "DEC R4"
+  print "JNZ R4 sum"
+  print "JZ R5 next ; buffer filled, more to read"
+  print "done: PRINT R7 \"\\n\""
+  print "EXIT 0"
+}' > bench/read_numbers.asmvm
+for p in read_int read_numbers; do
+  start=$(date +%s%N)
+  sum=$($ASMVM --no-cache bench/$p.asmvm | head -n 1)
+  end=$(date +%s%N)
+  echo "$p  sum=$sum  $(( (end - start) / 1000000 )) ms"
+done
+rm -f bench/numbers.txt bench/read_int.asmvm bench/read_numbers.asmvm
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Wall time of the parallel sum and producer/consumer programs on 1..8
+# threads. Sum: fixed total work split across threads. Producer/consumer:
+# each pair moves the same number of values, so ideal scaling keeps the
+# time flat.
+ASMVM=${ASMVM:-./asmvm_out}
+for t in 1 2 4 8; do
+  sh bench/gen_parallel_sum.sh $t > bench/sum_$t.asmvm
+  start=$(date +%s%N)
+  $ASMVM --no-cache bench/sum_$t.asmvm > /dev/null
+  end=$(date +%s%N)
+  echo "parallel sum     threads=$t  $(( (end - start) / 1000000 )) ms"
+done
+for t in 2 4 8; do
+  sh bench/gen_prodcons.sh $t > bench/prodcons_$t.asmvm
+  start=$(date +%s%N)
+  $ASMVM --no-cache bench/prodcons_$t.asmvm > /dev/null
+  end=$(date +%s%N)
+  echo "producer/consumer threads=$t  $(( (end - start) / 1000000 )) ms"
+done
+rm -f bench/sum_*.asmvm bench/prodcons_*.asmvm
@@ -0,0 +1,193 @@
+#include "channel.h"
+
+#include <string.h>
+#include <new>
+#include <thread>
+
+namespace asmvm {
+
+namespace {
+
+// Failed attempts before a blocking call goes to sleep.
+const int kSpins = 64;
+
+uint32_t RoundUpToPowerOfTwo(uint32_t n) {
+  uint32_t p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+uint32_t Clamp(uint32_t n, uint32_t max) {
+  return n == 0 ? 1 : n > max ? max : n;
+}
+
+} // namespace
+
+Channel::Channel(Kind kind, uint32_t capacity, uint32_t message_size)
+  : kind_(kind),
+    mask_(RoundUpToPowerOfTwo(Clamp(capacity, kMaxChannelCapacity)) - 1),
+    message_size_(Clamp(message_size, kMaxMessageSize)),
+    slot_bytes_((sizeof(Slot) + message_size_ + 7) & ~7U),
+    slots_(new uint8_t[size_t(mask_ + 1) * slot_bytes_]),
+    senders_(0), closed_(false), tail_(0), head_(0), waiters_(0) {
+  for (uint32_t i = 0; i <= mask_; ++i) {
+    Slot* s = new (slot(i)) Slot;
+    s->sequence.store(i, std::memory_order_relaxed);
+    s->size = 0;
+  }
+}
+
+Channel::~Channel() {
+  for (uint32_t i = 0; i <= mask_; ++i) slot(i)->~Slot();
+  delete[] slots_;
+}
+
+void Channel::ReleaseSender() {
+  if (senders_.fetch_sub(1) == 1) {
+    closed_.store(true, std::memory_order_release);
+    Notify();
+  }
+}
+
+bool Channel::TrySend(const uint8_t* data, uint32_t size) {
+  if (size > message_size_) size = message_size_;
+  if (kind_ == kSpsc) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) > mask_) return false;
+    Slot* s = slot(tail);
+    memcpy(payload(s), data, size);
+    s->size = size;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  uint32_t tail = tail_.load(std::memory_order_relaxed);
+  Slot* s;
+  for (;;) {
+    s = slot(tail);
+    int32_t diff = int32_t(s->sequence.load(std::memory_order_acquire) - tail);
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      tail = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  memcpy(payload(s), data, size);
+  s->size = size;
+  s->sequence.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+int32_t Channel::TryRecv(uint8_t* data, uint32_t capacity) {
+  if (kind_ == kSpsc) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return -1;
+    Slot* s = slot(head);
+    uint32_t size = s->size;
+    memcpy(data, payload(s), size < capacity ? size : capacity);
+    head_.store(head + 1, std::memory_order_release);
+    return size;
+  }
+  uint32_t head = head_.load(std::memory_order_relaxed);
+  Slot* s;
+  for (;;) {
+    s = slot(head);
+    int32_t diff = int32_t(s->sequence.load(std::memory_order_acquire) - (head + 1));
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      return -1;
+    } else {
+      head = head_.load(std::memory_order_relaxed);
+    }
+  }
+  uint32_t size = s->size;
+  memcpy(data, payload(s), size < capacity ? size : capacity);
+  s->sequence.store(head + mask_ + 1, std::memory_order_release);
+  return size;
+}
+
+void Channel::Notify() {
+  // Pairs with the increment in Wait: either the waiter sees the change that
+  // preceded this call, or this call sees the waiter.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) == 0) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  wakeup_.notify_all();
+}
+
+template <class Ready>
+void Channel::Wait(Ready ready) {
+  for (int i = 0; i < kSpins; ++i) {
+    if (ready() || closed()) return;
+    std::this_thread::yield();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  waiters_.fetch_add(1);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (!ready() && !closed()) wakeup_.wait(lock);
+  waiters_.fetch_sub(1);
+}
+
+bool Channel::Send(const uint8_t* data, uint32_t size) {
+  for (;;) {
+    if (closed()) return false;
+    if (TrySend(data, size)) {
+      Notify();
+      return true;
+    }
+    Wait([this]() {
+      return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) <= mask_;
+    });
+  }
+}
+
+int32_t Channel::Recv(uint8_t* data, uint32_t capacity) {
+  for (;;) {
+    int32_t size = TryRecv(data, capacity);
+    if (size >= 0) {
+      Notify();
+      return size;
+    }
+    // Checked after TryRecv, so the messages sent before closing get out.
+    if (drained()) return -1;
+    Wait([this]() {
+      return head_.load(std::memory_order_relaxed) != tail_.load(std::memory_order_acquire);
+    });
+  }
+}
+
+ChannelTable::ChannelTable() : count_(0) {}
+
+ChannelTable::~ChannelTable() {
+  for (uint32_t i = 0; i < count_.load(); ++i) {
+    if (ends_[i].owned) delete ends_[i].channel;
+  }
+}
+
+int32_t ChannelTable::Attach(Channel* channel, bool sender, bool owned) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t count = count_.load(std::memory_order_relaxed);
+  if (count == kMaxChannels) return 0;
+  End& end = ends_[count];
+  end.channel = channel;
+  end.sending.store(sender && channel != NULL);
+  end.owned = owned;
+  if (end.sending.load()) channel->AddSender();
+  count_.store(count + 1, std::memory_order_release);
+  return count + 1;
+}
+
+bool ChannelTable::Release(int32_t handle) {
+  Channel* channel = Find(handle);
+  if (channel == NULL || !ends_[handle - 1].sending.exchange(false)) return false;
+  channel->ReleaseSender();
+  return true;
+}
+
+void ChannelTable::ReleaseAll() {
+  for (uint32_t i = 1; i <= count_.load(std::memory_order_acquire); ++i) Release(i);
+}
+
+} // namespace asmvm
@@ -0,0 +1,143 @@
+#ifndef ASMVM_CHANNEL_H
+#define ASMVM_CHANNEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+
+namespace asmvm {
+
+const uint32_t kMaxChannels = 64;
+const uint32_t kMaxChannelCapacity = 1 << 16;
+// Slots are allocated for the whole capacity up front, so this bounds a
+// channel to about 64MB of native memory. Threads of one program can pass
+// bigger data as the address of a heap block instead.
+const uint32_t kMaxMessageSize = 1024;
+const uint32_t kDefaultChannelCapacity = 64;
+const uint32_t kDefaultMessageSize = 64;
+
+// Bounded queue of messages of up to message_size bytes, for connecting
+// machines running on different threads (see the chan_* host functions).
+// Sending and receiving are lock-free: a single-producer single-consumer
+// ring when the channel has one sender and one receiver, Vyukov's bounded
+// MPMC queue otherwise. Only the blocking calls take a lock, and only once
+// the queue is full (Send) or empty (Recv).
+//
+// The channel closes when every sender has released its end; receivers get
+// the messages left and then end of channel.
+class Channel {
+ public:
+  enum Kind {
+    kSpsc,
+    kMpmc
+  };
+
+  // capacity is rounded up to a power of two.
+  Channel(Kind kind, uint32_t capacity, uint32_t message_size);
+  ~Channel();
+
+  Kind kind() const { return kind_; }
+  uint32_t capacity() const { return mask_ + 1; }
+  uint32_t message_size() const { return message_size_; }
+
+  // Senders, counted so the channel closes after the last one.
+  void AddSender() { senders_.fetch_add(1); }
+  void ReleaseSender();
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+  // False if the queue is full. Messages longer than message_size are cut.
+  bool TrySend(const uint8_t* data, uint32_t size);
+  // Copies the next message, cut to capacity bytes, and returns its size, or
+  // -1 if the queue is empty.
+  int32_t TryRecv(uint8_t* data, uint32_t capacity);
+
+  // Closed, and every message sent has been received.
+  bool drained() const {
+    return closed() && head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+  // Blocking versions. Send returns false if the channel is closed, Recv -1
+  // if it is closed and empty.
+  bool Send(const uint8_t* data, uint32_t size);
+  int32_t Recv(uint8_t* data, uint32_t capacity);
+
+  // For callers that wait elsewhere (TrySend/TryRecv are not followed by a
+  // wakeup of the other side): wakes anyone blocked in Send or Recv.
+  void Notify();
+
+ private:
+  Channel(const Channel&);
+  Channel& operator = (const Channel&);
+
+  struct Slot {
+    std::atomic<uint32_t> sequence;  // MPMC only.
+    uint32_t size;
+  };
+
+  Slot* slot(uint32_t position) {
+    return reinterpret_cast<Slot*>(slots_ + size_t(position & mask_) * slot_bytes_);
+  }
+  uint8_t* payload(Slot* s) { return reinterpret_cast<uint8_t*>(s + 1); }
+
+  // Blocks until ready() or the channel closes.
+  template <class Ready> void Wait(Ready ready);
+
+  const Kind kind_;
+  const uint32_t mask_;
+  const uint32_t message_size_;
+  const uint32_t slot_bytes_;
+  uint8_t* slots_;
+  std::atomic<int32_t> senders_;
+  std::atomic<bool> closed_;
+
+  // Producer and consumer positions on cache lines of their own.
+  char pad0_[64];
+  std::atomic<uint32_t> tail_;
+  char pad1_[64];
+  std::atomic<uint32_t> head_;
+  char pad2_[64];
+
+  std::atomic<int32_t> waiters_;
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+};
+
+// The channels of a program, by handle (1, 2...), shared by its threads.
+// Lookups take no lock.
+class ChannelTable {
+ public:
+  ChannelTable();
+  // Deletes the owned channels.
+  ~ChannelTable();
+
+  // A sending end counts as a sender of channel until released. NULL takes a
+  // handle without a channel. Returns the handle, or 0 if the table is full.
+  int32_t Attach(Channel* channel, bool sender, bool owned);
+  Channel* Find(int32_t handle) const {
+    if (handle <= 0 || uint32_t(handle) > count_.load(std::memory_order_acquire)) return NULL;
+    return ends_[handle - 1].channel;
+  }
+  // Releases the sending end of handle. False if it had none.
+  bool Release(int32_t handle);
+  // Releases every sending end.
+  void ReleaseAll();
+
+ private:
+  ChannelTable(const ChannelTable&);
+  ChannelTable& operator = (const ChannelTable&);
+
+  struct End {
+    Channel* channel;
+    std::atomic<bool> sending;
+    bool owned;
+  };
+
+  End ends_[kMaxChannels];
+  std::atomic<uint32_t> count_;
+  std::mutex mutex_;
+};
+
+} // namespace asmvm
+
+#endif
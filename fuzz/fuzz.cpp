@@ -0,0 +1,705 @@
+// Differential fuzzer of the execution engines. It generates random
+// well-formed programs that use every instruction of asmvm.y, runs each on
+// the reference tree interpreter (parsed, Instruction::Exec) and on every
+// other engine, and compares registers, data memory, output, diagnostics
+// and exit code. Mismatching programs are minimized line by line and saved.
+//
+// Engines:
+//   image    the program saved to an image (as the disk cache does) and
+//            loaded back without the parser.
+//   sliced   Continue() with a small random fuel, suspending and resuming
+//            at every block boundary.
+//   guarded  --guard-pages: unchecked loads, stores and stack accesses.
+//   profiled --profile: laid out and fused after a profile of its own run.
+//   aot      translated to C++, built with $CXX against libasmvm.a and run
+//            as a process. Only output and exit code are compared, so the
+//            programs print their registers and a hash of their memory
+//            before EXIT. Slow, so only every --aot-every programs.
+//
+//   make fuzz [FUZZ_SECONDS=60]
+//   fuzz/fuzz [--seconds N] [--seed N] [--aot-every N] [--out dir]
+//
+// Run from the top of the tree, where libasmvm.a and the headers are.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../aot.h"
+#include "../asmvm.h"
+#include "../image.h"
+#include "../output_sink.h"
+#include "../parser_aid.h"
+#include "../profile.h"
+#include "../source_buffer.h"
+
+namespace {
+
+// Instructions the reference may run before a program is thrown away. The
+// generated programs always finish well before; minimized ones may not.
+const int64_t kMaxFuel = 1000000;
+// Seconds a translated program may run.
+const int kAotTimeout = 10;
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+std::string Format(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+std::string Format(const char* format, ...) {
+  char buffer[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  return buffer;
+}
+
+std::string Join(const std::vector<std::string>& lines) {
+  std::string text;
+  for (size_t i = 0; i < lines.size(); ++i) text += lines[i] + "\n";
+  return text;
+}
+
+bool WriteFile(const std::string& path, const std::string& data) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) return false;
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && ok;
+}
+
+std::string ReadFile(const std::string& path) {
+  std::string data;
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) return data;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) data.append(buffer, n);
+  fclose(file);
+  return data;
+}
+
+// Random programs. Every statement leaves the stack as it found it and
+// every loop counts down R7, which nothing else writes, so the programs
+// terminate and never underflow. Memory accesses stay inside buf, whose
+// indices are masked, or at constant offsets of the .DATA variables.
+// Divisors are non-zero constants other than -1 and shift counts are
+// below 32, so there is no undefined behaviour for the engines to disagree
+// on. Computed jumps, writes to PC, only ever skip the next instruction, and
+// only a few programs have them: ApplyProfile leaves programs that use PC
+// alone, so the profiled engine skips them.
+class Generator {
+ public:
+  explicit Generator(uint32_t seed) : random_(seed), labels_(0) {}
+
+  std::vector<std::string> Program() {
+    lines_.clear();
+    labels_ = 0;
+    functions_ = Uniform(0, 4);
+    uses_pc_ = Chance(5);
+    Data();
+    lines_.push_back(".CODE");
+    Block(-1, 0, Uniform(8, 30), true);
+    Epilogue();
+    for (int f = 0; f < functions_; ++f) Function(f);
+    return lines_;
+  }
+
+ private:
+  int Uniform(int low, int high) {
+    return std::uniform_int_distribution<int>(low, high)(random_);
+  }
+  bool Chance(int percent) { return Uniform(0, 99) < percent; }
+
+  // A register the program may write: R1..R6 or R8.
+  std::string Reg() {
+    static const char* const kRegisters[] = {"R1", "R2", "R3", "R4", "R5", "R6", "R8"};
+    return kRegisters[Uniform(0, 6)];
+  }
+  // Any register but ST and PC, whose values differ between engines.
+  std::string ReadReg() { return Chance(10) ? "R7" : Reg(); }
+
+  std::string Int() {
+    static const int32_t kInteresting[] = {
+      0, 1, -1, 2, 7, 31, 32, 255, 256, 65535, 65536, 2147483647, -2147483647 - 1
+    };
+    switch (Uniform(0, 3)) {
+    case 0: return Format("%d", kInteresting[Uniform(0, 12)]);
+    case 1: return Format("0x%X", uint32_t(Uniform(0, 0xFFFF)));
+    case 2: return Format("%d", Uniform(-100, 100));
+    default: return Format("%d", int32_t(random_()));
+    }
+  }
+  std::string Source() { return Chance(60) ? ReadReg() : Int(); }
+
+  std::string NewLabel() { return Format("L%d", labels_++); }
+  void Emit(const std::string& line) {
+    lines_.push_back(pending_label_ + line);
+    pending_label_.clear();
+  }
+  // The label goes on the next instruction. Two labels in a row need one
+  // in between.
+  void Label(const std::string& label) {
+    if (!pending_label_.empty()) Emit("ADD R1 0 R1");
+    pending_label_ = label + ": ";
+  }
+
+  void Data() {
+    lines_.push_back(".DATA");
+    lines_.push_back(Format("v0 = %s", Int().c_str()));
+    int strings = Uniform(1, 3);
+    for (int i = 0; i < strings; ++i) {
+      std::string text;
+      for (int n = Uniform(0, 12); n > 0; --n) text += char(Uniform('a', 'z'));
+      if (Chance(50)) text += "\\n";
+      lines_.push_back(Format("s%d = \"%s\"", i, text.c_str()));
+      strings_ = strings;
+    }
+    if (Chance(50)) lines_.push_back(Format(".ALIGN %d", 1 << Uniform(0, 4)));
+    array_size_ = Uniform(1, 8);
+    std::string array = "a0 = " + Int();
+    for (int i = 1; i < array_size_; ++i) array += ", " + Int();
+    lines_.push_back(array);
+    lines_.push_back(".BSS");
+    lines_.push_back("buf [260]");
+    if (Chance(50)) lines_.push_back(Format(".ALIGN %d", 1 << Uniform(0, 6)));
+    lines_.push_back(Format("big [%d]", Uniform(1, 4096)));
+  }
+
+  // Index register for buf, masked to stay inside it.
+  std::string BufIndex(uint32_t mask) {
+    std::string index = Reg();
+    Emit(Format("AND %s %u %s", Source().c_str(), mask, index.c_str()));
+    return index;
+  }
+  // Address of size bytes: buf[Rx], buf[k], v0, a0[k], 0x0[k] or Rb[k].
+  std::string Address(uint32_t size, bool aligned) {
+    uint32_t mask = aligned ? 252 : 255;
+    switch (Uniform(0, 5)) {
+    case 0: return "buf[" + BufIndex(mask) + "]";
+    case 1: return Format("buf[%u]", uint32_t(Uniform(0, 255)) & mask);
+    case 2: return "v0";
+    case 3: return Format("a0[%d]", Uniform(0, array_size_ - 1) * 4);
+    // v0 is the first variable, at address 0.
+    case 4: return Format("0x0[%u]", uint32_t(Uniform(0, 3)) & ~(size - 1));
+    default: {
+        std::string base = Reg();
+        Emit("PUSH buf");
+        Emit("POP " + base);
+        return Format("%s[%u]", base.c_str(), uint32_t(Uniform(0, 255)) & mask);
+      }
+    }
+  }
+
+  void Simple() {
+    static const char* const kAlu[] = {"ADD", "SUB", "MUL", "AND", "OR", "XOR"};
+    static const char* const kLoads[] = {"LD1", "LD2", "LD4"};
+    static const char* const kStores[] = {"ST1", "ST2", "ST4"};
+    switch (Uniform(0, 16)) {
+    case 0: case 1:
+      Emit(Format("%s %s %s %s", kAlu[Uniform(0, 5)], Source().c_str(), Source().c_str(),
+                  Reg().c_str()));
+      break;
+    case 2: {
+        int divisor = Uniform(-50, 50);
+        if (divisor == 0 || divisor == -1) divisor = 3;
+        Emit(Format("%s %s %d %s", Chance(50) ? "DIV" : "MOD", Source().c_str(), divisor,
+                    Reg().c_str()));
+      }
+      break;
+    case 3:
+      Emit(Format("%s %s %d %s", Chance(50) ? "SHL" : "SHR", Source().c_str(), Uniform(0, 31),
+                  Reg().c_str()));
+      break;
+    case 4:
+      switch (Uniform(0, 2)) {
+      case 0: Emit(Format("NOT %s %s", ReadReg().c_str(), Reg().c_str())); break;
+      case 1: Emit("INC " + Reg()); break;
+      default: Emit("DEC " + Reg()); break;
+      }
+      break;
+    case 5: Emit(Format("MV %s %s", Reg().c_str(), Source().c_str())); break;
+    case 6: case 7: {
+        int kind = Uniform(0, 2);
+        std::string address = Address(1 << kind, false);
+        Emit(Format("%s %s %s", kLoads[kind], Reg().c_str(), address.c_str()));
+      }
+      break;
+    case 8: case 9: {
+        int kind = Uniform(0, 2);
+        std::string address = Address(1 << kind, false);
+        Emit(Format("%s %s %s", kStores[kind], Source().c_str(), address.c_str()));
+      }
+      break;
+    case 10: {
+        std::string address = Address(4, true);
+        switch (Uniform(0, 3)) {
+        case 0: Emit(Format("LD4A %s %s", Reg().c_str(), address.c_str())); break;
+        case 1: Emit(Format("ST4R %s %s", Source().c_str(), address.c_str())); break;
+        case 2: Emit(Format("XADD %s %s", Reg().c_str(), address.c_str())); break;
+        default: Emit(Format("CAS %s %s %s", Reg().c_str(), ReadReg().c_str(), address.c_str()));
+        }
+      }
+      break;
+    case 11: {
+        std::string print = "PRINT";
+        for (int n = Uniform(1, 4); n > 0; --n) {
+          switch (Uniform(0, 3)) {
+          case 0: print += " \"x\""; break;
+          case 1: print += " " + Source(); break;
+          case 2: print += Format(" s%d", Uniform(0, strings_ - 1)); break;
+          default: print += " \" \""; break;
+          }
+        }
+        Emit(print + " \"\\n\"");
+      }
+      break;
+    case 12:
+      if (Chance(50)) {
+        Emit("FPRINT " + ReadReg());
+      } else if (Chance(50)) {
+        Emit(Format("SPRINT s%d", Uniform(0, strings_ - 1)));
+      } else {
+        std::string base = Reg();
+        Emit(Format("PUSH s%d", Uniform(0, strings_ - 1)));
+        Emit("POP " + base);
+        Emit("SPRINT " + base);
+      }
+      break;
+    case 13:
+      // hash is register convention (R1 = buffer, R2 = bytes); sleep pops.
+      if (Chance(70)) {
+        Emit("PUSH buf");
+        Emit("POP R1");
+        Emit(Format("AND %s 255 R2", Source().c_str()));
+        Emit(Chance(50) ? "SYSCALL \"hash\" " + Reg() : "SYSCALL 17 " + Reg());
+      } else {
+        Emit("PUSH 0");
+        Emit("SYSCALL \"sleep\" " + Reg());
+      }
+      break;
+    case 14:
+      Emit(Format("PRINT \"%s\" %s \"\\n\"", Chance(50) ? "r" : "", ReadReg().c_str()));
+      break;
+    case 15:
+      if (uses_pc_) {
+        // Writing PC goes on after the index written.
+        std::string index = Reg();
+        Emit(Format("MV %s PC", index.c_str()));
+        Emit(Format("ADD %s 2 PC", index.c_str()));
+        Emit("INC " + index);
+        break;
+      }
+      // Falls through.
+    default:
+      Emit(Format("ADD %s %s %s", ReadReg().c_str(), Int().c_str(), Reg().c_str()));
+      break;
+    }
+  }
+
+  // count statements of function (-1 for main) at nesting depth.
+  void Block(int function, int depth, int count, bool loops) {
+    for (int i = 0; i < count; ++i) {
+      int kind = depth >= 3 ? 0 : Uniform(0, 12);
+      if (kind <= 6) {
+        Simple();
+      } else if (kind == 7) {
+        Emit(Chance(70) ? "PUSH " + Source() : Format("PUSH s%d", Uniform(0, strings_ - 1)));
+        Block(function, depth + 1, Uniform(0, 4), false);
+        Emit(Chance(80) ? "POP " + Reg() : "POP");
+      } else if (kind == 8) {
+        int words = Uniform(0, 16);
+        Emit(Format("PUSHN %d", words));
+        Block(function, depth + 1, Uniform(0, 4), false);
+        Emit(Format("POPN %d", words));
+      } else if (kind == 9) {
+        std::string skip = NewLabel();
+        Emit(Format("%s %s %s", Chance(50) ? "JZ" : "JNZ", ReadReg().c_str(), skip.c_str()));
+        Block(function, depth + 1, Uniform(1, 5), loops);
+        if (Chance(40)) {
+          std::string end = NewLabel();
+          Emit("JMP " + end);
+          Label(skip);
+          Block(function, depth + 1, Uniform(1, 5), loops);
+          Label(end);
+        } else {
+          Label(skip);
+        }
+      } else if (kind == 10 && loops) {
+        std::string top = NewLabel();
+        Emit(Format("MV R7 %d", Uniform(1, 12)));
+        Label(top);
+        Block(function, depth + 1, Uniform(1, 8), false);
+        Emit("DEC R7");
+        Emit("JNZ R7 " + top);
+      } else if (kind >= 11 && function + 1 < functions_) {
+        // Only later functions, so there is no recursion.
+        Emit(Format("CALL f%d", Uniform(function + 1, functions_ - 1)));
+      } else {
+        Simple();
+      }
+    }
+  }
+
+  void Function(int f) {
+    Label(Format("f%d", f));
+    // A frame addressed from ST, which is the same wherever the stack is.
+    bool frame = Chance(50);
+    if (frame) {
+      Emit("ENTER 8 ST");
+      Emit(Format("ST4 %s ST[-4]", Source().c_str()));
+    }
+    Block(f, 1, Uniform(1, 12), false);
+    if (frame) {
+      Emit(Format("LD4 %s ST[-4]", Reg().c_str()));
+      Emit("LEAVE");
+    }
+    Emit("RET");
+  }
+
+  // What the aot engine compares instead of registers and memory.
+  void Epilogue() {
+    Emit("PRINT \"regs\" \" \" R1 \" \" R2 \" \" R3 \" \" R4 \" \" R5 \" \" R6 \" \" R7 \" \" R8 \"\\n\"");
+    std::string exit = Chance(50) ? Format("%d", Uniform(0, 3)) : ReadReg();
+    bool exit_register = exit[0] == 'R';
+    Emit("PUSH " + (exit_register ? exit : std::string("0")));
+    Emit("LD4 R3 v0");
+    Emit("LD4 R4 a0");
+    Emit("PRINT \"data\" \" \" R3 \" \" R4 \"\\n\"");
+    Emit("PUSH buf");
+    Emit("POP R1");
+    Emit("MV R2 260");
+    Emit("SYSCALL \"hash\" R8");
+    Emit("PRINT \"buf\" \" \" R1 \"\\n\"");
+    Emit("POP R3");
+    Emit("EXIT " + (exit_register ? std::string("R3") : exit));
+  }
+
+  std::mt19937 random_;
+  std::vector<std::string> lines_;
+  std::string pending_label_;
+  int labels_;
+  int functions_;
+  bool uses_pc_;
+  int strings_;
+  int array_size_;
+};
+
+// What a run left behind.
+struct Outcome {
+  bool finished;
+  int32_t exit_code;
+  int32_t registers[8];
+  std::string memory;
+  std::string output;
+  std::string diagnostics;
+};
+
+enum Engine {
+  kEngineImage,
+  kEngineSliced,
+  kEngineGuarded,
+  kEngineProfiled,
+  kEngineAot,
+  kEngineCount
+};
+
+const char* const kEngineNames[kEngineCount] = {"image", "sliced", "guarded", "profiled", "aot"};
+
+// Parses source into a new machine writing to the sinks. NULL if it does
+// not parse or link.
+asmvm::AsmMachine* Load(const std::string& source, asmvm::StringSink* output,
+                        asmvm::StringSink* diagnostics) {
+  asmvm::AsmMachine* vm = new asmvm::AsmMachine();
+  vm->set_output(output);
+  vm->set_diagnostics(diagnostics);
+  asmvm::SourceBuffer buffer;
+  buffer.Assign(source.data(), source.size());
+  if (!asmvm::parser::Parse(buffer, vm)) {
+    delete vm;
+    return NULL;
+  }
+  return vm;
+}
+
+void Finish(asmvm::AsmMachine* vm, bool finished, const asmvm::StringSink& output,
+            const asmvm::StringSink& diagnostics, Outcome* outcome) {
+  outcome->finished = finished;
+  outcome->exit_code = finished ? vm->exit_code() : 0;
+  for (uint32_t i = 0; i < 8; ++i) outcome->registers[i] = vm->get_register(i);
+  // .DATA and .BSS: the stack moves with --guard-pages.
+  outcome->memory.assign(reinterpret_cast<const char*>(vm->data()),
+                         vm->static_data_size() + vm->reserve_size());
+  outcome->output = output.str();
+  outcome->diagnostics = diagnostics.str();
+}
+
+// Runs source on the reference interpreter. False if it does not load or
+// does not finish within kMaxFuel.
+bool RunReference(const std::string& source, Outcome* outcome) {
+  asmvm::StringSink output, diagnostics;
+  asmvm::AsmMachine* vm = Load(source, &output, &diagnostics);
+  if (vm == NULL) return false;
+  vm->Reset();
+  bool finished = vm->Continue(kMaxFuel) == asmvm::AsmMachine::kRunExited;
+  Finish(vm, finished, output, diagnostics, outcome);
+  delete vm;
+  return finished;
+}
+
+// Translates, builds and runs source. Fills output and exit_code only.
+bool RunAot(asmvm::AsmMachine* vm, const std::string& directory, Outcome* outcome) {
+  std::string code;
+  if (!asmvm::TranslateToCpp(*vm, "fuzz", &code)) return false;
+  std::string base = directory + "/aot";
+  if (!WriteFile(base + ".cpp", code)) return false;
+  const char* cxx = getenv("CXX");
+  std::string build = Format("%s -O1 -pthread -I. %s.cpp libasmvm.a -o %s 2> %s.log",
+                             cxx != NULL ? cxx : "g++", base.c_str(), base.c_str(), base.c_str());
+  if (system(build.c_str()) != 0) {
+    outcome->diagnostics = "g++: " + ReadFile(base + ".log");
+    return true;
+  }
+  std::string run = Format("timeout %d %s > %s.out 2> %s.err", kAotTimeout, base.c_str(),
+                           base.c_str(), base.c_str());
+  int status = system(run.c_str());
+  outcome->finished = WIFEXITED(status) && WEXITSTATUS(status) != 124;
+  outcome->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  outcome->output = ReadFile(base + ".out");
+  outcome->diagnostics = ReadFile(base + ".err");
+  return true;
+}
+
+// Runs source on engine. False if the engine could not run it at all.
+bool RunEngine(Engine engine, const std::string& source, const std::string& directory,
+               std::mt19937* random, Outcome* outcome) {
+  asmvm::StringSink output, diagnostics;
+  asmvm::AsmMachine* vm = Load(source, &output, &diagnostics);
+  if (vm == NULL) return false;
+  bool ok = true;
+  switch (engine) {
+  case kEngineImage: {
+      std::string image;
+      asmvm::AsmMachine* loaded = new asmvm::AsmMachine();
+      loaded->set_output(&output);
+      loaded->set_diagnostics(&diagnostics);
+      ok = asmvm::SaveImage(*vm, 0, &image) && asmvm::LoadImage(image, 0, loaded);
+      delete vm;
+      vm = loaded;
+      if (!ok) break;
+      vm->Reset();
+      Finish(vm, vm->Continue(kMaxFuel) == asmvm::AsmMachine::kRunExited, output,
+             diagnostics, outcome);
+    }
+    break;
+  case kEngineSliced: {
+      int64_t slice = std::uniform_int_distribution<int>(1, 50)(*random);
+      vm->Reset();
+      asmvm::AsmMachine::RunState state = asmvm::AsmMachine::kRunSuspended;
+      while (state == asmvm::AsmMachine::kRunSuspended && vm->instructions() < kMaxFuel) {
+        state = vm->Continue(slice);
+      }
+      Finish(vm, state == asmvm::AsmMachine::kRunExited, output, diagnostics, outcome);
+    }
+    break;
+  case kEngineGuarded:
+    ok = vm->EnableGuardPages();
+    if (!ok) break;
+    vm->Reset();
+    Finish(vm, vm->Continue(kMaxFuel) == asmvm::AsmMachine::kRunExited, output, diagnostics,
+           outcome);
+    break;
+  case kEngineProfiled: {
+      // Profiled on a machine of its own, as runs leave their data behind.
+      asmvm::StringSink profile_output, profile_diagnostics;
+      asmvm::AsmMachine* profiled = Load(source, &profile_output, &profile_diagnostics);
+      asmvm::Profile profile(0, profiled->program().size());
+      asmvm::ProfileHooks hooks(&profile);
+      profiled->Reset();
+      profiled->Continue(kMaxFuel, hooks);
+      delete profiled;
+      // Programs it cannot lay out, those that use PC among them, are not
+      // run: they would only test the interpreter again.
+      ok = asmvm::ApplyProfile(vm, profile);
+      if (!ok) break;
+      vm->Reset();
+      Finish(vm, vm->Continue(kMaxFuel) == asmvm::AsmMachine::kRunExited, output, diagnostics,
+             outcome);
+    }
+    break;
+  case kEngineAot:
+    ok = RunAot(vm, directory, outcome);
+    break;
+  default:
+    ok = false;
+  }
+  delete vm;
+  return ok;
+}
+
+// How the engine's outcome differs from the reference, empty if it does not.
+std::string Compare(Engine engine, const Outcome& expected, const Outcome& actual) {
+  if (!actual.finished) return "não terminou";
+  if (engine == kEngineAot) {
+    if (uint8_t(expected.exit_code) != uint8_t(actual.exit_code)) {
+      return Format("código de saída %d, esperado %d", actual.exit_code,
+                    uint8_t(expected.exit_code));
+    }
+  } else {
+    if (expected.exit_code != actual.exit_code) {
+      return Format("código de saída %d, esperado %d", actual.exit_code, expected.exit_code);
+    }
+    for (int i = 0; i < 8; ++i) {
+      if (expected.registers[i] != actual.registers[i]) {
+        return Format("R%d = %d, esperado %d", i + 1, actual.registers[i], expected.registers[i]);
+      }
+    }
+    if (expected.memory != actual.memory) {
+      size_t i = 0;
+      while (i < expected.memory.size() && i < actual.memory.size() &&
+             expected.memory[i] == actual.memory[i]) {
+        ++i;
+      }
+      return Format("memória difere a partir de [%zu]", i);
+    }
+  }
+  if (expected.output != actual.output) return "saída difere";
+  if (expected.diagnostics != actual.diagnostics) {
+    return "diagnósticos diferem: " + actual.diagnostics.substr(0, 200);
+  }
+  return "";
+}
+
+// Whether lines still load, finish on the reference and mismatch on engine.
+bool Fails(Engine engine, const std::vector<std::string>& lines, const std::string& directory,
+           std::mt19937* random, std::string* difference) {
+  std::string source = Join(lines);
+  Outcome expected, actual;
+  if (!RunReference(source, &expected)) return false;
+  if (!RunEngine(engine, source, directory, random, &actual)) return false;
+  *difference = Compare(engine, expected, actual);
+  return !difference->empty();
+}
+
+// Removes chunks of lines, then single lines, while the program still fails,
+// until nothing more can go or the deadline passes. The last line, an EXIT
+// or RET, stays: the interpreter does not survive running off the end.
+std::vector<std::string> Minimize(Engine engine, std::vector<std::string> lines,
+                                  const std::string& directory, std::mt19937* random,
+                                  double deadline, std::string* difference) {
+  for (size_t chunk = (lines.size() - 1) / 2; chunk >= 1; chunk /= 2) {
+    bool removed = true;
+    while (removed && now_seconds() < deadline) {
+      removed = false;
+      for (size_t begin = 0; begin + 1 < lines.size() && now_seconds() < deadline;) {
+        std::vector<std::string> candidate(lines.begin(), lines.begin() + begin);
+        size_t end = std::min(lines.size() - 1, begin + chunk);
+        candidate.insert(candidate.end(), lines.begin() + end, lines.end());
+        std::string candidate_difference;
+        if (Fails(engine, candidate, directory, random, &candidate_difference)) {
+          lines.swap(candidate);
+          *difference = candidate_difference;
+          removed = true;
+        } else {
+          begin += chunk;
+        }
+      }
+    }
+  }
+  return lines;
+}
+
+int usage(const char* program) {
+  fprintf(stderr, "Uso: %s [--seconds N] [--seed N] [--aot-every N] [--out diretório]\n", program);
+  return 2;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  double seconds = 60;
+  uint32_t seed = time(NULL);
+  int aot_every = 20;
+  std::string directory = "fuzz/failures";
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 == argc) return usage(argv[0]);
+    if (!strcmp(argv[i], "--seconds")) {
+      seconds = atof(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--seed")) {
+      seed = strtoul(argv[i + 1], NULL, 10);
+    } else if (!strcmp(argv[i], "--aot-every")) {
+      aot_every = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--out")) {
+      directory = argv[i + 1];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  mkdir(directory.c_str(), 0755);
+  fprintf(stderr, "Semente %u, %.0f s.\n", seed, seconds);
+
+  double start = now_seconds();
+  double deadline = start + seconds;
+  std::mt19937 random(seed);
+  int programs = 0, discarded = 0, failures = 0;
+  int runs[kEngineCount] = {0};
+  // A crash takes the fuzzer down with it; the program is left here.
+  std::string current = directory + "/current.asmvm";
+  while (now_seconds() < deadline) {
+    uint32_t program_seed = random();
+    Generator generator(program_seed);
+    std::vector<std::string> lines = generator.Program();
+    std::string source = Join(lines);
+    WriteFile(current, source);
+    ++programs;
+    Outcome expected;
+    if (!RunReference(source, &expected)) {
+      ++discarded;
+      continue;
+    }
+    for (int e = 0; e < kEngineCount; ++e) {
+      Engine engine = Engine(e);
+      if (engine == kEngineAot && (aot_every <= 0 || programs % aot_every != 0)) continue;
+      Outcome actual;
+      if (!RunEngine(engine, source, directory, &random, &actual)) continue;
+      ++runs[e];
+      std::string difference = Compare(engine, expected, actual);
+      if (difference.empty()) continue;
+
+      ++failures;
+      fprintf(stderr, "Programa %u: %s: %s. Minimizando...\n", program_seed, kEngineNames[e],
+              difference.c_str());
+      // Minimizing gets at most a quarter of what is left.
+      double minimize_deadline = now_seconds() + std::max(10.0, (deadline - now_seconds()) / 4);
+      std::vector<std::string> minimal =
+          Minimize(engine, lines, directory, &random, minimize_deadline, &difference);
+      std::string path = Format("%s/%u-%s.asmvm", directory.c_str(), program_seed,
+                                kEngineNames[e]);
+      std::string header = Format("; %s: %s\n", kEngineNames[e], difference.c_str());
+      WriteFile(path, header + Join(minimal));
+      fprintf(stderr, "  %zu linhas em %s\n", minimal.size(), path.c_str());
+    }
+  }
+  remove(current.c_str());
+  static const char* const kAotFiles[] = {"", ".cpp", ".log", ".out", ".err"};
+  for (size_t i = 0; i < sizeof(kAotFiles) / sizeof(kAotFiles[0]); ++i) {
+    remove((directory + "/aot" + kAotFiles[i]).c_str());
+  }
+
+  fprintf(stderr, "%d programas em %.1f s (%d descartados), execuções:", programs,
+          now_seconds() - start, discarded);
+  for (int e = 0; e < kEngineCount; ++e) fprintf(stderr, " %s %d", kEngineNames[e], runs[e]);
+  fprintf(stderr, ", %d divergências.\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+#include "heap.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "asmvm.h"
+
+namespace asmvm {
+
+namespace {
+
+const uint32_t kHeapPageSize = 4096;
+const uint8_t kFreedByte = 0xDD;
+
+// Sizes of the small block classes: steps of 16 up to 128, then four steps
+// per doubling up to kMaxSmallBlock.
+const uint32_t kClassSizes[] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256,
+  320, 384, 448, 512,
+  640, 768, 896, 1024,
+};
+const uint32_t kClassCount = sizeof(kClassSizes) / sizeof(kClassSizes[0]);
+
+uint32_t AlignUp(uint32_t value, uint32_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+uint32_t SizeClass(uint32_t size) {
+  if (size <= 128) return size == 0 ? 0 : (size - 1) / 16;
+  uint32_t size_class = 8;
+  while (kClassSizes[size_class] < size) ++size_class;
+  return size_class;
+}
+
+} // namespace
+
+Heap::Heap(AsmMachine* vm)
+  : vm_(vm), begin_(vm->heap_begin()), end_(begin_), debug_(false),
+    free_lists_(kClassCount), in_use_(0), blocks_(0) {
+}
+
+uint32_t Heap::Alloc(uint32_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return AllocLocked(size);
+}
+
+bool Heap::Free(uint32_t address) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return FreeLocked(address);
+}
+
+uint32_t Heap::BlockSize(uint32_t address) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return BlockSizeLocked(address);
+}
+
+uint32_t Heap::Realloc(uint32_t address, uint32_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (address == 0) return AllocLocked(size);
+  uint32_t old_size = BlockSizeLocked(address);
+  if (old_size == 0) return 0;
+  if (size == 0) {
+    FreeLocked(address);
+    return 0;
+  }
+  if (size <= old_size && (old_size > kMaxSmallBlock || size > old_size / 2)) return address;
+  if (old_size > kMaxSmallBlock && size > kMaxSmallBlock) {
+    // Big blocks grow into the free range right after them.
+    uint32_t grown = AlignUp(size, kHeapAlignment);
+    std::map<uint32_t, uint32_t>::iterator next = free_ranges_.find(address + old_size);
+    if (next != free_ranges_.end() && old_size + next->second >= grown) {
+      uint32_t rest = old_size + next->second - grown;
+      free_ranges_.erase(next);
+      if (rest > 0) free_ranges_[address + grown] = rest;
+      big_blocks_[address] = grown;
+      in_use_ += grown - old_size;
+      return address;
+    }
+  }
+  uint32_t moved = AllocLocked(size);
+  if (moved == 0) return 0;
+  uint8_t* memory = vm_->data();
+  memmove(memory + moved, memory + address, std::min(size, old_size));
+  FreeLocked(address);
+  return moved;
+}
+
+Heap::Stats Heap::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats;
+  stats.in_use = in_use_;
+  stats.heap_size = end_ - begin_;
+  stats.free_bytes = stats.heap_size - in_use_;
+  stats.largest_free = 0;
+  uint32_t range_bytes = 0;
+  for (std::map<uint32_t, uint32_t>::const_iterator it = free_ranges_.begin();
+       it != free_ranges_.end(); ++it) {
+    range_bytes += it->second;
+    stats.largest_free = std::max(stats.largest_free, it->second);
+  }
+  stats.fragmentation =
+      range_bytes == 0 ? 0 : 100 - uint32_t(uint64_t(stats.largest_free) * 100 / range_bytes);
+  stats.blocks = blocks_;
+  return stats;
+}
+
+uint32_t Heap::AllocLocked(uint32_t size) {
+  if (size == 0) size = 1;
+  if (size > kMaxMemorySize) return 0;
+  uint32_t address;
+  if (size <= kMaxSmallBlock) {
+    uint32_t size_class = SizeClass(size);
+    std::vector<uint32_t>& free_list = free_lists_[size_class];
+    if (free_list.empty() && !RefillClass(size_class)) return 0;
+    address = free_list.back();
+    free_list.pop_back();
+    size = kClassSizes[size_class];
+  } else {
+    size = AlignUp(size, kHeapAlignment);
+    address = AllocRange(size, kHeapAlignment);
+    if (address == 0) return 0;
+    big_blocks_[address] = size;
+  }
+  MarkLive(address, true);
+  in_use_ += size;
+  ++blocks_;
+  return address;
+}
+
+bool Heap::FreeLocked(uint32_t address) {
+  uint32_t size = BlockSizeLocked(address);
+  if (size == 0) return false;
+  uint8_t size_class = page_classes_[(address - begin_) / kHeapPageSize];
+  if (size_class != 0) {
+    free_lists_[size_class - 1].push_back(address);
+  } else {
+    big_blocks_.erase(address);
+    FreeRange(address, size);
+  }
+  MarkLive(address, false);
+  if (debug_) memset(vm_->data() + address, kFreedByte, size);
+  in_use_ -= size;
+  --blocks_;
+  return true;
+}
+
+uint32_t Heap::BlockSizeLocked(uint32_t address) const {
+  if (address < begin_ || address >= end_ || address % kHeapAlignment != 0 || !IsLive(address)) return 0;
+  uint8_t size_class = page_classes_[(address - begin_) / kHeapPageSize];
+  if (size_class != 0) {
+    // Spans are aligned to their size, so their blocks start at multiples
+    // of the class size from an address multiple of kHeapSpanSize.
+    uint32_t size = kClassSizes[size_class - 1];
+    return address % kHeapSpanSize % size == 0 ? size : 0;
+  }
+  std::map<uint32_t, uint32_t>::const_iterator block = big_blocks_.find(address);
+  return block == big_blocks_.end() ? 0 : block->second;
+}
+
+uint32_t Heap::AllocRange(uint32_t size, uint32_t align) {
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    for (std::map<uint32_t, uint32_t>::iterator it = free_ranges_.begin();
+         it != free_ranges_.end(); ++it) {
+      uint32_t range = it->first;
+      uint32_t range_size = it->second;
+      uint32_t address = AlignUp(range, align);
+      if (address - range > range_size || range_size - (address - range) < size) continue;
+      free_ranges_.erase(it);
+      if (address > range) free_ranges_[range] = address - range;
+      uint32_t end = address + size;
+      if (end < range + range_size) free_ranges_[end] = range + range_size - end;
+      return address;
+    }
+    if (attempt == 0 && !Grow(size + align)) return 0;
+  }
+  return 0;
+}
+
+void Heap::FreeRange(uint32_t address, uint32_t size) {
+  std::map<uint32_t, uint32_t>::iterator next = free_ranges_.lower_bound(address);
+  if (next != free_ranges_.end() && address + size == next->first) {
+    size += next->second;
+    next = free_ranges_.erase(next);
+  }
+  if (next != free_ranges_.begin()) {
+    std::map<uint32_t, uint32_t>::iterator previous = next;
+    --previous;
+    if (previous->first + previous->second == address) {
+      previous->second += size;
+      return;
+    }
+  }
+  free_ranges_[address] = size;
+}
+
+bool Heap::Grow(uint32_t size) {
+  uint64_t end = uint64_t(end_) + AlignUp(std::max(size, kHeapGrowth), kHeapPageSize);
+  if (end > kMaxMemorySize) end = kMaxMemorySize;
+  if (end <= end_ || end - end_ < size || !vm_->GrowMemory(end)) return false;
+  uint32_t old_end = end_;
+  end_ = end;
+  page_classes_.resize((end_ - begin_) / kHeapPageSize, 0);
+  live_.resize((end_ - begin_) / kHeapAlignment, false);
+  FreeRange(old_end, end_ - old_end);
+  return true;
+}
+
+bool Heap::RefillClass(uint32_t size_class) {
+  uint32_t span = AllocRange(kHeapSpanSize, kHeapSpanSize);
+  if (span == 0) return false;
+  for (uint32_t page = 0; page < kHeapSpanSize; page += kHeapPageSize) {
+    page_classes_[(span + page - begin_) / kHeapPageSize] = size_class + 1;
+  }
+  // Pushed backwards, so blocks come out in address order.
+  uint32_t block_size = kClassSizes[size_class];
+  std::vector<uint32_t>& free_list = free_lists_[size_class];
+  for (uint32_t block = kHeapSpanSize / block_size; block > 0; --block) {
+    free_list.push_back(span + (block - 1) * block_size);
+  }
+  return true;
+}
+
+void Heap::MarkLive(uint32_t address, bool live) {
+  live_[(address - begin_) / kHeapAlignment] = live;
+}
+
+bool Heap::IsLive(uint32_t address) const {
+  return live_[(address - begin_) / kHeapAlignment];
+}
+
+} // namespace asmvm
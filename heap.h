@@ -0,0 +1,104 @@
+#ifndef ASMVM_HEAP_H
+#define ASMVM_HEAP_H
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+namespace asmvm {
+
+class AsmMachine;
+
+const uint32_t kHeapAlignment = 16;
+// Blocks up to this size come from the size class free lists.
+const uint32_t kMaxSmallBlock = 1024;
+// Small blocks of one class are carved a span at a time, from an address
+// multiple of the span size.
+const uint32_t kHeapSpanSize = 16384;
+// The heap grows at least this much at a time.
+const uint32_t kHeapGrowth = 65536;
+
+// Allocator of the heap of a program (see the alloc, free, realloc and
+// heap_stats host functions). The heap is the VM memory from heap_begin() up
+// to the end of the memory, which grows with it. All bookkeeping is native,
+// so the program cannot corrupt it.
+//
+// Small blocks are rounded up to one of a few size classes and come from a
+// LIFO free list per class, refilled a whole span at a time. Bigger blocks,
+// and the spans themselves, come from address ordered free ranges, first fit,
+// coalesced with their neighbours when freed. Spans are never given back.
+//
+// The heap remembers which addresses are live blocks, so double frees and
+// frees of addresses that are not blocks fail instead of corrupting its free
+// lists. In debug mode they are also reported, and freed blocks are filled
+// with 0xDD.
+class Heap {
+ public:
+  struct Stats {
+    uint32_t in_use;        // Bytes of live blocks, size classes included.
+    uint32_t heap_size;     // Bytes between heap_begin() and the end.
+    uint32_t free_bytes;    // heap_size - in_use.
+    uint32_t largest_free;  // Largest free range for big blocks.
+    uint32_t fragmentation; // 100 - largest_free * 100 / bytes in free ranges.
+    uint32_t blocks;        // Live blocks.
+  };
+
+  // vm is the root machine of the program.
+  explicit Heap(AsmMachine* vm);
+
+  uint32_t heap_begin() const { return begin_; }
+  bool debug() const { return debug_; }
+  void set_debug(bool debug) { debug_ = debug; }
+
+  // Address of a block of at least size bytes, aligned to kHeapAlignment, or
+  // 0 if the memory is exhausted. The block is not cleared.
+  uint32_t Alloc(uint32_t size);
+  // False if address is not a live block.
+  bool Free(uint32_t address);
+  // Moves the block to one of size bytes, keeping its contents, as C realloc:
+  // address 0 allocates and size 0 frees. 0 on failure, which leaves the
+  // block as it was.
+  uint32_t Realloc(uint32_t address, uint32_t size);
+  // Bytes usable in the block at address, or 0 if it is not a block.
+  uint32_t BlockSize(uint32_t address);
+
+  Stats stats();
+
+ private:
+  Heap(const Heap&);
+  Heap& operator = (const Heap&);
+
+  // Versions of the public calls for when mutex_ is held.
+  uint32_t AllocLocked(uint32_t size);
+  bool FreeLocked(uint32_t address);
+  uint32_t BlockSizeLocked(uint32_t address) const;
+  // First fit from the free ranges, growing the heap if none fits. align is
+  // a power of two multiple of kHeapAlignment.
+  uint32_t AllocRange(uint32_t size, uint32_t align);
+  void FreeRange(uint32_t address, uint32_t size);
+  bool Grow(uint32_t size);
+  bool RefillClass(uint32_t size_class);
+  void MarkLive(uint32_t address, bool live);
+  bool IsLive(uint32_t address) const;
+
+  AsmMachine* vm_;
+  std::mutex mutex_;
+  uint32_t begin_;
+  uint32_t end_;
+  bool debug_;
+  // Per class, addresses of the free small blocks.
+  std::vector<std::vector<uint32_t> > free_lists_;
+  // Size class + 1 of each page of the heap inside a span, 0 for the rest.
+  std::vector<uint8_t> page_classes_;
+  std::map<uint32_t, uint32_t> free_ranges_;  // Address to size.
+  std::map<uint32_t, uint32_t> big_blocks_;   // Address to size.
+  // One bit per kHeapAlignment bytes, set at live blocks.
+  std::vector<bool> live_;
+  uint32_t in_use_;
+  uint32_t blocks_;
+};
+
+} // namespace asmvm
+
+#endif
@@ -0,0 +1,711 @@
+#include "host_functions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "asmvm.h"
+#include "channel.h"
+#include "heap.h"
+#include "metrics.h"
+#include "syscall_log.h"
+#include "threads.h"
+
+namespace asmvm {
+
+namespace {
+
+enum SysCallCode {
+  kSysCallFopen = 0,
+  kSysCallFclose = 1,
+  kSysCallFprint = 2,
+  kSysCallReadString = 3,
+  kSysCallReadInt = 4,
+  kSysCallReadFloat = 5,
+  kSysCallSleep,
+  kSysCallFread,
+  kSysCallFwrite,
+  kSysCallFseek,
+  kSysCallNow,
+  kSysCallSocket,
+  kSysCallTCPConnect,
+  kSysCallSend,
+  kSysCallRecv,
+  kSysCallListen,
+  kSysCallBind,
+  kSysCallHash,
+  kSysCallSpawn,
+  kSysCallJoin,
+  kSysCallFutexWait,
+  kSysCallFutexWake,
+  kSysCallChanOpen,
+  kSysCallChanClose,
+  kSysCallChanSend,
+  kSysCallChanRecv,
+  kSysCallChanSendBatch,
+  kSysCallChanRecvBatch,
+  kSysCallReadNumbers,
+  kSysCallAlloc,
+  kSysCallFree,
+  kSysCallRealloc,
+  kSysCallHeapStats
+};
+
+enum OpenMode {
+  kOpenModeRead = 1,
+  kOpenModeWrite = 2,
+  kOpenModeCreate = 4,
+  kOpenModeBinary = 8,
+  kOpenModeAppend = 16
+};
+
+enum ParamType {
+  kTypeString = 0,
+  kTypeInt,
+  kTypeFloat,
+  kTypeNoMoreParams
+};
+
+union float_wrapper {
+    int32_t i;
+    float f;
+};
+
+FILE* File(HostCall& call, int32_t handler) {
+  if (handler <= 0) return NULL;
+  return call.vm().file(handler);
+}
+
+// Bytes moved through the file handler, for the metrics if enabled.
+void CountRead(HostCall& call, int32_t handler, int64_t bytes) {
+  Metrics* metrics = call.vm().metrics();
+  if (metrics != NULL && bytes > 0) metrics->RecordRead(handler, bytes);
+}
+
+void CountWritten(HostCall& call, int32_t handler, int64_t bytes) {
+  Metrics* metrics = call.vm().metrics();
+  if (metrics != NULL && bytes > 0) metrics->RecordWrite(handler, bytes);
+}
+
+int32_t Fopen(HostCall& call) {
+  const char* filename = call.string(0);
+  int32_t mode = call.integer(1);
+  int32_t handler = 0;
+  if (filename == NULL) {
+    // Leaves handler 0 on the stack, as for any other failure.
+  } else if ((mode & (kOpenModeRead)) == kOpenModeRead) {
+    handler = call.vm().fopen(filename, "r");
+  } else if ((mode & (kOpenModeRead | kOpenModeWrite)) == (kOpenModeRead | kOpenModeWrite)) {
+    handler = call.vm().fopen(filename, "r+");
+  } else if ((mode & (kOpenModeRead | kOpenModeWrite | kOpenModeCreate | kOpenModeBinary)) == (kOpenModeRead | kOpenModeWrite | kOpenModeCreate | kOpenModeBinary)) {
+    handler = call.vm().fopen(filename, "wb+");
+  } else if ((mode & (kOpenModeRead | kOpenModeWrite | kOpenModeCreate)) == (kOpenModeRead | kOpenModeWrite | kOpenModeCreate)) {
+    handler = call.vm().fopen(filename, "w+");
+  } else if ((mode & (kOpenModeWrite | kOpenModeCreate)) == (kOpenModeWrite | kOpenModeCreate)) {
+    handler = call.vm().fopen(filename, "w");
+  } else if ((mode & (kOpenModeRead | kOpenModeWrite | kOpenModeBinary)) == (kOpenModeRead | kOpenModeWrite | kOpenModeBinary)) {
+    handler = call.vm().fopen(filename, "rb+");
+  } else if ((mode & (kOpenModeRead | kOpenModeBinary)) == (kOpenModeRead | kOpenModeBinary)) {
+    handler = call.vm().fopen(filename, "rb");
+  } else if ((mode & (kOpenModeWrite | kOpenModeBinary)) == (kOpenModeWrite | kOpenModeBinary)) {
+    handler = call.vm().fopen(filename, "wb");
+  } else if ((mode & (kOpenModeAppend | kOpenModeBinary)) == (kOpenModeAppend | kOpenModeBinary)) {
+    handler = call.vm().fopen(filename, "ab");
+  } else if ((mode & (kOpenModeAppend)) == kOpenModeAppend) {
+    handler = call.vm().fopen(filename, "a");
+  } else if ((mode & (kOpenModeAppend | kOpenModeRead | kOpenModeBinary)) == (kOpenModeAppend | kOpenModeRead | kOpenModeBinary)) {
+    handler = call.vm().fopen(filename, "ab+");
+  } else if ((mode & (kOpenModeAppend | kOpenModeRead )) == (kOpenModeAppend | kOpenModeRead )) {
+    handler = call.vm().fopen(filename, "a+");
+  }
+  call.set_result(handler);
+  return handler == 0 ? 1 : 0;
+}
+
+int32_t Fclose(HostCall& call) {
+  if (File(call, call.integer(0)) == NULL) return 1;
+  call.vm().fclose(call.integer(0));
+  return 0;
+}
+
+int32_t Fprint(HostCall& call) {
+  FILE* file = File(call, call.integer(0));
+  int32_t value = 0;
+  int written = 0;
+  switch (call.integer(1)) {
+  case kTypeString: {
+      call.Pop(&value);
+      const char* str = (const char*)call.vm().data() + value;
+      if (file != NULL && value >= 0 && uint32_t(value) < call.vm().memory_size() &&
+          memchr(str, '\0', call.vm().region_end(value) - value) != NULL) {
+        written = fprintf(file, "%s", str);
+      }
+    }
+    break;
+  case kTypeInt:
+    call.Pop(&value);
+    if (file != NULL) written = fprintf(file, "%d", value);
+    break;
+  case kTypeFloat: {
+      float_wrapper u;
+      call.Pop(&value);
+      u.i = value;
+      if (file != NULL) written = fprintf(file, "%f", u.f);
+    }
+    break;
+  }
+  if (file == NULL) return 1;
+  CountWritten(call, call.integer(0), written);
+  fflush(file);
+  return 0;
+}
+
+int32_t ReadString(HostCall& call) {
+  FILE* file = File(call, call.integer(0));
+  int32_t size = call.integer(1);
+  char* str = size > 0 ? (char*)call.pointer(2, size) : NULL;
+  if (file == NULL || str == NULL) return 1;
+  if (fgets(str, size, file) == NULL) return 1;
+  CountRead(call, call.integer(0), strlen(str));
+  call.Wrote(2, strlen(str) + 1);
+  return 0;
+}
+
+int32_t ReadInt(HostCall& call) {
+  FILE* file = File(call, call.integer(0));
+  int32_t value = 0;
+  int consumed = 0;
+  int res = file == NULL ? 0 : fscanf(file, "%d%n", &value, &consumed);
+  CountRead(call, call.integer(0), consumed);
+  call.set_result(value);
+  return res != 1 ? 1 : 0;
+}
+
+int32_t ReadFloat(HostCall& call) {
+  FILE* file = File(call, call.integer(0));
+  float value = 0.0F;
+  int consumed = 0;
+  int res = file == NULL ? 0 : fscanf(file, "%f%n", &value, &consumed);
+  CountRead(call, call.integer(0), consumed);
+  call.set_result(value);
+  return res != 1 ? 1 : 0;
+}
+
+int32_t Sleep(HostCall& call) {
+  std::this_thread::sleep_for(std::chrono::milliseconds((uint32_t)call.integer(0)));
+  return 0;
+}
+
+// Milliseconds of a monotonic clock in R1, wrapping around.
+int32_t Now(HostCall& call) {
+  call.set_result(int32_t(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count()));
+  return 0;
+}
+
+// 32-bit FNV-1a of the R2 bytes at address R1.
+int32_t Hash(HostCall& call) {
+  uint32_t size = call.integer(1);
+  const uint8_t* data = call.pointer(0, size);
+  if (data == NULL) return 1;
+  uint32_t hash = 2166136261U;
+  for (uint32_t i = 0; i < size; ++i) {
+    hash ^= data[i];
+    hash *= 16777619U;
+  }
+  call.set_result(int32_t(hash));
+  return 0;
+}
+
+// Thread running the function at R1 with R1 = R2 and ST = R3. Status 1 if
+// it could not be started, as under a fuel budget (see ThreadGroup::Spawn).
+int32_t Spawn(HostCall& call) {
+  int32_t id = call.vm().threads().Spawn(call.vm(), call.integer(0), call.integer(1), call.integer(2));
+  call.set_result(id);
+  return id == 0 ? 1 : 0;
+}
+
+int32_t Join(HostCall& call) {
+  int32_t result = 0;
+  if (!call.vm().threads().Join(call.integer(0), &result)) return 1;
+  call.set_result(result);
+  return 0;
+}
+
+// Sleeps while the word at R1 holds R2. Status 1 if it did not.
+int32_t FutexWait(HostCall& call) {
+  int32_t* word = call.vm().atomic_word(call.integer(0));
+  if (word == NULL) return 2;
+  return call.vm().threads().Wait(word, call.integer(1));
+}
+
+// Wakes up to R2 threads sleeping on the word at R1. Result how many.
+int32_t FutexWake(HostCall& call) {
+  int32_t* word = call.vm().atomic_word(call.integer(0));
+  if (word == NULL) return 2;
+  call.set_result(call.vm().threads().Wake(word, call.integer(1)));
+  return 0;
+}
+
+// Channels (see channel.h). R1 is the channel handle. Status 2 for a bad
+// handle or buffer, 1 for a closed channel.
+
+// New MPMC channel of R1 messages of up to R2 bytes. Result its handle.
+int32_t ChanOpen(HostCall& call) {
+  Channel* channel = new Channel(Channel::kMpmc, call.integer(0), call.integer(1));
+  int32_t handle = call.vm().channels().Attach(channel, true, true);
+  if (handle == 0) delete channel;
+  call.set_result(handle);
+  return handle == 0 ? 2 : 0;
+}
+
+// Releases the sending end of R1.
+int32_t ChanClose(HostCall& call) {
+  return call.vm().channels().Release(call.integer(0)) ? 0 : 2;
+}
+
+// Sends the R3 bytes at R2. Result 1 if sent.
+int32_t ChanSend(HostCall& call) {
+  Channel* channel = call.vm().channels().Find(call.integer(0));
+  uint32_t size = call.integer(2);
+  const uint8_t* data = call.pointer(1, size);
+  if (channel == NULL || data == NULL) return 2;
+  call.set_result(0);
+  if (channel->closed()) return 1;
+  if (channel->TrySend(data, size)) {
+    channel->Notify();
+  } else if (call.vm().yield_on_block()) {
+    return kHostWouldBlock;
+  } else if (!channel->Send(data, size)) {
+    return 1;
+  }
+  call.set_result(1);
+  return 0;
+}
+
+// Receives a message into the R3 bytes at R2. Result its size, -1 once the
+// channel is closed and drained.
+int32_t ChanRecv(HostCall& call) {
+  Channel* channel = call.vm().channels().Find(call.integer(0));
+  uint32_t capacity = call.integer(2);
+  uint8_t* data = call.pointer(1, capacity);
+  if (channel == NULL || data == NULL) return 2;
+  int32_t size = channel->TryRecv(data, capacity);
+  if (size >= 0) {
+    channel->Notify();
+  } else if (channel->drained()) {
+    // Nothing left.
+  } else if (call.vm().yield_on_block()) {
+    return kHostWouldBlock;
+  } else {
+    size = channel->Recv(data, capacity);
+  }
+  call.set_result(size);
+  return size < 0 ? 1 : 0;
+}
+
+// Sends up to R3 messages of R4 bytes each, laid out one after the other
+// from R2, waiting only for the first one. Result how many were sent.
+int32_t ChanSendBatch(HostCall& call) {
+  Channel* channel = call.vm().channels().Find(call.integer(0));
+  uint32_t count = call.integer(2);
+  uint32_t size = call.integer(3);
+  if (size == 0 || size > kMaxMessageSize || count > call.vm().memory_size() / size) return 2;
+  const uint8_t* data = call.pointer(1, count * size);
+  if (channel == NULL || data == NULL) return 2;
+  call.set_result(0);
+  if (channel->closed()) return 1;
+  uint32_t sent = 0;
+  while (sent < count && channel->TrySend(data + sent * size, size)) ++sent;
+  if (sent == 0 && count > 0) {
+    if (call.vm().yield_on_block()) return kHostWouldBlock;
+    if (!channel->Send(data, size)) return 1;
+    ++sent;
+    while (sent < count && channel->TrySend(data + sent * size, size)) ++sent;
+  }
+  // One wakeup for the whole batch.
+  channel->Notify();
+  call.set_result(int32_t(sent));
+  return 0;
+}
+
+// Receives up to R3 messages into R4 byte slots from R2, waiting only for
+// the first one. Result how many were received, 0 once the channel is
+// closed and drained.
+int32_t ChanRecvBatch(HostCall& call) {
+  Channel* channel = call.vm().channels().Find(call.integer(0));
+  uint32_t count = call.integer(2);
+  uint32_t size = call.integer(3);
+  if (size == 0 || size > kMaxMessageSize || count > call.vm().memory_size() / size) return 2;
+  uint8_t* data = call.pointer(1, count * size);
+  if (channel == NULL || data == NULL) return 2;
+  uint32_t received = 0;
+  while (received < count && channel->TryRecv(data + received * size, size) >= 0) ++received;
+  if (received == 0 && count > 0 && !channel->drained()) {
+    if (call.vm().yield_on_block()) return kHostWouldBlock;
+    if (channel->Recv(data, size) >= 0) ++received;
+    while (received < count && channel->TryRecv(data + received * size, size) >= 0) ++received;
+  }
+  if (received > 0) channel->Notify();
+  call.set_result(int32_t(received));
+  return received == 0 && count > 0 ? 1 : 0;
+}
+
+// Stop reasons of read_numbers.
+enum ReadStop {
+  kReadStopCount = 0,
+  kReadStopEnd,
+  kReadStopArgs,
+  kReadStopMalformed
+};
+
+const int kMaxNumberLength = 64;
+
+inline bool IsSeparator(int c) {
+  return c == ' ' || c == ',' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+inline bool IsDigit(int c) {
+  return c >= '0' && c <= '9';
+}
+
+// Parses one integer whose first character is c, saturating like strtol.
+// Returns its length, or 0, with the offending character pushed back, if it
+// is not one.
+int ParseInt(FILE* file, int c, int32_t* value) {
+  bool negative = c == '-';
+  int length = 0;
+  if (c == '-' || c == '+') {
+    c = getc_unlocked(file);
+    ++length;
+  }
+  if (!IsDigit(c)) {
+    if (c != EOF) ungetc(c, file);
+    return 0;
+  }
+  int64_t n = 0;
+  for (; IsDigit(c); c = getc_unlocked(file)) {
+    if (n <= int64_t(INT32_MAX) + 1) n = n * 10 + (c - '0');
+    ++length;
+  }
+  if (c != EOF) ungetc(c, file);
+  if (negative) n = -n;
+  if (n > INT32_MAX) n = INT32_MAX;
+  if (n < INT32_MIN) n = INT32_MIN;
+  *value = int32_t(n);
+  return length;
+}
+
+// Collects the token starting at c and converts it with strtof, which rounds
+// the same way as the fscanf of read_float. Returns its length, or 0 if it
+// is not a number.
+int ParseFloat(FILE* file, int c, float* value) {
+  char token[kMaxNumberLength + 1];
+  int length = 0;
+  while (c != EOF && !IsSeparator(c) && length < kMaxNumberLength) {
+    token[length++] = char(c);
+    c = getc_unlocked(file);
+  }
+  if (c != EOF) ungetc(c, file);
+  token[length] = '\0';
+  char* end = NULL;
+  *value = strtof(token, &end);
+  return length < kMaxNumberLength && end == token + length ? length : 0;
+}
+
+// Parses up to R4 numbers separated by whitespace or commas from the file R1
+// straight into the int32 (R2 = 1) or float32 (R2 = 2) array at R3. Result
+// how many were stored; the status tells why it stopped (see ReadStop).
+int32_t ReadNumbers(HostCall& call) {
+  FILE* file = File(call, call.integer(0));
+  int32_t type = call.integer(1);
+  uint32_t count = call.integer(3);
+  call.set_result(0);
+  if (count > call.vm().memory_size() / sizeof(int32_t)) return kReadStopArgs;
+  uint8_t* data = call.pointer(2, count * sizeof(int32_t));
+  if (file == NULL || data == NULL || (type != kTypeInt && type != kTypeFloat)) {
+    return kReadStopArgs;
+  }
+  int32_t stop = kReadStopCount;
+  uint32_t parsed = 0;
+  int64_t bytes = 0;
+  // One lock for the whole batch instead of one per character.
+  flockfile(file);
+  while (parsed < count) {
+    int c = getc_unlocked(file);
+    for (; IsSeparator(c); c = getc_unlocked(file)) ++bytes;
+    if (c == EOF) {
+      stop = kReadStopEnd;
+      break;
+    }
+    int length;
+    if (type == kTypeInt) {
+      int32_t value;
+      length = ParseInt(file, c, &value);
+      if (length > 0) memcpy(data + parsed * sizeof(value), &value, sizeof(value));
+    } else {
+      float value;
+      length = ParseFloat(file, c, &value);
+      if (length > 0) memcpy(data + parsed * sizeof(value), &value, sizeof(value));
+    }
+    if (length == 0) {
+      stop = kReadStopMalformed;
+      break;
+    }
+    bytes += length;
+    ++parsed;
+  }
+  funlockfile(file);
+  CountRead(call, call.integer(0), bytes);
+  call.Wrote(2, parsed * sizeof(int32_t));
+  call.set_result(int32_t(parsed));
+  return stop;
+}
+
+// Heap (see heap.h). Status 1 when the memory is exhausted.
+
+// New block of R1 bytes. Result its address, 0 on failure.
+int32_t Alloc(HostCall& call) {
+  uint32_t address = call.vm().heap().Alloc(call.integer(0));
+  call.set_result(int32_t(address));
+  return address == 0 ? 1 : 0;
+}
+
+// Frees the block at R1. Status 1 if it is not a block.
+int32_t Free(HostCall& call) {
+  Heap& heap = call.vm().heap();
+  if (heap.Free(call.integer(0))) return 0;
+  if (heap.debug()) {
+    call.vm().Diagnostic("Heap: free of [%d], which is not an allocated block. Double free?\n",
+                         call.integer(0));
+  }
+  return 1;
+}
+
+// Resizes the block at R1 to R2 bytes. Result its new address. Status 2 if R1
+// is not a block.
+int32_t Realloc(HostCall& call) {
+  Heap& heap = call.vm().heap();
+  uint32_t address = call.integer(0);
+  uint32_t size = call.integer(1);
+  call.set_result(0);
+  if (address != 0 && heap.BlockSize(address) == 0) return 2;
+  uint32_t moved = heap.Realloc(address, size);
+  call.set_result(int32_t(moved));
+  return moved == 0 && size != 0 ? 1 : 0;
+}
+
+// Stores in_use, heap_size, free_bytes, largest_free, fragmentation and
+// blocks (see Heap::Stats) in the int32 array at R1.
+int32_t HeapStats(HostCall& call) {
+  Heap::Stats stats = call.vm().heap().stats();
+  int32_t values[] = {
+    int32_t(stats.in_use), int32_t(stats.heap_size), int32_t(stats.free_bytes),
+    int32_t(stats.largest_free), int32_t(stats.fragmentation), int32_t(stats.blocks)
+  };
+  uint8_t* data = call.pointer(0, sizeof(values));
+  if (data == NULL) return 2;
+  memcpy(data, values, sizeof(values));
+  return 0;
+}
+
+bool ParseSignature(const std::string& signature, HostFunction* function) {
+  function->argc = 0;
+  function->result = '\0';
+  function->variadic = false;
+  size_t i = 0;
+  for (; i < signature.size() && signature[i] != '-'; ++i) {
+    char type = signature[i];
+    if (function->variadic) return false;
+    if (type == '*') {
+      function->variadic = true;
+      continue;
+    }
+    if (strchr("ifps", type) == NULL || function->argc == kMaxHostArgs) return false;
+    function->args[function->argc++] = type;
+  }
+  if (i < signature.size()) {
+    if (signature.compare(i, std::string::npos, "->i") == 0 ||
+        signature.compare(i, std::string::npos, "->f") == 0) {
+      function->result = signature[i + 2];
+    } else {
+      return false;
+    }
+  }
+  return !(function->variadic && function->convention == kHostArgsInRegisters);
+}
+
+HostRegistry* NewDefaultRegistry() {
+  HostRegistry* registry = new HostRegistry();
+  registry->Register(kSysCallFopen, "fopen", "si->i", Fopen);
+  registry->Register(kSysCallFclose, "fclose", "i", Fclose);
+  registry->Register(kSysCallFprint, "fprint", "ii*", Fprint);
+  registry->Register(kSysCallReadString, "read_string", "iip", ReadString);
+  registry->Register(kSysCallReadInt, "read_int", "i->i", ReadInt);
+  registry->Register(kSysCallReadFloat, "read_float", "i->f", ReadFloat);
+  registry->Register(kSysCallSleep, "sleep", "i", Sleep);
+  registry->Register(kSysCallNow, "now", "->i", Now, kHostArgsInRegisters);
+  registry->Register(kSysCallHash, "hash", "pi->i", Hash, kHostArgsInRegisters);
+  registry->Register(kSysCallSpawn, "spawn", "iii->i", Spawn, kHostArgsInRegisters);
+  registry->Register(kSysCallJoin, "join", "i->i", Join, kHostArgsInRegisters);
+  registry->Register(kSysCallFutexWait, "futex_wait", "pi", FutexWait, kHostArgsInRegisters);
+  registry->Register(kSysCallFutexWake, "futex_wake", "pi->i", FutexWake, kHostArgsInRegisters);
+  registry->Register(kSysCallChanOpen, "chan_open", "ii->i", ChanOpen, kHostArgsInRegisters);
+  registry->Register(kSysCallChanClose, "chan_close", "i", ChanClose, kHostArgsInRegisters);
+  registry->Register(kSysCallChanSend, "chan_send", "ipi->i", ChanSend, kHostArgsInRegisters);
+  registry->Register(kSysCallChanRecv, "chan_recv", "ipi->i", ChanRecv, kHostArgsInRegisters);
+  registry->Register(kSysCallChanSendBatch, "chan_send_batch", "ipii->i", ChanSendBatch,
+                     kHostArgsInRegisters);
+  registry->Register(kSysCallChanRecvBatch, "chan_recv_batch", "ipii->i", ChanRecvBatch,
+                     kHostArgsInRegisters);
+  registry->Register(kSysCallReadNumbers, "read_numbers", "iipi->i", ReadNumbers,
+                     kHostArgsInRegisters);
+  registry->Register(kSysCallAlloc, "alloc", "i->i", Alloc, kHostArgsInRegisters);
+  registry->Register(kSysCallFree, "free", "p", Free, kHostArgsInRegisters);
+  registry->Register(kSysCallRealloc, "realloc", "pi->i", Realloc, kHostArgsInRegisters);
+  registry->Register(kSysCallHeapStats, "heap_stats", "p", HeapStats, kHostArgsInRegisters);
+  return registry;
+}
+
+// The built-in functions that depend on the host, recorded and replayed
+// (see SysCallLog).
+bool IsLogged(const HostFunction& function) {
+  HostHandler handler = function.handler;
+  return handler == Fopen || handler == Fclose || handler == Fprint || handler == ReadString ||
+         handler == ReadInt || handler == ReadFloat || handler == ReadNumbers ||
+         handler == Sleep || handler == Now;
+}
+
+} // namespace
+
+HostRegistry& HostRegistry::Default() {
+  static HostRegistry* registry = NewDefaultRegistry();
+  return *registry;
+}
+
+bool HostRegistry::Register(int32_t number, const std::string& name, const std::string& signature,
+                            HostHandler handler, HostConvention convention) {
+  if (number != kNoHostNumber && by_number_.count(number) != 0) return false;
+  if (by_name_.count(name) != 0) return false;
+  HostFunction function;
+  function.number = number;
+  function.name = name;
+  function.signature = signature;
+  function.handler = handler;
+  function.convention = convention;
+  if (!ParseSignature(signature, &function)) return false;
+  function.index = functions_.size();
+  functions_.push_back(function);
+  if (number != kNoHostNumber) by_number_[number] = &functions_.back();
+  by_name_[name] = &functions_.back();
+  return true;
+}
+
+const HostFunction* HostRegistry::Find(int32_t number) const {
+  std::map<int32_t, const HostFunction*>::const_iterator it = by_number_.find(number);
+  return it == by_number_.end() ? NULL : it->second;
+}
+
+const HostFunction* HostRegistry::Find(const std::string& name) const {
+  std::map<std::string, const HostFunction*>::const_iterator it = by_name_.find(name);
+  return it == by_name_.end() ? NULL : it->second;
+}
+
+HostCall::HostCall(AsmMachine& vm, const HostFunction& function)
+  : vm_(vm), function_(function), result_(0), written_address_(0), written_size_(0) {
+  memset(args_, 0, sizeof(args_));
+}
+
+float HostCall::real(uint32_t i) const {
+  float_wrapper u;
+  u.i = args_[i];
+  return u.f;
+}
+
+uint8_t* HostCall::pointer(uint32_t i, uint32_t size) {
+  uint32_t address = args_[i];
+  if (!vm_.in_memory(address, 0) || size > vm_.region_end(address) - address) return NULL;
+  return vm_.data() + address;
+}
+
+const char* HostCall::string(uint32_t i) {
+  uint32_t address = args_[i];
+  if (!vm_.in_memory(address, 1)) return NULL;
+  const char* str = (const char*)vm_.data() + address;
+  return memchr(str, '\0', vm_.region_end(address) - address) == NULL ? NULL : str;
+}
+
+bool HostCall::Pop(int32_t* value) {
+  return vm_.pop(value);
+}
+
+void HostCall::set_result(float value) {
+  float_wrapper u;
+  u.f = value;
+  result_ = u.i;
+}
+
+int32_t HostCall::RunLogged(SysCallLog* log) {
+  SysCallLog::Entry entry;
+  uint32_t st = vm_.reg_ST();
+  if (!log->replaying()) {
+    int32_t status = function_.handler(*this);
+    entry.number = function_.number;
+    entry.status = status;
+    entry.result = result_;
+    // Variadic functions pop their extra arguments themselves.
+    entry.stack_delta = int32_t(vm_.reg_ST() - st);
+    if (written_size_ > 0) {
+      entry.address = written_address_;
+      entry.bytes.assign(reinterpret_cast<const char*>(vm_.data()) + written_address_,
+                         written_size_);
+    }
+    log->Record(entry);
+    return status;
+  }
+  bool diverged = log->diverged();
+  if (!log->Replay(function_.number, &entry)) {
+    if (!diverged) {
+      vm_.Diagnostic("Replay: SYSCALL \"%s\" is not the next call in the log. It and the "
+                     "logged calls after it fail.\n", function_.name.c_str());
+    }
+    result_ = 0;
+    return 1;
+  }
+  uint32_t size = entry.bytes.size();
+  if (size > 0 && size <= vm_.memory_size() && vm_.in_memory(entry.address, size)) {
+    memcpy(vm_.data() + entry.address, entry.bytes.data(), size);
+  }
+  vm_.set_register(kRegisterIndexSt, st + entry.stack_delta);
+  result_ = entry.result;
+  return entry.status;
+}
+
+int32_t CallHostFunction(AsmMachine& vm, const HostFunction& function) {
+  HostCall call(vm, function);
+  if (function.convention == kHostArgsInRegisters) {
+    for (uint32_t i = 0; i < function.argc; ++i) {
+      call.args_[i] = vm.get_register(i);
+    }
+  } else {
+    for (uint32_t i = 0; i < function.argc; ++i) {
+      vm.pop(&call.args_[i]);
+    }
+  }
+  SysCallLog* log = vm.syscall_log();
+  int32_t status = log != NULL && IsLogged(function) ? call.RunLogged(log) : function.handler(call);
+  if (status == kHostWouldBlock) return status;
+  if (function.result != '\0') {
+    if (function.convention == kHostArgsInRegisters) {
+      vm.set_register(0, call.result_);
+    } else {
+      vm.push_value(call.result_);
+    }
+  }
+  return status;
+}
+
+} // namespace asmvm
@@ -0,0 +1,135 @@
+#ifndef ASMVM_HOST_FUNCTIONS_H
+#define ASMVM_HOST_FUNCTIONS_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <stdint.h>
+
+namespace asmvm {
+
+class AsmMachine;
+class HostCall;
+class SysCallLog;
+
+const uint32_t kMaxHostArgs = 8;
+// Number of the functions registered by name only.
+const int32_t kNoHostNumber = -1;
+
+// Returns the status the SYSCALL instruction stores in its register operand,
+// 0 on success.
+typedef int32_t (*HostHandler)(HostCall& call);
+
+// Returned by a handler, instead of blocking, when the machine yields on
+// block (AsmMachine::yield_on_block). The SYSCALL runs again, arguments and
+// all, when the machine is continued, so only register convention functions
+// may return it.
+const int32_t kHostWouldBlock = INT32_MIN;
+
+enum HostConvention {
+  // Arguments are popped from the data stack, first argument first, and the
+  // result is pushed back. The convention of the built-in syscalls.
+  kHostArgsOnStack,
+  // Arguments are read from R1..Rn and the result is written to R1. The
+  // SYSCALL status register should be another one.
+  kHostArgsInRegisters
+};
+
+// A native function callable with SYSCALL. The signature lists the argument
+// types, optionally followed by "->" and the type of the result:
+//   i  int32_t
+//   f  float
+//   p  address of a buffer in VM memory
+//   s  address of a '\0' terminated string in VM memory
+//   *  (last, stack convention only) more arguments the handler pops itself
+// e.g. "si->i" takes a string and an int and returns an int.
+struct HostFunction {
+  int32_t number;
+  std::string name;
+  std::string signature;
+  HostHandler handler;
+  HostConvention convention;
+  uint32_t argc;
+  char args[kMaxHostArgs];
+  char result;  // '\0' if none.
+  bool variadic;
+  uint32_t index;  // Position in its registry.
+};
+
+// Host functions by number and by name. SYSCALL instructions are bound to
+// their function when the program is linked, so functions must be registered
+// before that and never removed.
+class HostRegistry {
+ public:
+  HostRegistry() {}
+
+  // The registry machines link against by default, with the built-in
+  // syscalls already registered.
+  static HostRegistry& Default();
+
+  // number may be kNoHostNumber. Returns false if the signature is malformed
+  // or the number or name is already taken.
+  bool Register(int32_t number, const std::string& name, const std::string& signature,
+                HostHandler handler, HostConvention convention = kHostArgsOnStack);
+
+  const HostFunction* Find(int32_t number) const;
+  const HostFunction* Find(const std::string& name) const;
+  // All the functions, by HostFunction::index.
+  size_t size() const { return functions_.size(); }
+  const HostFunction& function(size_t index) const { return functions_[index]; }
+
+ private:
+  HostRegistry(const HostRegistry&);
+  HostRegistry& operator = (const HostRegistry&);
+
+  std::deque<HostFunction> functions_;  // Stable addresses.
+  std::map<int32_t, const HostFunction*> by_number_;
+  std::map<std::string, const HostFunction*> by_name_;
+};
+
+// Arguments and result of one host function call, as seen by its handler.
+// Addresses are checked against the VM memory: pointer() and string() return
+// NULL for buffers that do not fit in it.
+class HostCall {
+ public:
+  HostCall(AsmMachine& vm, const HostFunction& function);
+
+  AsmMachine& vm() { return vm_; }
+
+  int32_t integer(uint32_t i) const { return args_[i]; }
+  float real(uint32_t i) const;
+  uint8_t* pointer(uint32_t i, uint32_t size);
+  const char* string(uint32_t i);
+  // Pops one of the extra arguments of a variadic function.
+  bool Pop(int32_t* value);
+
+  void set_result(int32_t value) { result_ = value; }
+  void set_result(float value);
+  // For handlers of logged functions (see SysCallLog): the first size bytes
+  // of the buffer at argument i are what the call wrote to VM memory.
+  void Wrote(uint32_t i, uint32_t size) {
+    written_address_ = args_[i];
+    written_size_ = size;
+  }
+
+ private:
+  friend int32_t CallHostFunction(AsmMachine& vm, const HostFunction& function);
+
+  // Runs the handler and logs the outcome, or replays it from log.
+  int32_t RunLogged(SysCallLog* log);
+
+  AsmMachine& vm_;
+  const HostFunction& function_;
+  int32_t args_[kMaxHostArgs];
+  int32_t result_;
+  uint32_t written_address_;
+  uint32_t written_size_;
+};
+
+// Fetches the arguments of function, calls it and stores its result. Returns
+// the status for the SYSCALL register.
+int32_t CallHostFunction(AsmMachine& vm, const HostFunction& function);
+
+} // namespace asmvm
+
+#endif
@@ -0,0 +1,641 @@
+#include "image.h"
+
+#include <string.h>
+#include <vector>
+
+#include "op.h"
+
+namespace asmvm {
+
+namespace {
+
+enum SourceTag {
+  kSourceNone = 0,
+  kSourceRegister,
+  kSourceInteger,
+  kSourceSymbol
+};
+
+enum BaseTag {
+  kBaseRegister = 0,
+  kBaseHex,
+  kBaseVar
+};
+
+enum PrintableTag {
+  kPrintableSource = 0,
+  kPrintableString,
+  kPrintableSymbolString
+};
+
+class ImageWriter {
+ public:
+  explicit ImageWriter(std::string* out) : out_(out), ok_(true) {}
+  bool ok() const { return ok_; }
+  void Fail() { ok_ = false; }
+  void Put8(uint8_t value) { out_->push_back(char(value)); }
+  void Put32(uint32_t value) { PutBytes(&value, sizeof(value)); }
+  void Put64(uint64_t value) { PutBytes(&value, sizeof(value)); }
+  void PutBytes(const void* data, size_t size) { out_->append(static_cast<const char*>(data), size); }
+  void PutString(const std::string& value) {
+    Put32(value.size());
+    PutBytes(value.data(), value.size());
+  }
+  void PutSource(const Source* src);
+  void PutBase(const BaseAddress* base);
+  void PutAddress(const Address* address);
+  void PutPrintable(const Printable* printable);
+ private:
+  std::string* out_;
+  bool ok_;
+};
+
+class ImageReader {
+ public:
+  ImageReader(const std::string& in, Arena& arena)
+    : in_(in), arena_(arena), pos_(0), symbol_count_(0), symbol_map_(NULL), ok_(true) {}
+  bool ok() const { return ok_; }
+  void Fail() { ok_ = false; }
+  bool at_end() const { return pos_ == in_.size(); }
+  uint8_t Get8() {
+    uint8_t value = 0;
+    GetBytes(&value, sizeof(value));
+    return value;
+  }
+  uint32_t Get32() {
+    uint32_t value = 0;
+    GetBytes(&value, sizeof(value));
+    return value;
+  }
+  uint64_t Get64() {
+    uint64_t value = 0;
+    GetBytes(&value, sizeof(value));
+    return value;
+  }
+  const char* GetBytes(void* out, size_t size) {
+    if (!ok_ || in_.size() - pos_ < size) {
+      ok_ = false;
+      return NULL;
+    }
+    const char* data = in_.data() + pos_;
+    if (out != NULL) memcpy(out, data, size);
+    pos_ += size;
+    return data;
+  }
+  std::string GetString() {
+    uint32_t size = Get32();
+    const char* data = GetBytes(NULL, size);
+    return data == NULL ? std::string() : std::string(data, size);
+  }
+  const char* GetArenaString() {
+    uint32_t size = Get32();
+    const char* data = GetBytes(NULL, size);
+    return data == NULL ? "" : arena_.StrDup(data, size);
+  }
+  Arena& arena() { return arena_; }
+  Source* GetSource();
+  SymbolId GetSymbol() {
+    SymbolId id = Get32();
+    if (id >= symbol_count_) ok_ = false;
+    if (!ok_) return 0;
+    return symbol_map_ != NULL ? (*symbol_map_)[id] : id;
+  }
+  void set_symbol_count(size_t symbol_count) { symbol_count_ = symbol_count; }
+  // Ids in the image to ids of the machine, for modules.
+  void set_symbol_map(const std::vector<SymbolId>* symbol_map) {
+    symbol_map_ = symbol_map;
+    symbol_count_ = symbol_map->size();
+  }
+  BaseAddress* GetBase();
+  Address* GetAddress();
+  Printable* GetPrintable();
+ private:
+  const std::string& in_;
+  Arena& arena_;
+  size_t pos_;
+  size_t symbol_count_;
+  const std::vector<SymbolId>* symbol_map_;
+  bool ok_;
+};
+
+void ImageWriter::PutSource(const Source* src) {
+  if (src == NULL) {
+    Put8(kSourceNone);
+  } else if (const RegisterSource* reg = dynamic_cast<const RegisterSource*>(src)) {
+    Put8(kSourceRegister);
+    Put32(reg->rindex());
+  } else if (const SymbolSource* symbol = dynamic_cast<const SymbolSource*>(src)) {
+    Put8(kSourceSymbol);
+    Put32(symbol->symbol());
+  } else {
+    const IntegerValue* int_value = static_cast<const IntegerValue*>(src);
+    Put8(kSourceInteger);
+    Put8(int_value->kind());
+    Put32(int_value->value());
+  }
+}
+
+Source* ImageReader::GetSource() {
+  switch (Get8()) {
+  case kSourceNone:
+    return NULL;
+  case kSourceRegister:
+    return arena_.New<RegisterSource>(Get32());
+  case kSourceInteger: {
+      Value::ValueKind kind = Value::ValueKind(Get8());
+      return arena_.New<IntegerValue>(kind, int32_t(Get32()));
+    }
+  case kSourceSymbol:
+    return arena_.New<SymbolSource>(GetSymbol());
+  }
+  ok_ = false;
+  return NULL;
+}
+
+void ImageWriter::PutBase(const BaseAddress* base) {
+  if (const BaseAddressRegister* reg = dynamic_cast<const BaseAddressRegister*>(base)) {
+    Put8(kBaseRegister);
+    Put32(reg->rindex());
+  } else if (const BaseAddressHex* hex = dynamic_cast<const BaseAddressHex*>(base)) {
+    Put8(kBaseHex);
+    Put32(hex->hex());
+  } else {
+    Put8(kBaseVar);
+    Put32(static_cast<const BaseAddressVar*>(base)->symbol());
+  }
+}
+
+BaseAddress* ImageReader::GetBase() {
+  switch (Get8()) {
+  case kBaseRegister:
+    return arena_.New<BaseAddressRegister>(Get32());
+  case kBaseHex:
+    return arena_.New<BaseAddressHex>(Get32());
+  case kBaseVar:
+    return arena_.New<BaseAddressVar>(GetSymbol());
+  }
+  ok_ = false;
+  return NULL;
+}
+
+void ImageWriter::PutAddress(const Address* address) {
+  PutBase(address->base());
+  PutSource(address->offset());
+}
+
+Address* ImageReader::GetAddress() {
+  BaseAddress* base = GetBase();
+  if (base == NULL) return NULL;
+  return arena_.New<Address>(base, GetSource());
+}
+
+void ImageWriter::PutPrintable(const Printable* printable) {
+  if (const StringValue* str = dynamic_cast<const StringValue*>(printable)) {
+    Put8(kPrintableString);
+    PutString(str->value());
+  } else if (const SymbolString* str = dynamic_cast<const SymbolString*>(printable)) {
+    Put8(kPrintableSymbolString);
+    Put32(str->symbol());
+  } else {
+    Put8(kPrintableSource);
+    PutSource(static_cast<const Source*>(printable));
+  }
+}
+
+Printable* ImageReader::GetPrintable() {
+  switch (Get8()) {
+  case kPrintableSource:
+    return GetSource();
+  case kPrintableString:
+    return arena_.New<StringValue>(Value::kValueKindConst, GetArenaString());
+  case kPrintableSymbolString:
+    return arena_.New<SymbolString>(GetSymbol());
+  }
+  ok_ = false;
+  return NULL;
+}
+
+void PutInstruction(const Instruction* ins, ImageWriter* w) {
+  Instruction::Opcode opcode = ins->opcode();
+  w->Put8(opcode);
+  switch (opcode) {
+  case Instruction::kOpAdd:
+  case Instruction::kOpSub:
+  case Instruction::kOpMul:
+  case Instruction::kOpDiv:
+  case Instruction::kOpMod:
+  case Instruction::kOpAnd:
+  case Instruction::kOpOr:
+  case Instruction::kOpXor:
+  case Instruction::kOpShl:
+  case Instruction::kOpShr: {
+      const TernaryInstruction* op = static_cast<const TernaryInstruction*>(ins);
+      w->PutSource(op->param1());
+      w->PutSource(op->param2());
+      w->Put32(op->output_rindex());
+    }
+    break;
+  case Instruction::kOpNot:
+    w->Put32(static_cast<const OpNot*>(ins)->rindex1());
+    w->Put32(static_cast<const OpNot*>(ins)->rindex2());
+    break;
+  case Instruction::kOpJmp:
+    w->Put32(static_cast<const OpJmp*>(ins)->label());
+    break;
+  case Instruction::kOpCall:
+    w->Put32(static_cast<const OpCall*>(ins)->label());
+    break;
+  case Instruction::kOpRet:
+    break;
+  case Instruction::kOpJz:
+  case Instruction::kOpJnz:
+    w->Put32(static_cast<const ConditionalJump*>(ins)->rindex());
+    w->Put32(static_cast<const ConditionalJump*>(ins)->label());
+    break;
+  case Instruction::kOpMov:
+    w->Put32(static_cast<const OpMov*>(ins)->rindex_dst());
+    w->PutSource(static_cast<const OpMov*>(ins)->src());
+    break;
+  case Instruction::kOpPush:
+    w->PutSource(static_cast<const OpPush*>(ins)->src());
+    break;
+  case Instruction::kOpPop:
+    w->Put8(static_cast<const OpPop*>(ins)->store_value());
+    w->Put32(static_cast<const OpPop*>(ins)->rindex());
+    break;
+  case Instruction::kOpLd1:
+  case Instruction::kOpLd2:
+  case Instruction::kOpLd4:
+  case Instruction::kOpLd4Acquire:
+  case Instruction::kOpXadd:
+    w->Put32(static_cast<const OpLoad*>(ins)->rindex());
+    w->PutAddress(static_cast<const OpLoad*>(ins)->address());
+    break;
+  case Instruction::kOpCas:
+    w->Put32(static_cast<const OpCas*>(ins)->rindex());
+    w->Put32(static_cast<const OpCas*>(ins)->desired());
+    w->PutAddress(static_cast<const OpCas*>(ins)->address());
+    break;
+  case Instruction::kOpExit:
+    w->PutSource(static_cast<const OpExit*>(ins)->code());
+    break;
+  case Instruction::kOpInc:
+    w->Put32(static_cast<const OpInc*>(ins)->rindex());
+    break;
+  case Instruction::kOpDec:
+    w->Put32(static_cast<const OpDec*>(ins)->rindex());
+    break;
+  case Instruction::kOpPrint: {
+      const OpPrint* op = static_cast<const OpPrint*>(ins);
+      w->Put32(op->printable_count());
+      for (uint32_t i = 0; i < op->printable_count(); ++i) {
+        w->PutPrintable(op->printables()[i]);
+      }
+    }
+    break;
+  case Instruction::kOpSt1:
+  case Instruction::kOpSt2:
+  case Instruction::kOpSt4:
+  case Instruction::kOpSt4Release:
+    w->PutSource(static_cast<const OpStore*>(ins)->src());
+    w->PutAddress(static_cast<const OpStore*>(ins)->address());
+    break;
+  case Instruction::kOpSysCall: {
+      const OpSysCall* syscall = static_cast<const OpSysCall*>(ins);
+      w->PutSource(syscall->src());
+      if (syscall->src() == NULL) w->PutString(syscall->name());
+      w->Put32(syscall->rindex());
+    }
+    break;
+  case Instruction::kOpPushN:
+    w->Put32(static_cast<const OpPushN*>(ins)->bytes());
+    break;
+  case Instruction::kOpPopN:
+    w->Put32(static_cast<const OpPopN*>(ins)->bytes());
+    break;
+  case Instruction::kOpFprint:
+    w->Put32(static_cast<const OpFprint*>(ins)->rindex());
+    break;
+  case Instruction::kOpSprint:
+    w->PutBase(static_cast<const OpSprint*>(ins)->str());
+    break;
+  case Instruction::kOpEnter:
+    w->Put32(static_cast<const OpEnter*>(ins)->bytes());
+    w->Put32(static_cast<const OpEnter*>(ins)->rindex());
+    break;
+  case Instruction::kOpLeave:
+    break;
+  case Instruction::kOpStepJump:
+  case Instruction::kOpArithJump:
+    // Superinstructions of ApplyProfile have no encoding.
+    w->Fail();
+    break;
+  }
+}
+
+Instruction* GetTernaryInstruction(Instruction::Opcode opcode, Arena& code, ImageReader* r) {
+  Source* param1 = r->GetSource();
+  Source* param2 = r->GetSource();
+  uint32_t output_rindex = r->Get32();
+  switch (opcode) {
+  case Instruction::kOpAdd: return code.New<OpAdd>(param1, param2, output_rindex);
+  case Instruction::kOpSub: return code.New<OpSub>(param1, param2, output_rindex);
+  case Instruction::kOpMul: return code.New<OpMul>(param1, param2, output_rindex);
+  case Instruction::kOpDiv: return code.New<OpDiv>(param1, param2, output_rindex);
+  case Instruction::kOpMod: return code.New<OpMod>(param1, param2, output_rindex);
+  case Instruction::kOpAnd: return code.New<OpAnd>(param1, param2, output_rindex);
+  case Instruction::kOpOr: return code.New<OpOr>(param1, param2, output_rindex);
+  case Instruction::kOpXor: return code.New<OpXor>(param1, param2, output_rindex);
+  case Instruction::kOpShl: return code.New<OpShl>(param1, param2, output_rindex);
+  default: return code.New<OpShr>(param1, param2, output_rindex);
+  }
+}
+
+Instruction* GetInstruction(AsmMachine* vm, ImageReader* r) {
+  Arena& code = vm->code_arena();
+  uint32_t rindex;
+  Source* src;
+  Instruction::Opcode opcode = Instruction::Opcode(r->Get8());
+  switch (opcode) {
+  case Instruction::kOpAdd:
+  case Instruction::kOpSub:
+  case Instruction::kOpMul:
+  case Instruction::kOpDiv:
+  case Instruction::kOpMod:
+  case Instruction::kOpAnd:
+  case Instruction::kOpOr:
+  case Instruction::kOpXor:
+  case Instruction::kOpShl:
+  case Instruction::kOpShr:
+    return GetTernaryInstruction(opcode, code, r);
+  case Instruction::kOpNot:
+    rindex = r->Get32();
+    return code.New<OpNot>(rindex, r->Get32());
+  case Instruction::kOpJmp:
+    return code.New<OpJmp>(r->GetSymbol());
+  case Instruction::kOpCall:
+    return code.New<OpCall>(r->GetSymbol());
+  case Instruction::kOpRet:
+    return code.New<OpRet>();
+  case Instruction::kOpJz:
+    rindex = r->Get32();
+    return code.New<OpJz>(rindex, r->GetSymbol());
+  case Instruction::kOpJnz:
+    rindex = r->Get32();
+    return code.New<OpJnz>(rindex, r->GetSymbol());
+  case Instruction::kOpMov:
+    rindex = r->Get32();
+    return code.New<OpMov>(rindex, r->GetSource());
+  case Instruction::kOpPush:
+    return code.New<OpPush>(r->GetSource());
+  case Instruction::kOpPop:
+    if (r->Get8()) return code.New<OpPop>(r->Get32());
+    r->Get32();
+    return code.New<OpPop>();
+  case Instruction::kOpLd1:
+    rindex = r->Get32();
+    return code.New<OpLd1>(rindex, r->GetAddress());
+  case Instruction::kOpLd2:
+    rindex = r->Get32();
+    return code.New<OpLd2>(rindex, r->GetAddress());
+  case Instruction::kOpLd4:
+    rindex = r->Get32();
+    return code.New<OpLd4>(rindex, r->GetAddress());
+  case Instruction::kOpLd4Acquire:
+    rindex = r->Get32();
+    return code.New<OpLd4Acquire>(rindex, r->GetAddress());
+  case Instruction::kOpXadd:
+    rindex = r->Get32();
+    return code.New<OpXadd>(rindex, r->GetAddress());
+  case Instruction::kOpCas: {
+      rindex = r->Get32();
+      uint32_t desired = r->Get32();
+      return code.New<OpCas>(rindex, desired, r->GetAddress());
+    }
+  case Instruction::kOpExit:
+    return code.New<OpExit>(r->GetSource());
+  case Instruction::kOpInc:
+    return code.New<OpInc>(r->Get32());
+  case Instruction::kOpDec:
+    return code.New<OpDec>(r->Get32());
+  case Instruction::kOpPrint: {
+      std::vector<Printable*> printables;
+      for (uint32_t count = r->Get32(); count > 0 && r->ok(); --count) {
+        printables.push_back(r->GetPrintable());
+      }
+      return code.New<OpPrint>(r->arena(), printables);
+    }
+  case Instruction::kOpSt1:
+    src = r->GetSource();
+    return code.New<OpSt1>(src, r->GetAddress());
+  case Instruction::kOpSt2:
+    src = r->GetSource();
+    return code.New<OpSt2>(src, r->GetAddress());
+  case Instruction::kOpSt4:
+    src = r->GetSource();
+    return code.New<OpSt4>(src, r->GetAddress());
+  case Instruction::kOpSt4Release:
+    src = r->GetSource();
+    return code.New<OpSt4Release>(src, r->GetAddress());
+  case Instruction::kOpSysCall:
+    src = r->GetSource();
+    if (src == NULL) {
+      const char* name = r->GetArenaString();
+      return code.New<OpSysCall>(name, r->Get32());
+    }
+    return code.New<OpSysCall>(src, r->Get32());
+  case Instruction::kOpPushN:
+    return code.New<OpPushN>(r->Get32());
+  case Instruction::kOpPopN:
+    return code.New<OpPopN>(r->Get32());
+  case Instruction::kOpFprint:
+    return code.New<OpFprint>(r->Get32());
+  case Instruction::kOpSprint: {
+      BaseAddress* str = r->GetBase();
+      return str == NULL ? NULL : code.New<OpSprint>(str);
+    }
+  case Instruction::kOpEnter: {
+      uint32_t bytes = r->Get32();
+      return code.New<OpEnter>(bytes, r->Get32());
+    }
+  case Instruction::kOpLeave:
+    return code.New<OpLeave>();
+  case Instruction::kOpStepJump:
+  case Instruction::kOpArithJump:
+    r->Fail();
+    return NULL;
+  }
+  return NULL;
+}
+
+} // namespace
+
+bool SaveImage(const AsmMachine& vm, uint64_t source_hash, std::string* out) {
+  out->clear();
+  ImageWriter w(out);
+  w.Put32(kImageMagic);
+  w.Put32(kImageVersion);
+  w.Put64(source_hash);
+
+  w.Put32(vm.static_data_size());
+  w.PutBytes(vm.data(), vm.static_data_size());
+  // Only the size of .BSS: it is zero on load.
+  w.Put32(vm.reserve_size());
+
+  // Symbols in id order, so that interning them again yields the same ids.
+  const SymbolTable& symbols = vm.symbols();
+  w.Put32(symbols.size());
+  for (SymbolId id = 0; id < symbols.size(); ++id) {
+    w.PutString(symbols[id].name);
+    w.Put8(symbols[id].kind);
+    w.Put32(symbols[id].value);
+  }
+
+  const std::vector<Instruction*>& program = vm.program();
+  w.Put32(program.size());
+  for (size_t i = 0; i < program.size(); ++i) {
+    PutInstruction(program[i], &w);
+  }
+  return w.ok();
+}
+
+bool LoadImage(const std::string& image, uint64_t source_hash, AsmMachine* vm) {
+  ImageReader r(image, vm->arena());
+  if (r.Get32() != kImageMagic || r.Get32() != kImageVersion || r.Get64() != source_hash) {
+    return false;
+  }
+
+  uint32_t data_size = r.Get32();
+  const char* data = r.GetBytes(NULL, data_size);
+  uint32_t reserve_size = r.Get32();
+  if (data == NULL || !r.ok() ||
+      !vm->LoadStaticData(reinterpret_cast<const uint8_t*>(data), data_size, reserve_size)) {
+    return false;
+  }
+
+  SymbolTable& symbols = vm->symbols();
+  uint32_t symbol_count = r.Get32();
+  for (uint32_t id = 0; id < symbol_count && r.ok(); ++id) {
+    std::string name = r.GetString();
+    Symbol::Kind kind = Symbol::Kind(r.Get8());
+    int32_t value = r.Get32();
+    if (symbols.Intern(name, 0) != id) return false;
+    if (kind != Symbol::kSymbolUndefined) symbols.Define(id, kind, value, 0);
+  }
+  r.set_symbol_count(symbols.size());
+
+  for (uint32_t count = r.Get32(); count > 0 && r.ok(); --count) {
+    Instruction* ins = GetInstruction(vm, &r);
+    if (ins == NULL) return false;
+    vm->add_instruction(ins);
+  }
+  return r.ok() && r.at_end() && vm->Link();
+}
+
+bool SaveModule(const AsmMachine& vm, std::string* out) {
+  out->clear();
+  ImageWriter w(out);
+  w.Put32(kModuleMagic);
+  w.Put32(kImageVersion);
+
+  w.Put32(vm.static_data_size());
+  w.PutBytes(vm.data(), vm.static_data_size());
+  w.Put32(vm.data_alignment());
+  w.Put32(vm.reserve_size());
+  w.Put32(vm.reserve_alignment());
+
+  w.Put32(vm.imports().size());
+  for (size_t i = 0; i < vm.imports().size(); ++i) w.PutString(vm.imports()[i]);
+
+  const SymbolTable& symbols = vm.symbols();
+  w.Put32(symbols.size());
+  for (SymbolId id = 0; id < symbols.size(); ++id) {
+    w.PutString(symbols[id].name);
+    w.Put8(symbols[id].kind);
+    w.Put32(symbols[id].value);
+  }
+
+  const std::vector<Instruction*>& program = vm.program();
+  w.Put32(program.size());
+  for (size_t i = 0; i < program.size(); ++i) {
+    PutInstruction(program[i], &w);
+  }
+  return w.ok();
+}
+
+static bool InvalidModule(const std::string& name, AsmMachine* vm) {
+  vm->Diagnostic("Módulo %s: objeto inválido ou de outra versão.\n", name.c_str());
+  return false;
+}
+
+bool AppendModule(const std::string& object, const std::string& name, AsmMachine* vm,
+                  std::vector<std::string>* imports) {
+  ImageReader r(object, vm->arena());
+  if (r.Get32() != kModuleMagic || r.Get32() != kImageVersion) return InvalidModule(name, vm);
+
+  uint32_t data_size = r.Get32();
+  const char* data = r.GetBytes(NULL, data_size);
+  uint32_t data_alignment = r.Get32();
+  uint32_t reserve_size = r.Get32();
+  uint32_t reserve_alignment = r.Get32();
+  if (data == NULL || !r.ok() || data_alignment == 0 || data_alignment > kMaxDataAlignment ||
+      reserve_alignment == 0 || reserve_alignment > kMaxDataAlignment) {
+    return InvalidModule(name, vm);
+  }
+  for (uint32_t count = r.Get32(); count > 0 && r.ok(); --count) {
+    imports->push_back(r.GetString());
+  }
+
+  // Unqualified names are the module's own and get its name as prefix;
+  // qualified ones belong to the modules it imports.
+  SymbolTable& symbols = vm->symbols();
+  std::vector<std::pair<Symbol::Kind, int32_t> > definitions;
+  std::vector<SymbolId> symbol_map;
+  for (uint32_t count = r.Get32(); count > 0 && r.ok(); --count) {
+    std::string symbol = r.GetString();
+    Symbol::Kind kind = Symbol::Kind(r.Get8());
+    int32_t value = r.Get32();
+    if (symbol.find('.') == std::string::npos) symbol = name + "." + symbol;
+    symbol_map.push_back(symbols.Intern(symbol, 0));
+    definitions.push_back(std::make_pair(kind, value));
+  }
+  if (!r.ok()) return InvalidModule(name, vm);
+
+  uint32_t data_base, reserve_base;
+  if (!vm->AppendModuleData(name, reinterpret_cast<const uint8_t*>(data), data_size,
+                            data_alignment, reserve_size, reserve_alignment, &data_base,
+                            &reserve_base)) {
+    return false;
+  }
+  uint32_t code_base = vm->program().size();
+  for (size_t i = 0; i < symbol_map.size(); ++i) {
+    int32_t value = definitions[i].second;
+    switch (definitions[i].first) {
+    case Symbol::kSymbolVar:
+      value = uint32_t(value) < data_size ? value + data_base : value - data_size + reserve_base;
+      break;
+    case Symbol::kSymbolLabel:
+      value += code_base;
+      break;
+    default:
+      continue;
+    }
+    if (symbols[symbol_map[i]].kind != Symbol::kSymbolUndefined) {
+      vm->Diagnostic("Módulo %s: símbolo %s redefinido.\n", name.c_str(),
+                     symbols[symbol_map[i]].name);
+      return false;
+    }
+    symbols.Define(symbol_map[i], definitions[i].first, value, 0);
+  }
+
+  r.set_symbol_map(&symbol_map);
+  for (uint32_t count = r.Get32(); count > 0 && r.ok(); --count) {
+    Instruction* ins = GetInstruction(vm, &r);
+    if (ins == NULL) return InvalidModule(name, vm);
+    vm->add_instruction(ins);
+  }
+  if (!r.ok() || !r.at_end()) return InvalidModule(name, vm);
+  return true;
+}
+
+} // namespace asmvm
@@ -0,0 +1,44 @@
+#ifndef ASMVM_IMAGE_H
+#define ASMVM_IMAGE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "asmvm.h"
+
+namespace asmvm {
+
+// A program image is the parsed form of a program (static data, symbols and
+// instructions) serialized so it can be loaded back without running the
+// parser. Symbol references are kept symbolic and linked again on load.
+// Images are only meant to be read by the same build on the same host:
+// numbers are stored in native byte order.
+const uint32_t kImageMagic = 0x4d565341; // "ASVM"
+const uint32_t kImageVersion = 4;
+
+// Fails if the program has instructions that images cannot hold, the
+// superinstructions of ApplyProfile.
+bool SaveImage(const AsmMachine& vm, uint64_t source_hash, std::string* out);
+
+// Fills an empty vm from image. Fails if the image is truncated, was built by
+// another image version or does not belong to the source with source_hash.
+bool LoadImage(const std::string& image, uint64_t source_hash, AsmMachine* vm);
+
+// Module objects (see module.h) are images of a module that was parsed but
+// not linked. They also record its imports and the alignment its data needs.
+const uint32_t kModuleMagic = 0x4f4d5341; // "ASMO"
+
+// Fails as SaveImage does.
+bool SaveModule(const AsmMachine& vm, std::string* out);
+
+// Appends the module in object to vm as module name: its data and .BSS
+// after vm's (see AsmMachine::AppendModuleData), its instructions after
+// vm's, and its symbols qualified with name and relocated. Adds the modules
+// it imports to imports. vm still has to be linked.
+bool AppendModule(const std::string& object, const std::string& name, AsmMachine* vm,
+                  std::vector<std::string>* imports);
+
+} // namespace asmvm
+
+#endif
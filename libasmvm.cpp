@@ -0,0 +1,109 @@
+#include "libasmvm.h"
+
+#include <string.h>
+
+#include "parser_aid.h"
+#include "source_buffer.h"
+
+namespace asmvm {
+
+Vm::Vm()
+  : vm_(NULL), output_(FileSink::Stdout()), diagnostics_(FileSink::Stderr()),
+    host_functions_(&HostRegistry::Default()) {}
+
+Vm::~Vm() {
+  delete vm_;
+}
+
+bool Vm::LoadString(const std::string& source) {
+  return LoadBuffer(source.data(), source.size());
+}
+
+bool Vm::LoadBuffer(const char* data, size_t size) {
+  SourceBuffer source;
+  source.Assign(data, size);
+  return Load(source);
+}
+
+bool Vm::LoadFile(const std::string& path) {
+  SourceBuffer source;
+  if (!source.Open(path)) {
+    std::string message = "Erro ao tentar abrir o arquivo " + path + "!\n";
+    diagnostics_->Write(message.data(), message.size());
+    return false;
+  }
+  return Load(source);
+}
+
+bool Vm::Load(SourceBuffer& source) {
+  AsmMachine* vm = new AsmMachine();
+  vm->set_output(output_);
+  vm->set_diagnostics(diagnostics_);
+  vm->set_host_functions(host_functions_);
+  if (!parser::Parse(source, vm)) {
+    delete vm;
+    return false;
+  }
+  delete vm_;
+  vm_ = vm;
+  return true;
+}
+
+void Vm::set_output(OutputSink* sink) {
+  output_ = sink != NULL ? sink : FileSink::Stdout();
+  if (vm_ != NULL) vm_->set_output(output_);
+}
+
+void Vm::set_diagnostics(OutputSink* sink) {
+  diagnostics_ = sink != NULL ? sink : FileSink::Stderr();
+  if (vm_ != NULL) vm_->set_diagnostics(diagnostics_);
+}
+
+bool Vm::Write(uint32_t address, const void* data, size_t size) {
+  if (address > vm_->memory_size() || size > vm_->region_end(address) - address) return false;
+  memcpy(vm_->data() + address, data, size);
+  return true;
+}
+
+bool Vm::Read(uint32_t address, void* data, size_t size) const {
+  if (address > vm_->memory_size() || size > vm_->region_end(address) - address) return false;
+  memcpy(data, vm_->data() + address, size);
+  return true;
+}
+
+int32_t Vm::Address(const std::string& variable) const {
+  SymbolId id = vm_->symbols().Find(variable);
+  if (id == kNoSymbol || vm_->symbols()[id].kind != Symbol::kSymbolVar) return -1;
+  return vm_->symbols()[id].value;
+}
+
+int32_t Vm::Label(const std::string& label) const {
+  SymbolId id = vm_->symbols().Find(label);
+  if (id == kNoSymbol || vm_->symbols()[id].kind != Symbol::kSymbolLabel) return -1;
+  return vm_->symbols()[id].value;
+}
+
+bool Vm::Run(int32_t* exit_code, int64_t fuel) {
+  vm_->Reset();
+  if (vm_->Continue(fuel) != AsmMachine::kRunExited) return false;
+  *exit_code = vm_->exit_code();
+  return true;
+}
+
+bool Vm::Call(const std::string& label, const int32_t* args, size_t argc, int32_t* result,
+              int64_t fuel) {
+  return Call(Label(label), args, argc, result, fuel);
+}
+
+bool Vm::Call(int32_t entry, const int32_t* args, size_t argc, int32_t* result, int64_t fuel) {
+  if (entry < 0 || size_t(entry) >= vm_->program().size() || argc > 8) return false;
+  vm_->PrepareCall(entry);
+  for (size_t i = 0; i < argc; ++i) {
+    vm_->set_register(i, args[i]);
+  }
+  if (vm_->Continue(fuel) != AsmMachine::kRunReturned) return false;
+  *result = vm_->exit_code();
+  return true;
+}
+
+} // namespace asmvm
@@ -0,0 +1,88 @@
+#ifndef ASMVM_LIBASMVM_H
+#define ASMVM_LIBASMVM_H
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asmvm.h"
+#include "host_functions.h"
+#include "output_sink.h"
+
+namespace asmvm {
+
+class SourceBuffer;
+
+// Embedding API of libasmvm. A Vm holds one compiled program and its machine
+// state, which persists from one run or call to the next (registers are
+// reset, data memory is not). A Vm is not thread safe, but separate Vms can
+// run concurrently; loading is serialized internally.
+//
+//   asmvm::Vm vm;
+//   asmvm::StringSink out;
+//   vm.set_output(&out);
+//   if (!vm.LoadString("...")) ...
+//   int32_t args[] = {20, 22}, sum;
+//   vm.Call("add", args, 2, &sum);
+class Vm {
+ public:
+  Vm();
+  ~Vm();
+
+  // Compile a program, replacing the current one. Diagnostics go to the
+  // diagnostics sink.
+  bool LoadString(const std::string& source);
+  bool LoadBuffer(const char* data, size_t size);
+  bool LoadFile(const std::string& path);
+  bool loaded() const { return vm_ != NULL; }
+
+  // Sinks are not owned. NULL restores stdout/stderr.
+  void set_output(OutputSink* sink);
+  void set_diagnostics(OutputSink* sink);
+  // Host functions SYSCALL binds to in the programs loaded afterwards.
+  void set_host_functions(const HostRegistry* registry) { host_functions_ = registry; }
+
+  // The accessors below require a loaded program.
+  // Registers are numbered as in the machine: 0..7 are R1..R8, then
+  // kRegisterIndexSt and kRegisterIndexPc.
+  int32_t reg(uint32_t rindex) const { return vm_->get_register(rindex); }
+  void set_reg(uint32_t rindex, int32_t value) { vm_->set_register(rindex, value); }
+
+  // Copy to or from VM memory. False if the range does not fit in it.
+  bool Write(uint32_t address, const void* data, size_t size);
+  bool Read(uint32_t address, void* data, size_t size) const;
+  // Address of a .DATA variable or instruction index of a label, -1 if the
+  // program has no such symbol.
+  int32_t Address(const std::string& variable) const;
+  int32_t Label(const std::string& label) const;
+
+  // Runs the program from its first instruction. Returns false if it did not
+  // EXIT within fuel instructions, leaving it suspended.
+  bool Run(int32_t* exit_code, int64_t fuel = kUnlimitedFuel);
+  // Calls the function at label with args in R1..Rn (argc <= 8). Returns true
+  // and stores R1 in result when it returns; false if there is no such label,
+  // or the program EXITs or runs out of fuel instead.
+  bool Call(const std::string& label, const int32_t* args, size_t argc, int32_t* result,
+            int64_t fuel = kUnlimitedFuel);
+  // Same with the label already resolved, for repeated calls.
+  bool Call(int32_t entry, const int32_t* args, size_t argc, int32_t* result,
+            int64_t fuel = kUnlimitedFuel);
+
+  // The underlying machine, NULL until a program is loaded.
+  AsmMachine* machine() { return vm_; }
+
+ private:
+  Vm(const Vm&);
+  Vm& operator = (const Vm&);
+
+  bool Load(SourceBuffer& source);
+
+  AsmMachine* vm_;
+  OutputSink* output_;
+  OutputSink* diagnostics_;
+  const HostRegistry* host_functions_;
+};
+
+} // namespace asmvm
+
+#endif
@@ -1,25 +1,498 @@
+#include <algorithm>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "aot.h"
+#include "channel.h"
+#include "heap.h"
+#include "metrics.h"
+#include "module.h"
 #include "parser_aid.h"
 #include "op.h"
 #include "parser.hpp"
+#include "profile.h"
+#include "program_cache.h"
+#include "scheduler.h"
+#include "syscall_log.h"
+#include "server.h"
 
-int main(int argc, char **argv) {
-	extern FILE *yyin;
-	if(argc != 2) {
-		printf("Uso: %s arquivo_de_entrada\n", argv[0]);
+static int usage(const char* program) {
+	printf("Uso: %s [--no-cache] [--parse-stats] [--guard-pages] [--heap-debug] [--heap-stats]\n"
+	       "        [--metrics arquivo [--metrics-format json|prometheus]]\n"
+	       "        [--record registro | --replay registro]\n"
+	       "        [--profile-out perfil | --profile perfil] arquivo_de_entrada\n"
+	       "     %s --cache-stats\n"
+	       "     %s --server socket arquivo_de_entrada\n"
+	       "     %s serve socket [--cache N] [--workers N]\n"
+	       "     %s sched [--threads N] [--slice N] [--fuel N] inquilino[:peso]=arquivo...\n"
+	       "     %s pipe [--threads N] [--capacity N] [--message-size N] [--mpmc] estágio...\n"
+	       "     %s aot arquivo_de_entrada [-o arquivo.cpp]\n"
+	       "     %s module arquivo.asmvm [-o arquivo.asmo]\n",
+	       program, program, program, program, program, program, program, program);
+	return 1;
+}
+
+static int serve(int argc, char **argv) {
+	size_t cache_capacity = asmvm::server::kDefaultCacheCapacity;
+	size_t max_workers = asmvm::server::kDefaultMaxWorkers;
+	for (int i = 3; i < argc; i += 2) {
+		if (i + 1 >= argc) return usage(argv[0]);
+		if (!strcmp(argv[i], "--cache")) {
+			cache_capacity = strtoul(argv[i + 1], NULL, 10);
+		} else if (!strcmp(argv[i], "--workers")) {
+			max_workers = strtoul(argv[i + 1], NULL, 10);
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	asmvm::server::Server server(argv[2], cache_capacity, max_workers);
+	return server.Serve();
+}
+
+static int cache_stats() {
+	asmvm::DiskCache cache(asmvm::DiskCache::DefaultDirectory(), asmvm::kDefaultDiskCacheBytes);
+	uint64_t hits = 0, misses = 0;
+	if (!cache.ReadCounters(&hits, &misses)) {
+		fprintf(stderr, "Cache indisponível.\n");
 		return 1;
 	}
+	printf("hits=%llu misses=%llu\n", (unsigned long long)hits, (unsigned long long)misses);
+	return 0;
+}
+
+static double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the program stored in path, from the disk cache if possible, or
+// NULL after reporting why it could not be loaded.
+static asmvm::AsmMachine* load(const char* path, bool use_cache, bool parse_stats,
+                               uint64_t* source_hash = NULL) {
+	asmvm::SourceBuffer source;
+	if (!source.Open(path)) {
+		fprintf(stderr, "Erro ao tentar abrir o arquivo %s!\n", path);
+		return NULL;
+	}
 	
-	if ((yyin = fopen(argv[1], "r")) == NULL) {
-		fprintf(stderr, "Erro ao tentar abrir o arquivo %s!\n", argv[1]);
+	uint64_t hash = asmvm::HashSource(source);
+	if (source_hash != NULL) *source_hash = hash;
+	asmvm::DiskCache cache(use_cache ? asmvm::DiskCache::DefaultDirectory() : std::string(),
+	                       asmvm::kDefaultDiskCacheBytes);
+	asmvm::AsmMachine* vm = new asmvm::AsmMachine();
+	bool hit = cache.Load(hash, vm);
+	if (!hit) {
+		delete vm;
+		vm = new asmvm::AsmMachine();
+		size_t lines = parse_stats ? std::count(source.data(), source.data() + source.size(), '\n') : 0;
+		double start = now_seconds();
+		if (!asmvm::parser::Parse(source, vm)) {
+			fprintf(stderr, "Não foi possível compilar %s!\n", path);
+			delete vm;
+			return NULL;
+		}
+		if (parse_stats) {
+			double elapsed = now_seconds() - start;
+			fprintf(stderr, "%zu linhas em %.3f s (%.0f linhas/s)\n", lines, elapsed, lines / elapsed);
+		}
+		cache.Store(hash, *vm);
+	}
+	if (use_cache) cache.Count(hit);
+	return vm;
+}
+
+// Runs several programs, each one on behalf of a tenant, time-sliced by an
+// asmvm::Scheduler, and prints the instructions accounted to each tenant.
+// Programs still running after --fuel instructions are stopped (status 2).
+static int sched(int argc, char **argv) {
+	size_t threads = std::thread::hardware_concurrency();
+	int64_t slice = asmvm::kDefaultSliceFuel;
+	int64_t fuel = 0;
+	int i = 2;
+	for (; i + 1 < argc && !strncmp(argv[i], "--", 2); i += 2) {
+		if (!strcmp(argv[i], "--threads")) {
+			threads = strtoul(argv[i + 1], NULL, 10);
+		} else if (!strcmp(argv[i], "--slice")) {
+			slice = strtoll(argv[i + 1], NULL, 10);
+		} else if (!strcmp(argv[i], "--fuel")) {
+			fuel = strtoll(argv[i + 1], NULL, 10);
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	if (i == argc) return usage(argv[0]);
+
+	asmvm::Scheduler scheduler(threads, slice, fuel);
+	std::map<std::string, uint32_t> tenant_ids;
+	std::vector<asmvm::AsmMachine*> machines;
+	int status = 0;
+	for (; i < argc; ++i) {
+		const char* eq = strchr(argv[i], '=');
+		if (eq == NULL) return usage(argv[0]);
+		std::string tenant(argv[i], eq - argv[i]);
+		uint32_t weight = 1;
+		size_t colon = tenant.find(':');
+		if (colon != std::string::npos) {
+			weight = strtoul(tenant.c_str() + colon + 1, NULL, 10);
+			tenant.erase(colon);
+		}
+		std::map<std::string, uint32_t>::iterator id = tenant_ids.find(tenant);
+		if (id == tenant_ids.end()) {
+			id = tenant_ids.insert(std::make_pair(tenant, scheduler.AddTenant(tenant, weight))).first;
+		}
+		asmvm::AsmMachine* vm = load(eq + 1, true, false);
+		if (vm == NULL) {
+			status = 1;
+			continue;
+		}
+		machines.push_back(vm);
+		scheduler.Submit(id->second, vm, eq + 1);
+	}
+
+	scheduler.Run();
+
+	for (size_t j = 0; j < scheduler.jobs().size(); ++j) {
+		const asmvm::Scheduler::Job& job = scheduler.jobs()[j];
+		const char* tenant = scheduler.tenants()[job.tenant].name.c_str();
+		if (job.suspended) {
+			fprintf(stderr, "%s: %s suspenso após %llu instruções.\n", tenant, job.name.c_str(),
+			        (unsigned long long)job.vm->instructions());
+			status = 2;
+		} else {
+			fprintf(stderr, "%s: %s terminou com código %d.\n", tenant, job.name.c_str(), job.exit_code);
+		}
+	}
+	fprintf(stderr, "%-16s %6s %14s %10s\n", "inquilino", "peso", "instruções", "fatias");
+	for (size_t t = 0; t < scheduler.tenants().size(); ++t) {
+		const asmvm::Scheduler::Tenant& tenant = scheduler.tenants()[t];
+		fprintf(stderr, "%-16s %6u %14llu %10llu\n", tenant.name.c_str(), tenant.weight,
+		        (unsigned long long)tenant.instructions, (unsigned long long)tenant.slices);
+	}
+	for (size_t j = 0; j < machines.size(); ++j) {
+		delete machines[j];
+	}
+	return status;
+}
+
+// Runs programs as the stages of a pipeline, each one connected to the next
+// by a channel: a stage receives from channel handle 1 and sends to handle 2.
+// The stages are jobs of an asmvm::Scheduler, on a thread each by default,
+// so a stage waiting on a channel lets the others run. Channels are SPSC
+// unless --mpmc, needed by stages that use a channel from several threads.
+// Returns the exit code of the last stage.
+static int pipeline(int argc, char **argv) {
+	size_t threads = 0;
+	uint32_t capacity = asmvm::kDefaultChannelCapacity;
+	uint32_t message_size = asmvm::kDefaultMessageSize;
+	asmvm::Channel::Kind kind = asmvm::Channel::kSpsc;
+	int i = 2;
+	for (; i < argc && !strncmp(argv[i], "--", 2); i += 2) {
+		if (!strcmp(argv[i], "--mpmc")) {
+			kind = asmvm::Channel::kMpmc;
+			--i;
+		} else if (i + 1 == argc) {
+			return usage(argv[0]);
+		} else if (!strcmp(argv[i], "--threads")) {
+			threads = strtoul(argv[i + 1], NULL, 10);
+		} else if (!strcmp(argv[i], "--capacity")) {
+			capacity = strtoul(argv[i + 1], NULL, 10);
+		} else if (!strcmp(argv[i], "--message-size")) {
+			message_size = strtoul(argv[i + 1], NULL, 10);
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	if (i == argc) return usage(argv[0]);
+
+	std::vector<asmvm::AsmMachine*> machines;
+	int status = 0;
+	for (int j = i; j < argc; ++j) {
+		asmvm::AsmMachine* vm = load(argv[j], true, false);
+		if (vm == NULL) {
+			status = 1;
+			continue;
+		}
+		machines.push_back(vm);
+	}
+	if (status != 0) {
+		for (size_t s = 0; s < machines.size(); ++s) delete machines[s];
+		return status;
+	}
+
+	size_t stages = machines.size();
+	std::vector<asmvm::Channel*> channels;
+	for (size_t s = 0; s + 1 < stages; ++s) {
+		channels.push_back(new asmvm::Channel(kind, capacity, message_size));
+	}
+	asmvm::Scheduler scheduler(threads == 0 ? stages : threads, asmvm::kDefaultSliceFuel, 0);
+	uint32_t tenant = scheduler.AddTenant("pipe", 1);
+	for (size_t s = 0; s < stages; ++s) {
+		machines[s]->channels().Attach(s > 0 ? channels[s - 1] : NULL, false, false);
+		machines[s]->channels().Attach(s + 1 < stages ? channels[s] : NULL, true, false);
+		scheduler.Submit(tenant, machines[s], argv[i + s]);
+	}
+
+	scheduler.Run();
+
+	for (size_t s = 0; s < stages; ++s) {
+		const asmvm::Scheduler::Job& job = scheduler.jobs()[s];
+		if (job.exit_code != 0) {
+			fprintf(stderr, "%s terminou com código %d.\n", job.name.c_str(), job.exit_code);
+		}
+		status = job.exit_code;
+	}
+	for (size_t s = 0; s < stages; ++s) delete machines[s];
+	for (size_t s = 0; s < channels.size(); ++s) delete channels[s];
+	return status;
+}
+
+// Translates a program to C++ (see aot.h), to stdout without -o.
+static int aot(int argc, char **argv) {
+	const char* input = NULL;
+	const char* output = NULL;
+	for (int i = 2; i < argc; ++i) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			output = argv[++i];
+		} else if (input == NULL) {
+			input = argv[i];
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	if (input == NULL) return usage(argv[0]);
+
+	asmvm::AsmMachine* vm = load(input, true, false);
+	if (vm == NULL) return 1;
+	std::string cpp;
+	bool translated = asmvm::TranslateToCpp(*vm, input, &cpp);
+	delete vm;
+	if (!translated) {
+		fprintf(stderr, "Não foi possível traduzir %s!\n", input);
 		return 1;
 	}
+	FILE* out = output == NULL ? stdout : fopen(output, "w");
+	if (out == NULL) {
+		fprintf(stderr, "Erro ao tentar criar o arquivo %s!\n", output);
+		return 1;
+	}
+	bool written = fwrite(cpp.data(), 1, cpp.size(), out) == cpp.size();
+	if (out != stdout) written = fclose(out) == 0 && written;
+	if (!written) {
+		fprintf(stderr, "Erro ao escrever %s!\n", output == NULL ? "a saída" : output);
+		return 1;
+	}
+	return 0;
+}
+
+// Compiles a module (see module.h), to the .asmo next to it without -o.
+static int module(int argc, char **argv) {
+	const char* input = NULL;
+	std::string output;
+	for (int i = 2; i < argc; ++i) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			output = argv[++i];
+		} else if (input == NULL) {
+			input = argv[i];
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	if (input == NULL) return usage(argv[0]);
+	if (output.empty()) {
+		output = input;
+		size_t extension = output.rfind(asmvm::kModuleSourceExtension);
+		if (extension != std::string::npos &&
+		    extension + strlen(asmvm::kModuleSourceExtension) == output.size()) {
+			output.erase(extension);
+		}
+		output += asmvm::kModuleObjectExtension;
+	}
+
+	asmvm::AsmMachine reporter;
+	std::string object;
+	if (!asmvm::CompileModule(input, &reporter, &object)) return 1;
+	FILE* out = fopen(output.c_str(), "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Erro ao tentar criar o arquivo %s!\n", output.c_str());
+		return 1;
+	}
+	bool written = fwrite(object.data(), 1, object.size(), out) == object.size();
+	if (fclose(out) != 0 || !written) {
+		fprintf(stderr, "Erro ao escrever %s!\n", output.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	bool use_cache = true;
+	bool parse_stats = false;
+	bool guard_pages = false;
+	bool heap_debug = false;
+	bool heap_stats = false;
+	const char* metrics_path = NULL;
+	asmvm::MetricsFormat metrics_format = asmvm::kMetricsJson;
+	const char* record_path = NULL;
+	const char* replay_path = NULL;
+	const char* profile_out_path = NULL;
+	const char* profile_path = NULL;
+	if (argc >= 3 && !strcmp(argv[1], "serve")) {
+		return serve(argc, argv);
+	}
+	if (argc >= 3 && !strcmp(argv[1], "sched")) {
+		return sched(argc, argv);
+	}
+	if (argc >= 3 && !strcmp(argv[1], "pipe")) {
+		return pipeline(argc, argv);
+	}
+	if (argc >= 3 && !strcmp(argv[1], "aot")) {
+		return aot(argc, argv);
+	}
+	if (argc >= 3 && !strcmp(argv[1], "module")) {
+		return module(argc, argv);
+	}
+	if (argc == 4 && !strcmp(argv[1], "--server")) {
+		return asmvm::server::RunRemote(argv[2], argv[3]);
+	}
+	if (argc == 2 && !strcmp(argv[1], "--cache-stats")) {
+		return cache_stats();
+	}
+	while (argc > 2 && !strncmp(argv[1], "--", 2)) {
+		if (!strcmp(argv[1], "--no-cache")) {
+			use_cache = false;
+		} else if (!strcmp(argv[1], "--parse-stats")) {
+			parse_stats = true;
+		} else if (!strcmp(argv[1], "--guard-pages")) {
+			// Out of range accesses fault and stop the program instead of
+			// being checked.
+			guard_pages = true;
+		} else if (!strcmp(argv[1], "--heap-debug")) {
+			// Double frees are reported and freed blocks filled with 0xDD.
+			heap_debug = true;
+		} else if (!strcmp(argv[1], "--heap-stats")) {
+			heap_stats = true;
+		} else if (!strcmp(argv[1], "--metrics") && argc > 3) {
+			// Written at exit and on SIGUSR1 (see metrics.h).
+			metrics_path = argv[2];
+			--argc;
+			++argv;
+		} else if (!strcmp(argv[1], "--record") && argc > 3 && replay_path == NULL) {
+			// Files, input and timing the program gets, for --replay (see
+			// syscall_log.h).
+			record_path = argv[2];
+			--argc;
+			++argv;
+		} else if (!strcmp(argv[1], "--replay") && argc > 3 && record_path == NULL) {
+			replay_path = argv[2];
+			--argc;
+			++argv;
+		} else if (!strcmp(argv[1], "--profile-out") && argc > 3 && profile_path == NULL) {
+			// Instruction and branch counts of the run, for --profile (see
+			// profile.h).
+			profile_out_path = argv[2];
+			--argc;
+			++argv;
+		} else if (!strcmp(argv[1], "--profile") && argc > 3 && profile_out_path == NULL) {
+			profile_path = argv[2];
+			--argc;
+			++argv;
+		} else if (!strcmp(argv[1], "--metrics-format") && argc > 3) {
+			if (!strcmp(argv[2], "json")) {
+				metrics_format = asmvm::kMetricsJson;
+			} else if (!strcmp(argv[2], "prometheus")) {
+				metrics_format = asmvm::kMetricsPrometheus;
+			} else {
+				return usage(argv[0]);
+			}
+			--argc;
+			++argv;
+		} else {
+			return usage(argv[0]);
+		}
+		--argc;
+		++argv;
+	}
+	if(argc != 2) {
+		return usage(argv[0]);
+	}
 	
-	if (yyparse()) {
-		fprintf(stderr, "Não foi possível compilar %s!\n", argv[1]);
+	uint64_t hash = 0;
+	asmvm::AsmMachine* vm = load(argv[1], use_cache, parse_stats, &hash);
+	if (vm == NULL) return 1;
+	if (guard_pages && !vm->EnableGuardPages()) {
+		fprintf(stderr, "Não foi possível proteger a memória de %s!\n", argv[1]);
+		delete vm;
 		return 1;
 	}
+	if (profile_path != NULL) {
+		// The optimized program is only run, never cached.
+		asmvm::Profile profile;
+		if (!profile.Load(profile_path, hash, vm->program().size())) {
+			fprintf(stderr, "O perfil %s é inválido ou de outra versão de %s; ignorado.\n",
+			        profile_path, argv[1]);
+		} else if (!asmvm::ApplyProfile(vm, profile)) {
+			fprintf(stderr, "Não foi possível aplicar o perfil %s.\n", profile_path);
+		}
+	}
+	if (heap_debug) vm->heap().set_debug(true);
+	asmvm::SysCallLog syscall_log;
+	if (record_path != NULL) {
+		if (!syscall_log.OpenRecord(record_path)) {
+			fprintf(stderr, "Erro ao tentar criar o arquivo %s!\n", record_path);
+			delete vm;
+			return 1;
+		}
+		vm->set_syscall_log(&syscall_log);
+	} else if (replay_path != NULL) {
+		if (!syscall_log.OpenReplay(replay_path)) {
+			fprintf(stderr, "O arquivo %s não é um registro válido!\n", replay_path);
+			delete vm;
+			return 1;
+		}
+		vm->set_syscall_log(&syscall_log);
+	}
+	// Before the program can start threads, which must not take SIGUSR1.
+	asmvm::MetricsExporter* exporter = NULL;
+	if (metrics_path != NULL) {
+		exporter = new asmvm::MetricsExporter(&vm->EnableMetrics(), metrics_path, metrics_format);
+	}
   
-  return asmvm::parser::StaticHolder::instance().vm().Run();;
-}
\ No newline at end of file
+	int32_t exit_code;
+	if (profile_out_path != NULL) {
+		// Of the main thread only.
+		asmvm::Profile profile(hash, vm->program().size());
+		asmvm::ProfileHooks hooks(&profile);
+		vm->Reset();
+		vm->Continue(asmvm::kUnlimitedFuel, hooks);
+		exit_code = vm->exit_code();
+		if (!profile.Save(profile_out_path)) {
+			fprintf(stderr, "Erro ao escrever o perfil em %s!\n", profile_out_path);
+		}
+	} else {
+		exit_code = vm->Run();
+	}
+	if (!syscall_log.Close()) {
+		fprintf(stderr, "Erro ao escrever %s!\n", record_path);
+	}
+	if (exporter != NULL) {
+		if (!exporter->Export()) {
+			fprintf(stderr, "Erro ao escrever as métricas em %s!\n", metrics_path);
+		}
+		delete exporter;
+	}
+	if (heap_stats) {
+		asmvm::Heap::Stats stats = vm->heap().stats();
+		fprintf(stderr, "Heap: %u bytes em uso em %u blocos, %u bytes no heap, %u livres "
+		        "(maior trecho %u, fragmentação %u%%).\n", stats.in_use, stats.blocks,
+		        stats.heap_size, stats.free_bytes, stats.largest_free, stats.fragmentation);
+	}
+	delete vm;
+	return exit_code;
+}
@@ -0,0 +1,252 @@
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "host_functions.h"
+
+namespace asmvm {
+
+namespace {
+
+void Append(std::string* out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+void Append(std::string* out, const char* format, ...) {
+  char buffer[512];
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (size > 0) out->append(buffer, std::min(size_t(size), sizeof(buffer) - 1));
+}
+
+// Escapes name for a JSON string or a Prometheus label value, where the
+// same two characters need it.
+std::string Quoted(const std::string& name) {
+  std::string quoted;
+  for (size_t i = 0; i < name.size(); ++i) {
+    if (name[i] == '"' || name[i] == '\\') quoted += '\\';
+    quoted += name[i];
+  }
+  return quoted;
+}
+
+const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+const char* const kQuantileNames[] = {"p50", "p90", "p99", "p999"};
+const uint32_t kQuantileCount = sizeof(kQuantiles) / sizeof(kQuantiles[0]);
+
+} // namespace
+
+Metrics::Metrics(const HostRegistry& registry)
+  : syscalls_(registry.size()), open_files_high_water_(0), stack_high_water_(0) {
+  for (size_t i = 0; i < syscalls_.size(); ++i) {
+    SysCallStats* stats = new SysCallStats();
+    stats->function = &registry.function(i);
+    stats->total.store(0, std::memory_order_relaxed);
+    stats->max.store(0, std::memory_order_relaxed);
+    for (uint32_t b = 0; b < kLatencyBuckets; ++b) {
+      stats->buckets[b].store(0, std::memory_order_relaxed);
+    }
+    syscalls_[i] = stats;
+  }
+}
+
+Metrics::~Metrics() {
+  for (size_t i = 0; i < syscalls_.size(); ++i) delete syscalls_[i];
+}
+
+uint32_t Metrics::Bucket(uint64_t nanoseconds) {
+  if (nanoseconds < kLatencySubBuckets) return uint32_t(nanoseconds);
+  uint32_t exponent = 63 - __builtin_clzll(nanoseconds);
+  if (exponent >= kMaxLatencyExponent) return kLatencyBuckets - 1;
+  uint32_t shift = exponent - kLatencySubBucketBits;
+  return (shift + 1) * kLatencySubBuckets +
+         uint32_t((nanoseconds >> shift) & (kLatencySubBuckets - 1));
+}
+
+uint64_t Metrics::BucketFloor(uint32_t bucket) {
+  if (bucket < kLatencySubBuckets) return bucket;
+  uint32_t shift = bucket / kLatencySubBuckets - 1;
+  return uint64_t(kLatencySubBuckets + bucket % kLatencySubBuckets) << shift;
+}
+
+void Metrics::RecordSysCall(const HostFunction& function, uint64_t nanoseconds) {
+  if (function.index >= syscalls_.size()) return;
+  SysCallStats* stats = syscalls_[function.index];
+  stats->buckets[Bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+  stats->total.fetch_add(nanoseconds, std::memory_order_relaxed);
+  RaiseTo(&stats->max, nanoseconds);
+}
+
+void Metrics::RecordRead(int32_t handle, uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  files_[handle].read += bytes;
+}
+
+void Metrics::RecordWrite(int32_t handle, uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  files_[handle].written += bytes;
+}
+
+uint64_t Metrics::Quantile(const std::vector<uint64_t>& counts, uint64_t calls,
+                           double quantile) {
+  uint64_t rank = uint64_t(quantile * calls);
+  if (rank < quantile * calls) ++rank;
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (uint32_t b = 0; b < kLatencyBuckets; ++b) {
+    seen += counts[b];
+    if (seen >= rank) return BucketFloor(b + 1) - 1;
+  }
+  return BucketFloor(kLatencyBuckets) - 1;
+}
+
+void Metrics::Format(MetricsFormat format, std::string* out) {
+  out->clear();
+  if (format == kMetricsJson) {
+    FormatJson(out);
+  } else {
+    FormatPrometheus(out);
+  }
+}
+
+void Metrics::FormatJson(std::string* out) {
+  out->append("{\n  \"syscalls\": [");
+  const char* separator = "\n";
+  std::vector<uint64_t> counts(kLatencyBuckets);
+  for (size_t i = 0; i < syscalls_.size(); ++i) {
+    const SysCallStats& stats = *syscalls_[i];
+    uint64_t calls = 0;
+    for (uint32_t b = 0; b < kLatencyBuckets; ++b) {
+      counts[b] = stats.buckets[b].load(std::memory_order_relaxed);
+      calls += counts[b];
+    }
+    if (calls == 0) continue;
+    uint64_t max = stats.max.load(std::memory_order_relaxed);
+    Append(out, "%s    {\"name\": \"%s\", \"calls\": %" PRIu64 ", \"total_ns\": %" PRIu64
+           ", \"max_ns\": %" PRIu64, separator, Quoted(stats.function->name).c_str(), calls,
+           stats.total.load(std::memory_order_relaxed), max);
+    for (uint32_t q = 0; q < kQuantileCount; ++q) {
+      Append(out, ", \"%s_ns\": %" PRIu64, kQuantileNames[q],
+             std::min(Quantile(counts, calls, kQuantiles[q]), max));
+    }
+    out->append("}");
+    separator = ",\n";
+  }
+  out->append("\n  ],\n  \"files\": [");
+  separator = "\n";
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    for (std::map<int32_t, FileStats>::const_iterator it = files_.begin(); it != files_.end();
+         ++it) {
+      Append(out, "%s    {\"handle\": %d, \"read_bytes\": %" PRIu64 ", \"written_bytes\": %"
+             PRIu64 "}", separator, it->first, it->second.read, it->second.written);
+      separator = ",\n";
+    }
+  }
+  Append(out, "\n  ],\n  \"open_files_high_water\": %u,\n  \"stack_high_water_bytes\": %u\n}\n",
+         open_files_high_water_.load(std::memory_order_relaxed),
+         stack_high_water_.load(std::memory_order_relaxed));
+}
+
+void Metrics::FormatPrometheus(std::string* out) {
+  out->append("# HELP asmvm_syscall_latency_seconds Latency of SYSCALL by host function.\n"
+              "# TYPE asmvm_syscall_latency_seconds summary\n");
+  std::vector<uint64_t> counts(kLatencyBuckets);
+  for (size_t i = 0; i < syscalls_.size(); ++i) {
+    const SysCallStats& stats = *syscalls_[i];
+    uint64_t calls = 0;
+    for (uint32_t b = 0; b < kLatencyBuckets; ++b) {
+      counts[b] = stats.buckets[b].load(std::memory_order_relaxed);
+      calls += counts[b];
+    }
+    if (calls == 0) continue;
+    std::string quoted = Quoted(stats.function->name);
+    const char* name = quoted.c_str();
+    uint64_t max = stats.max.load(std::memory_order_relaxed);
+    for (uint32_t q = 0; q < kQuantileCount; ++q) {
+      Append(out, "asmvm_syscall_latency_seconds{syscall=\"%s\",quantile=\"%g\"} %.9f\n", name,
+             kQuantiles[q], std::min(Quantile(counts, calls, kQuantiles[q]), max) * 1e-9);
+    }
+    Append(out, "asmvm_syscall_latency_seconds_sum{syscall=\"%s\"} %.9f\n", name,
+           stats.total.load(std::memory_order_relaxed) * 1e-9);
+    Append(out, "asmvm_syscall_latency_seconds_count{syscall=\"%s\"} %" PRIu64 "\n", name, calls);
+  }
+  std::string read, written;
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    for (std::map<int32_t, FileStats>::const_iterator it = files_.begin(); it != files_.end();
+         ++it) {
+      Append(&read, "asmvm_file_read_bytes_total{handle=\"%d\"} %" PRIu64 "\n", it->first,
+             it->second.read);
+      Append(&written, "asmvm_file_written_bytes_total{handle=\"%d\"} %" PRIu64 "\n", it->first,
+             it->second.written);
+    }
+  }
+  out->append("# HELP asmvm_file_read_bytes_total Bytes read by file handle.\n"
+              "# TYPE asmvm_file_read_bytes_total counter\n");
+  out->append(read);
+  out->append("# HELP asmvm_file_written_bytes_total Bytes written by file handle.\n"
+              "# TYPE asmvm_file_written_bytes_total counter\n");
+  out->append(written);
+  Append(out, "# HELP asmvm_open_files_high_water Most files open at once.\n"
+         "# TYPE asmvm_open_files_high_water gauge\n"
+         "asmvm_open_files_high_water %u\n",
+         open_files_high_water_.load(std::memory_order_relaxed));
+  Append(out, "# HELP asmvm_stack_high_water_bytes Deepest stack of any thread.\n"
+         "# TYPE asmvm_stack_high_water_bytes gauge\n"
+         "asmvm_stack_high_water_bytes %u\n",
+         stack_high_water_.load(std::memory_order_relaxed));
+}
+
+bool Metrics::Export(const std::string& path, MetricsFormat format) {
+  std::string text;
+  Format(format, &text);
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".tmp%d", int(getpid()));
+  std::string temp_path = path + suffix;
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  bool ok = write(fd, text.data(), text.size()) == ssize_t(text.size());
+  ok = (close(fd) == 0) && ok;
+  if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+MetricsExporter::MetricsExporter(Metrics* metrics, const std::string& path,
+                                 MetricsFormat format)
+  : metrics_(metrics), path_(path), format_(format), stopping_(false) {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  watcher_ = std::thread(&MetricsExporter::Watch, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+  stopping_.store(true);
+  // Blocked everywhere else, so it can only wake the watcher.
+  kill(getpid(), SIGUSR1);
+  watcher_.join();
+}
+
+void MetricsExporter::Watch() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  for (;;) {
+    int signal;
+    if (sigwait(&signals, &signal) != 0 || stopping_.load()) return;
+    Export();
+  }
+}
+
+} // namespace asmvm
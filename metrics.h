@@ -0,0 +1,151 @@
+#ifndef ASMVM_METRICS_H
+#define ASMVM_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "run_hooks.h"
+
+namespace asmvm {
+
+class HostRegistry;
+struct HostFunction;
+
+enum MetricsFormat {
+  kMetricsJson,
+  kMetricsPrometheus
+};
+
+// Latencies are kept to within 1/kLatencySubBuckets of their value, HDR
+// style: each power of two of nanoseconds is split in kLatencySubBuckets
+// buckets, up to 2^kMaxLatencyExponent ns (about 18 minutes), where they
+// saturate.
+const uint32_t kLatencySubBucketBits = 3;
+const uint32_t kLatencySubBuckets = 1 << kLatencySubBucketBits;
+const uint32_t kMaxLatencyExponent = 40;
+const uint32_t kLatencyBuckets =
+    (kMaxLatencyExponent - kLatencySubBucketBits + 1) * kLatencySubBuckets;
+
+// Runtime metrics of a program (see AsmMachine::EnableMetrics): the calls
+// and latency histogram of each host function, bytes read and written per
+// file handle and high-water marks of open files and stack use. Safe to
+// update from all the threads of the program and to export while they run.
+// Machines without metrics pay one NULL test per SYSCALL for them.
+class Metrics {
+ public:
+  // Host functions are those of registry at this point.
+  explicit Metrics(const HostRegistry& registry);
+  ~Metrics();
+
+  static uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void RecordSysCall(const HostFunction& function, uint64_t nanoseconds);
+  void RecordRead(int32_t handle, uint64_t bytes);
+  void RecordWrite(int32_t handle, uint64_t bytes);
+  void RecordOpenFiles(uint32_t open) { RaiseTo(&open_files_high_water_, open); }
+  // Bytes a machine has above where its stack started.
+  void RecordStack(uint32_t bytes) { RaiseTo(&stack_high_water_, bytes); }
+
+  void Format(MetricsFormat format, std::string* out);
+  // Replaces path with the metrics, through a temporary file so readers
+  // never see half of them.
+  bool Export(const std::string& path, MetricsFormat format);
+
+ private:
+  Metrics(const Metrics&);
+  Metrics& operator = (const Metrics&);
+
+  struct SysCallStats {
+    const HostFunction* function;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> max;
+    std::atomic<uint64_t> buckets[kLatencyBuckets];
+  };
+  struct FileStats {
+    FileStats() : read(0), written(0) {}
+    uint64_t read;
+    uint64_t written;
+  };
+
+  template <class T> static void RaiseTo(std::atomic<T>* mark, T value) {
+    T current = mark->load(std::memory_order_relaxed);
+    while (value > current && !mark->compare_exchange_weak(current, value,
+                                                           std::memory_order_relaxed)) {
+    }
+  }
+  // Smallest value of bucket, which holds those below the next one's.
+  static uint64_t BucketFloor(uint32_t bucket);
+  static uint32_t Bucket(uint64_t nanoseconds);
+  // Upper edge of the bucket below which the fraction quantile of the calls
+  // fall, counts being those of the buckets.
+  static uint64_t Quantile(const std::vector<uint64_t>& counts, uint64_t calls,
+                           double quantile);
+
+  void FormatJson(std::string* out);
+  void FormatPrometheus(std::string* out);
+
+  // By HostFunction::index.
+  std::vector<SysCallStats*> syscalls_;
+  std::mutex files_mutex_;
+  std::map<int32_t, FileStats> files_;
+  std::atomic<uint32_t> open_files_high_water_;
+  std::atomic<uint32_t> stack_high_water_;
+};
+
+// Exports metrics to a file whenever the process gets SIGUSR1. SIGUSR1 is
+// blocked in the thread that creates the exporter, and in the threads it
+// creates from then on, so it has to be created before any of them; a thread
+// of its own waits for the signal.
+class MetricsExporter {
+ public:
+  MetricsExporter(Metrics* metrics, const std::string& path, MetricsFormat format);
+  ~MetricsExporter();
+
+  bool Export() { return metrics_->Export(path_, format_); }
+
+ private:
+  MetricsExporter(const MetricsExporter&);
+  MetricsExporter& operator = (const MetricsExporter&);
+
+  void Watch();
+
+  Metrics* metrics_;
+  std::string path_;
+  MetricsFormat format_;
+  std::atomic<bool> stopping_;
+  std::thread watcher_;
+};
+
+// Run hooks of the machines of a program with metrics, which track how far
+// their stack goes.
+struct StackHighWater : public NoHooks {
+  static const bool kInstructionHooks = true;
+
+  StackHighWater(Metrics* metrics, uint32_t stack_begin)
+    : metrics_(metrics), stack_begin_(stack_begin), peak_(stack_begin) {}
+
+  void on_instruction(AsmMachine& vm, uint32_t pc, const Instruction& ins) {
+    uint32_t st = vm.reg_ST();
+    if (st > peak_) {
+      peak_ = st;
+      metrics_->RecordStack(st - stack_begin_);
+    }
+  }
+
+  Metrics* metrics_;
+  uint32_t stack_begin_;
+  uint32_t peak_;
+};
+
+} // namespace asmvm
+
+#endif
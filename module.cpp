@@ -0,0 +1,92 @@
+#include "module.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <set>
+#include <vector>
+
+#include "image.h"
+#include "parser_aid.h"
+#include "program_cache.h"
+#include "source_buffer.h"
+
+namespace asmvm {
+
+namespace {
+
+// Whether the file of a was modified before that of b, to the nanosecond.
+bool Older(const struct stat& a, const struct stat& b) {
+  if (a.st_mtim.tv_sec != b.st_mtim.tv_sec) return a.st_mtim.tv_sec < b.st_mtim.tv_sec;
+  return a.st_mtim.tv_nsec < b.st_mtim.tv_nsec;
+}
+
+std::vector<std::string> ModulePath() {
+  const char* variable = getenv(kModulePathVariable);
+  std::string path = variable != NULL && *variable != '\0' ? variable : ".";
+  std::vector<std::string> directories;
+  size_t begin = 0;
+  for (;;) {
+    size_t end = path.find(':', begin);
+    directories.push_back(path.substr(begin, end - begin));
+    if (end == std::string::npos) break;
+    begin = end + 1;
+  }
+  return directories;
+}
+
+// Object of module name, read or compiled.
+bool FindModule(const std::string& name, AsmMachine* vm, std::string* object) {
+  std::vector<std::string> directories = ModulePath();
+  for (size_t i = 0; i < directories.size(); ++i) {
+    std::string base = (directories[i].empty() ? "." : directories[i]) + "/" + name;
+    std::string object_path = base + kModuleObjectExtension;
+    std::string source_path = base + kModuleSourceExtension;
+    struct stat object_stat, source_stat;
+    bool has_object = stat(object_path.c_str(), &object_stat) == 0;
+    bool has_source = stat(source_path.c_str(), &source_stat) == 0;
+    // Timestamps can tie for writes close together, so the object must be
+    // strictly newer than its source.
+    if (has_object && (!has_source || Older(source_stat, object_stat))) {
+      if (ReadSourceFile(object_path, object)) return true;
+      vm->Diagnostic("Módulo %s: erro ao ler %s.\n", name.c_str(), object_path.c_str());
+      return false;
+    }
+    if (has_source) return CompileModule(source_path, vm, object);
+  }
+  vm->Diagnostic("Módulo %s não encontrado.\n", name.c_str());
+  return false;
+}
+
+} // namespace
+
+bool CompileModule(const std::string& path, AsmMachine* vm, std::string* object) {
+  SourceBuffer source;
+  if (!source.Open(path)) {
+    vm->Diagnostic("Erro ao tentar abrir o arquivo %s!\n", path.c_str());
+    return false;
+  }
+  AsmMachine module;
+  module.set_diagnostics(vm->diagnostics());
+  if (!parser::ParseModule(source, &module)) {
+    vm->Diagnostic("Não foi possível compilar o módulo %s!\n", path.c_str());
+    return false;
+  }
+  return SaveModule(module, object);
+}
+
+bool LinkImports(AsmMachine* vm) {
+  std::vector<std::string> imports = vm->imports();
+  std::set<std::string> linked;
+  // imports grows as the modules bring their own.
+  for (size_t i = 0; i < imports.size(); ++i) {
+    std::string name = imports[i];
+    if (!linked.insert(name).second) continue;
+    std::string object;
+    if (!FindModule(name, vm, &object) || !AppendModule(object, name, vm, &imports)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace asmvm
@@ -0,0 +1,44 @@
+#ifndef ASMVM_MODULE_H
+#define ASMVM_MODULE_H
+
+#include <string>
+
+#include "asmvm.h"
+
+namespace asmvm {
+
+// Separate compilation. A program names the modules it uses in .IMPORT lines
+// before its .DATA section and refers to their labels and variables
+// qualified with the module name:
+//
+//   .IMPORT strings
+//   .CODE
+//   PUSH strings.greeting
+//   POP R1
+//   CALL strings.print
+//
+// A module is an ordinary source file, name.asmvm, whose own labels and
+// variables are qualified with its name when it is linked in. It may import
+// other modules. `asmvm module name.asmvm` compiles it to an object,
+// name.asmo (see SaveModule in image.h), which linking loads without the
+// parser, relocating its instructions, data and .BSS after the program's.
+// Each module is linked once however many times it is imported.
+const char kModuleSourceExtension[] = ".asmvm";
+const char kModuleObjectExtension[] = ".asmo";
+
+// Colon separated directories searched for modules; "." by default.
+const char kModulePathVariable[] = "ASMVM_PATH";
+
+// Parses the module source at path into an object. Diagnostics go to those
+// of vm.
+bool CompileModule(const std::string& path, AsmMachine* vm, std::string* object);
+
+// Appends the modules vm imports, and those they import, to vm, before it is
+// linked. A module is read from its object, unless its source is as new or
+// newer, which is then compiled on the fly. False, after reporting, if one is
+// missing or does not fit.
+bool LinkImports(AsmMachine* vm);
+
+} // namespace asmvm
+
+#endif
@@ -1,6 +1,9 @@
 #include "op.h"
-#include <thread>
-#include <chrono>
+#include <algorithm>
+#include <string.h>
+
+#include "host_functions.h"
+#include "metrics.h"
 
 namespace asmvm {
 
@@ -59,47 +62,50 @@ int32_t OpNot::Exec(AsmMachine& vm) {
   return vm.reg_PC() + 1;
 }
 
-int32_t OpJmp::Exec(AsmMachine& vm) {
-  Value* value = NULL;
-  if (vm.GetSymbolValue(label_, &value)) {
-    if (value->type() == Value::kValueTypeInteger) {
-      IntegerValue* int_value = static_cast<IntegerValue*>(value);
-      return int_value->value();
-    }
+OpPrint::OpPrint(Arena& arena, const std::vector<Printable*>& printables)
+  : printables_(arena.NewArray<Printable*>(printables.size())), printable_count_(printables.size()) {
+  std::copy(printables.begin(), printables.end(), printables_);
+}
+
+bool OpPrint::Link(AsmMachine& vm) {
+  bool ok = true;
+  for (uint32_t i = 0; i < printable_count_; ++i) {
+    ok = printables_[i]->Link(vm) && ok;
   }
-  printf("Ivalid label in instruction [JMP %s]. Aborting...\n", label_.c_str());
-  return -1;
+  return ok;
+}
+
+int32_t OpJmp::Exec(AsmMachine& vm) {
+  return vm.Branch(target_);
 }
 
 int32_t OpCall::Exec(AsmMachine& vm) {
-  Value* value = NULL;
-  if (vm.GetSymbolValue(label_, &value)) {
-    if (value->type() == Value::kValueTypeInteger) {
-      IntegerValue* int_value = static_cast<IntegerValue*>(value);
-      vm.call_push();
-      return int_value->value();
-    }
+  if (!vm.call_push()) {
+    vm.Print("Call stack overflow. Maximum call depth = %d.\n", kMaxCallDepth);
+    return -1;
   }
-  printf("Ivalid label in instruction [CALL %s]. Aborting...\n", label_.c_str());
-  return -1;
+  return vm.Branch(target_);
 }
 
 int32_t OpRet::Exec(AsmMachine& vm) {
-  return vm.call_pop() + 1;
+  if (vm.current_frame().frame_base != kNoFrame) {
+    vm.Print("RET with an open frame. Missing LEAVE?\n");
+    return -1;
+  }
+  uint32_t return_pc;
+  if (!vm.call_pop(&return_pc)) {
+    vm.Print("Invalid RET operation. Call stack is empty.\n");
+    return -1;
+  }
+  if (return_pc == kHostReturnPc) return vm.ReturnToHost();
+  return vm.Branch(return_pc + 1);
 }
 
 int32_t ConditionalJump::Exec(AsmMachine& vm) {
-  Value* value = NULL;
-  if (jmp_condition(vm) && vm.GetSymbolValue(label_, &value)) {
-    if (value->type() == Value::kValueTypeInteger) {
-      IntegerValue* int_value = static_cast<IntegerValue*>(value);
-      return int_value->value();
-    } else {
-      printf("Ivalid label in instruction [JMP %s]. Aborting...\n", label_.c_str());
-      return -1;
-    }
+  if (jmp_condition(vm)) {
+    return vm.Branch(target_);
   }
-  return vm.reg_PC() + 1;  
+  return vm.Branch(vm.reg_PC() + 1);
 }
 
 int32_t OpMov::Exec(AsmMachine& vm) {
@@ -109,7 +115,7 @@ int32_t OpMov::Exec(AsmMachine& vm) {
 
 int32_t OpPush::Exec(AsmMachine& vm) {
   if (!vm.push_value(src_->value(vm))) {
-    printf("Stack overflow. Default memory size = %d.", kDefaultMemorySize);
+    vm.Print("Stack overflow. Default memory size = %d.", vm.stack_end());
     return -1;
   }
   return vm.reg_PC() + 1;
@@ -118,7 +124,7 @@ int32_t OpPush::Exec(AsmMachine& vm) {
 int32_t OpPop::Exec(AsmMachine& vm) {
   int32_t value = 0;
   if (!vm.pop(&value)) {
-    printf("Invalid POP operation. Stack is empty.");
+    vm.Print("Invalid POP operation. Stack is empty.");
     return -1;
   }
   if (store_value_) { 
@@ -128,28 +134,28 @@ int32_t OpPop::Exec(AsmMachine& vm) {
 }
 
 int32_t OpSt1::Exec(AsmMachine& vm) {
-  if (!vm.push_value(uint8_t(src_->value(vm)), address_->address(vm), 0)) {
-    printf("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), kDefaultMemorySize);
+  if (!vm.store_value(address_->address(vm), uint8_t(src_->value(vm)))) {
+    vm.Print("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), vm.memory_size());
   }
   return vm.reg_PC() + 1;
 }
 
 int32_t OpSt2::Exec(AsmMachine& vm) {
-  if (!vm.push_value(uint16_t(src_->value(vm)), address_->address(vm), 0)) {
-    printf("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), kDefaultMemorySize);
+  if (!vm.store_value(address_->address(vm), uint16_t(src_->value(vm)))) {
+    vm.Print("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), vm.memory_size());
   }
   return vm.reg_PC() + 1;
 }
 
 int32_t OpSt4::Exec(AsmMachine& vm) {
-  if (!vm.push_value(src_->value(vm), address_->address(vm), 0)) {
-    printf("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), kDefaultMemorySize);
+  if (!vm.store_value(address_->address(vm), src_->value(vm))) {
+    vm.Print("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), vm.memory_size());
   }
   return vm.reg_PC() + 1;
 }
 
 int32_t OpExit::Exec(AsmMachine& vm) {
-  printf("\nProgram exit with code %d.\n", code_->value(vm));
+  vm.Print("\nProgram exit with code %d.\n", code_->value(vm));
   if (code_->value(vm) < 0) return -1;
   return -1 - code_->value(vm);
 }
@@ -165,74 +171,83 @@ int32_t OpDec::Exec(AsmMachine& vm) {
 }
 
 int32_t OpPrint::Exec(AsmMachine& vm) {
-  for (auto i = printables_.begin(); i != printables_.end(); i++) {
-    printf("%s", (*i)->str(vm).c_str());
+  for (uint32_t i = 0; i < printable_count_; ++i) {
+    std::string str = printables_[i]->str(vm);
+    vm.Write(str.data(), str.size());
   }
-  fflush(stdout);
+  vm.Flush();
   return vm.reg_PC() + 1;
 }
 
 int32_t OpLd1::Exec(AsmMachine& vm) {
-  uint8_t value;
+  uint8_t value = 0;
   if (!vm.load_value(address_->address(vm), 0, &value)) {
-    printf("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), kDefaultMemorySize);
+    vm.Print("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), vm.memory_size());
   }
   vm.set_register(rindex_, value);
   return vm.reg_PC() + 1;
 }
 
 int32_t OpLd2::Exec(AsmMachine& vm) {
-  uint16_t value;
+  uint16_t value = 0;
   if (!vm.load_value(address_->address(vm), 0, &value)) {
-    printf("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), kDefaultMemorySize);
+    vm.Print("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), vm.memory_size());
   }
   vm.set_register(rindex_, value);
   return vm.reg_PC() + 1;
 }
 
 int32_t OpLd4::Exec(AsmMachine& vm) {
-  uint32_t value;
+  uint32_t value = 0;
   if (!vm.load_value(address_->address(vm), 0, &value)) {
-    printf("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), kDefaultMemorySize);
+    vm.Print("Invalid address [%d]. Default memory size = %d.\n", address_->address(vm), vm.memory_size());
   }
   vm.set_register(rindex_, value);
   return vm.reg_PC() + 1;
 }
 
-enum SysCallCode {
-  kSysCallFopen = 0,
-  kSysCallFclose = 1,
-  kSysCallFprint = 2,
-  kSysCallReadString = 3,
-  kSysCallReadInt = 4,
-  kSysCallReadFloat = 5,
-  kSysCallSleep,
-  kSysCallFread,
-  kSysCallFwrite,
-  kSysCallFseek,
-  kSysCallNow,
-  kSysCallSocket,
-  kSysCallTCPConnect,
-  kSysCallSend,
-  kSysCallRecv,
-  kSysCallListen,
-  kSysCallBind
-};
+namespace {
 
-enum OpenMode {
-  kOpenModeRead = 1,
-  kOpenModeWrite = 2,
-  kOpenModeCreate = 4,
-  kOpenModeBinary = 8,
-  kOpenModeAppend = 16
-};
+int32_t* AtomicWord(AsmMachine& vm, int32_t address) {
+  int32_t* word = vm.atomic_word(address);
+  if (word == NULL) {
+    vm.Print("Invalid atomic address [%d]. Atomic words are 4-byte aligned within the %d bytes of memory.\n", address, vm.memory_size());
+  }
+  return word;
+}
 
-enum ParamType {
-  kTypeString = 0,
-  kTypeInt,
-  kTypeFloat,
-  kTypeNoMoreParams
-};
+} // namespace
+
+int32_t OpXadd::Exec(AsmMachine& vm) {
+  int32_t* word = AtomicWord(vm, address_->address(vm));
+  if (word != NULL) {
+    vm.set_register(rindex_, __atomic_fetch_add(word, vm.get_register(rindex_), __ATOMIC_SEQ_CST));
+  }
+  return vm.reg_PC() + 1;
+}
+
+int32_t OpCas::Exec(AsmMachine& vm) {
+  int32_t* word = AtomicWord(vm, address_->address(vm));
+  if (word != NULL) {
+    int32_t expected = vm.get_register(rindex_);
+    __atomic_compare_exchange_n(word, &expected, vm.get_register(desired_), false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    vm.set_register(rindex_, expected);
+  }
+  return vm.reg_PC() + 1;
+}
+
+int32_t OpLd4Acquire::Exec(AsmMachine& vm) {
+  int32_t* word = AtomicWord(vm, address_->address(vm));
+  if (word != NULL) vm.set_register(rindex_, __atomic_load_n(word, __ATOMIC_ACQUIRE));
+  return vm.reg_PC() + 1;
+}
+
+int32_t OpSt4Release::Exec(AsmMachine& vm) {
+  int32_t* word = AtomicWord(vm, address_->address(vm));
+  if (word != NULL) __atomic_store_n(word, src_->value(vm), __ATOMIC_RELEASE);
+  return vm.reg_PC() + 1;
+}
 
 union float_wrapper {
     int32_t i;
@@ -241,124 +256,48 @@ union float_wrapper {
 
 
 int32_t OpSysCall::Exec(AsmMachine& vm) {
-  int32_t function_code = src_->value(vm);
-  int32_t pointer;
-  int32_t mode;
-  int32_t nparams;
-  int32_t handler = 0;
-  int32_t ret = 0;
-  const char* filename = NULL;
-  switch (function_code) {
-  case kSysCallFopen:
-    //printf("[kSysCallFopen]\n");
-    vm.pop(&pointer);
-    vm.pop(&mode);
-    filename = (const char*)vm.data() + pointer;
-    if ((mode & (kOpenModeRead)) == kOpenModeRead) {
-      handler = vm.fopen(filename, "r");
-    } else if ((mode & (kOpenModeRead | kOpenModeWrite)) == (kOpenModeRead | kOpenModeWrite)) {
-      handler = vm.fopen(filename, "r+");
-    } else if ((mode & (kOpenModeRead | kOpenModeWrite | kOpenModeCreate | kOpenModeBinary)) == (kOpenModeRead | kOpenModeWrite | kOpenModeCreate | kOpenModeBinary)) {
-      handler = vm.fopen(filename, "wb+");
-    } else if ((mode & (kOpenModeRead | kOpenModeWrite | kOpenModeCreate)) == (kOpenModeRead | kOpenModeWrite | kOpenModeCreate)) {
-      handler = vm.fopen(filename, "w+");
-    } else if ((mode & (kOpenModeWrite | kOpenModeCreate)) == (kOpenModeWrite | kOpenModeCreate)) {
-      handler = vm.fopen(filename, "w");
-    } else if ((mode & (kOpenModeRead | kOpenModeWrite | kOpenModeBinary)) == (kOpenModeRead | kOpenModeWrite | kOpenModeBinary)) {
-      handler = vm.fopen(filename, "rb+");
-    } else if ((mode & (kOpenModeRead | kOpenModeBinary)) == (kOpenModeRead | kOpenModeBinary)) {
-      handler = vm.fopen(filename, "rb");
-    } else if ((mode & (kOpenModeWrite | kOpenModeBinary)) == (kOpenModeWrite | kOpenModeBinary)) {
-      handler = vm.fopen(filename, "wb");
-    } else if ((mode & (kOpenModeAppend | kOpenModeBinary)) == (kOpenModeAppend | kOpenModeBinary)) {
-      handler = vm.fopen(filename, "ab");
-    } else if ((mode & (kOpenModeAppend)) == kOpenModeAppend) {
-      handler = vm.fopen(filename, "a");
-    } else if ((mode & (kOpenModeAppend | kOpenModeRead | kOpenModeBinary)) == (kOpenModeAppend | kOpenModeRead | kOpenModeBinary)) {
-      handler = vm.fopen(filename, "ab+");
-    } else if ((mode & (kOpenModeAppend | kOpenModeRead )) == (kOpenModeAppend | kOpenModeRead )) {
-      handler = vm.fopen(filename, "a+");
-    }
-    if (handler == 0) ret = 1;
-    vm.push_value(handler);
-    break;
-  case kSysCallFclose:
-    vm.pop(&handler);
-    vm.fclose(handler);
-    break;
-  case kSysCallFprint: {
-      int type = -1;
-      vm.pop(&handler);
-      const char* str = NULL;
-      int32_t value;
-      vm.pop(&type);
-      switch (type) {
-      case kTypeString:
-        vm.pop(&pointer);
-        str = (const char*)vm.data() + pointer;
-        //printf("[kSysCallFprint] str = [%s]\n", str);
-        fprintf(vm.file(handler), "%s", str);
-        break;
-      case kTypeInt:
-        vm.pop(&value);
-        fprintf(vm.file(handler), "%d", value);
-        //printf("[kSysCallFprint] int = [%d]\n", value);
-        break;
-      case kTypeFloat: {
-          float_wrapper u;
-          vm.pop(&value);
-          u.i = value;
-          fprintf(vm.file(handler), "%f", u.f);
-        }
-        break;
-      }
-    }
-    fflush(vm.file(handler));
-    break;
-  case kSysCallReadString: {
-      char* str = NULL;
-      int32_t size = 0;
-      vm.pop(&handler);
-      vm.pop(&size); // Size of the string
-      vm.pop(&pointer); // Address of the string
-      str = (char*)vm.data() + pointer;
-      char* res = fgets(str, size, vm.file(handler));
-      if (res == NULL) {
-        ret = 1;
-      }
-    }
-    break;
-  case kSysCallReadInt: {
-      int32_t value = 0;
-      vm.pop(&handler);
-      int res = fscanf(vm.file(handler), "%d", &value);
-      if (res != 1) {
-        ret = 1;
-      }
-      vm.push_value(value);
-    }
-    break;
-  case kSysCallReadFloat: {
-      float value = 0.0F;
-      vm.pop(&handler);
-      int res = fscanf(vm.file(handler), "%f", &value);
-      if (res != 1) {
-        ret = 1;
-      }
-      vm.push_value(value);
-    }
-    break;
-  case kSysCallSleep: {
-      int32_t ms = 0;   
-      vm.pop(&ms);
-      std::this_thread::sleep_for(std::chrono::milliseconds((uint32_t)ms));
+  const HostFunction* function = function_;
+  if (function == NULL) {
+    function = vm.host_functions().Find(src_->value(vm));
+    if (function == NULL) {
+      vm.set_register(rindex_, 1);
+      return vm.reg_PC() + 1;
     }
-    break;
   }
-  vm.set_register(rindex_, ret);
+  int32_t status;
+  Metrics* metrics = vm.metrics();
+  if (metrics == NULL) {
+    status = CallHostFunction(vm, *function);
+  } else {
+    uint64_t start = Metrics::Now();
+    status = CallHostFunction(vm, *function);
+    // A call that would block runs again, and counts then.
+    if (status != kHostWouldBlock) metrics->RecordSysCall(*function, Metrics::Now() - start);
+  }
+  if (status == kHostWouldBlock) return vm.Yield();
+  vm.set_register(rindex_, status);
   return vm.reg_PC() + 1;
 }
 
+bool OpSysCall::Link(AsmMachine& vm) {
+  function_ = NULL;
+  if (name_ != NULL) {
+    function_ = vm.host_functions().Find(name_);
+    if (function_ == NULL) vm.Diagnostic("SYSCALL \"%s\" não registrada.\n", name_);
+    return function_ != NULL;
+  }
+  // Numbers in registers are looked up on every call.
+  const IntegerValue* number = dynamic_cast<const IntegerValue*>(src_);
+  if (number == NULL) return src_->Link(vm);
+  function_ = vm.host_functions().Find(number->value());
+  if (function_ == NULL) vm.Diagnostic("SYSCALL %d não registrada.\n", number->value());
+  return function_ != NULL;
+}
+
+int32_t OpSysCall::number(AsmMachine& vm) const {
+  return function_ != NULL ? function_->number : src_->value(vm);
+}
+
 int32_t OpPushN::Exec(AsmMachine& vm) {
   vm.set_register(kRegisterIndexSt, vm.reg_ST() + bytes_);
   return vm.reg_PC() + 1;
@@ -369,23 +308,77 @@ int32_t OpPopN::Exec(AsmMachine& vm) {
   return vm.reg_PC() + 1;
 }
 
+int32_t OpEnter::Exec(AsmMachine& vm) {
+  CallFrame& frame = vm.current_frame();
+  if (frame.frame_base != kNoFrame) {
+    vm.Print("ENTER inside an open frame. Missing LEAVE?\n");
+    return -1;
+  }
+  // Without wrapping around for huge sizes, such as those of ENTER -8.
+  if (vm.reg_ST() >= vm.stack_end() || bytes_ >= vm.stack_end() - vm.reg_ST()) {
+    vm.Print("Stack overflow. Default memory size = %d.\n", vm.stack_end());
+    return -1;
+  }
+  frame.frame_base = vm.reg_ST();
+  vm.set_register(rindex_, vm.reg_ST());
+  vm.set_register(kRegisterIndexSt, vm.reg_ST() + bytes_);
+  return vm.reg_PC() + 1;
+}
+
+int32_t OpLeave::Exec(AsmMachine& vm) {
+  CallFrame& frame = vm.current_frame();
+  if (frame.frame_base == kNoFrame) {
+    vm.Print("LEAVE without ENTER.\n");
+    return -1;
+  }
+  vm.set_register(kRegisterIndexSt, frame.frame_base);
+  frame.frame_base = kNoFrame;
+  return vm.reg_PC() + 1;
+}
+
 int32_t OpFprint::Exec(AsmMachine& vm) {
   float_wrapper u;
   u.i = vm.get_register(rindex_);
-  printf("%f", u.f);
-  fflush(stdout);
+  vm.Print("%f", u.f);
+  vm.Flush();
   return vm.reg_PC() + 1;
 }
 
 int32_t OpSprint::Exec(AsmMachine& vm) {
-  if (reg_) {
-    int32_t pointer = vm.get_register(rindex_);
-    str_ = reinterpret_cast<const char*>(vm.data() + pointer);
-  }
-  printf("%s", str_);
-  fflush(stdout);
+  const char* str = reinterpret_cast<const char*>(vm.data() + str_->base_address(vm));
+  vm.Write(str, strlen(str));
+  vm.Flush();
   return vm.reg_PC() + 1;
 }
 
+bool FusedJump::Link(AsmMachine& vm) {
+  if (!jump_->Link(vm)) return false;
+  target_ = jump_->target();
+  return true;
+}
+
+
+Instruction* NewUncheckedInstruction(Arena& code, Instruction* ins) {
+  switch (ins->opcode()) {
+  case Instruction::kOpLd1:
+    return code.New<UncheckedLoad<OpLd1, uint8_t> >(*static_cast<OpLd1*>(ins));
+  case Instruction::kOpLd2:
+    return code.New<UncheckedLoad<OpLd2, uint16_t> >(*static_cast<OpLd2*>(ins));
+  case Instruction::kOpLd4:
+    return code.New<UncheckedLoad<OpLd4, uint32_t> >(*static_cast<OpLd4*>(ins));
+  case Instruction::kOpSt1:
+    return code.New<UncheckedStore<OpSt1, uint8_t> >(*static_cast<OpSt1*>(ins));
+  case Instruction::kOpSt2:
+    return code.New<UncheckedStore<OpSt2, uint16_t> >(*static_cast<OpSt2*>(ins));
+  case Instruction::kOpSt4:
+    return code.New<UncheckedStore<OpSt4, int32_t> >(*static_cast<OpSt4*>(ins));
+  case Instruction::kOpPush:
+    return code.New<UncheckedPush>(*static_cast<OpPush*>(ins));
+  case Instruction::kOpPop:
+    return code.New<UncheckedPop>(*static_cast<OpPop*>(ins));
+  default:
+    return NULL;
+  }
+}
 
-} // namespace asmvm
\ No newline at end of file
+} // namespace asmvm
@@ -1,8 +1,9 @@
 #ifndef ASMVM_OP_H
 #define ASMVM_OP_H
 
-#include <list>
+#include <vector>
 
+#include "host_functions.h"
 #include "params.h"
 
 namespace asmvm {
@@ -11,10 +12,6 @@ class TernaryInstruction : public Instruction {
  public:
   TernaryInstruction(Source* param1, Source* param2, uint32_t output_rindex)
     : param1_(param1), param2_(param2), output_rindex_(output_rindex) {}
-  virtual ~TernaryInstruction() {
-    delete param1_;
-    delete param2_;
-  }
   Source* param1() { return param1_; }
   Source* param2() { return param2_; }
   const Source* param1() const { return param1_; }
@@ -31,6 +28,7 @@ class OpAdd : public TernaryInstruction {
   OpAdd(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpAdd; }
 };
 
 class OpSub : public TernaryInstruction {
@@ -38,6 +36,7 @@ class OpSub : public TernaryInstruction {
   OpSub(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpSub; }
 };
 
 class OpMul : public TernaryInstruction {
@@ -45,6 +44,7 @@ class OpMul : public TernaryInstruction {
   OpMul(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpMul; }
 };
 
 class OpDiv : public TernaryInstruction {
@@ -52,6 +52,7 @@ class OpDiv : public TernaryInstruction {
   OpDiv(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpDiv; }
 };
 
 class OpMod : public TernaryInstruction {
@@ -59,6 +60,7 @@ class OpMod : public TernaryInstruction {
   OpMod(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpMod; }
 };
 
 class OpAnd : public TernaryInstruction {
@@ -66,6 +68,7 @@ class OpAnd : public TernaryInstruction {
   OpAnd(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpAnd; }
 };
 
 class OpOr : public TernaryInstruction {
@@ -73,6 +76,7 @@ class OpOr : public TernaryInstruction {
   OpOr(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpOr; }
 };
 
 class OpXor : public TernaryInstruction {
@@ -80,6 +84,7 @@ class OpXor : public TernaryInstruction {
   OpXor(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpXor; }
 };
 
 class OpShl : public TernaryInstruction {
@@ -87,6 +92,7 @@ class OpShl : public TernaryInstruction {
   OpShl(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpShl; }
 };
 
 class OpShr : public TernaryInstruction {
@@ -94,12 +100,16 @@ class OpShr : public TernaryInstruction {
   OpShr(Source* param1, Source* param2, uint32_t output_rindex) 
     : TernaryInstruction(param1, param2, output_rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpShr; }
 };
 
 class OpNot : public Instruction {
  public:
   OpNot(uint32_t rindex1, uint32_t rindex2) : rindex1_(rindex1), rindex2_(rindex2) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpNot; }
+  uint32_t rindex1() const { return rindex1_; }
+  uint32_t rindex2() const { return rindex2_; }
  private:
   uint32_t rindex1_;
   uint32_t rindex2_;
@@ -107,55 +117,73 @@ class OpNot : public Instruction {
 
 class OpJmp : public Instruction {
  public:
-  OpJmp(const std::string& label) : label_(label) {}
+  OpJmp(SymbolId label) : label_(label), target_(0) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpJmp; }
+  bool Link(AsmMachine& vm) { return vm.ResolveSymbol(label_, Symbol::kSymbolLabel, &target_); }
+  SymbolId label() const { return label_; }
+  int32_t target() const { return target_; }
  private:
-  std::string label_;
+  SymbolId label_;
+  int32_t target_;
 };
 
 class OpCall : public Instruction {
  public:
-  OpCall(const std::string& label) : label_(label) {}
+  OpCall(SymbolId label) : label_(label), target_(0) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpCall; }
+  bool Link(AsmMachine& vm) { return vm.ResolveSymbol(label_, Symbol::kSymbolLabel, &target_); }
+  SymbolId label() const { return label_; }
+  int32_t target() const { return target_; }
  private:
-  std::string label_;
+  SymbolId label_;
+  int32_t target_;
 };
 
 class OpRet : public Instruction {
  public:
   OpRet() {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpRet; }
 };
 
 class ConditionalJump : public Instruction {
  public:
-  ConditionalJump(uint32_t rindex, const std::string& label) : rindex_(rindex), label_(label) {}
+  ConditionalJump(uint32_t rindex, SymbolId label) : rindex_(rindex), label_(label), target_(0) {}
   int32_t Exec(AsmMachine& vm);
+  bool Link(AsmMachine& vm) { return vm.ResolveSymbol(label_, Symbol::kSymbolLabel, &target_); }
   virtual bool jmp_condition(AsmMachine& vm) = 0;
+  uint32_t rindex() const { return rindex_; }
+  SymbolId label() const { return label_; }
+  int32_t target() const { return target_; }
  protected:
   uint32_t rindex_;
-  std::string label_;
+  SymbolId label_;
+  int32_t target_;
 };
 
 class OpJz : public ConditionalJump {
  public:
-  OpJz(uint32_t rindex, const std::string& label) : ConditionalJump(rindex, label) {}
+  OpJz(uint32_t rindex, SymbolId label) : ConditionalJump(rindex, label) {}
+  Opcode opcode() const { return kOpJz; }
   bool jmp_condition(AsmMachine& vm) { return vm.get_register(rindex_) == 0; }
 };
 
 class OpJnz : public ConditionalJump {
  public:
-  OpJnz(uint32_t rindex, const std::string& label) : ConditionalJump(rindex, label) {}
+  OpJnz(uint32_t rindex, SymbolId label) : ConditionalJump(rindex, label) {}
+  Opcode opcode() const { return kOpJnz; }
   bool jmp_condition(AsmMachine& vm) { return vm.get_register(rindex_) != 0; }
 };
 
 class OpMov : public Instruction {
  public:
   OpMov(uint32_t rindex_dst, Source* src) : rindex_dst_(rindex_dst), src_(src) {}
-  ~OpMov() {
-    delete src_;
-  }
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpMov; }
+  uint32_t rindex_dst() const { return rindex_dst_; }
+  const Source* src() const { return src_; }
  private:
   uint32_t rindex_dst_;
   Source* src_;
@@ -164,10 +192,10 @@ class OpMov : public Instruction {
 class OpPush : public Instruction {
  public:
   OpPush(Source* src) : src_(src) {}
-  ~OpPush() {
-    delete src_;
-  }
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpPush; }
+  bool Link(AsmMachine& vm) { return src_->Link(vm); }
+  const Source* src() const { return src_; }
  private:
   Source* src_;
 };
@@ -177,6 +205,9 @@ class OpPop : public Instruction {
   OpPop() : rindex_(0), store_value_(false) {}
   OpPop(uint32_t rindex) : rindex_(rindex), store_value_(true) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpPop; }
+  uint32_t rindex() const { return rindex_; }
+  bool store_value() const { return store_value_; }
  private:
   uint32_t rindex_;
   bool store_value_;
@@ -185,10 +216,10 @@ class OpPop : public Instruction {
 class OpLoad : public Instruction {
  public:
   OpLoad(uint32_t rindex, Address* address) : rindex_(rindex), address_(address) {}
-  virtual ~OpLoad() {
-    delete address_;
-  }
-  
+  bool Link(AsmMachine& vm) { return address_->Link(vm); }
+  uint32_t rindex() const { return rindex_; }
+  const Address* address() const { return address_; }
+
  protected:
   uint32_t rindex_;
   Address* address_;
@@ -198,27 +229,61 @@ class OpLd1 : public OpLoad {
  public:
   OpLd1(uint32_t rindex, Address* address) : OpLoad(rindex, address) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpLd1; }
 };
 
 class OpLd2 : public OpLoad {
  public:
   OpLd2(uint32_t rindex, Address* address) : OpLoad(rindex, address) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpLd2; }
 };
 
 class OpLd4 : public OpLoad {
  public:
   OpLd4(uint32_t rindex, Address* address) : OpLoad(rindex, address) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpLd4; }
+};
+
+// Atomic instructions, on 4-byte aligned words of the memory shared by the
+// threads of the program (see threads.h). XADD and CAS are sequentially
+// consistent.
+
+// Adds the register to the word and leaves the previous value in it.
+class OpXadd : public OpLoad {
+ public:
+  OpXadd(uint32_t rindex, Address* address) : OpLoad(rindex, address) {}
+  int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpXadd; }
+};
+
+// Stores the new register in the word if it holds the expected one, and
+// leaves the previous value of the word in the expected register.
+class OpCas : public OpLoad {
+ public:
+  OpCas(uint32_t expected, uint32_t desired, Address* address)
+    : OpLoad(expected, address), desired_(desired) {}
+  int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpCas; }
+  uint32_t desired() const { return desired_; }
+ private:
+  uint32_t desired_;
+};
+
+class OpLd4Acquire : public OpLoad {
+ public:
+  OpLd4Acquire(uint32_t rindex, Address* address) : OpLoad(rindex, address) {}
+  int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpLd4Acquire; }
 };
 
 class OpExit : public Instruction {
  public:
   OpExit(Source* code) : code_(code) {}
-  ~OpExit() {
-    delete code_;
-  }
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpExit; }
+  const Source* code() const { return code_; }
  private:
   Source* code_;
 };
@@ -227,6 +292,8 @@ class OpInc : public Instruction {
  public:
   OpInc(uint32_t rindex) : rindex_(rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpInc; }
+  uint32_t rindex() const { return rindex_; }
  private:
   uint32_t rindex_;
 };
@@ -235,25 +302,32 @@ class OpDec : public Instruction {
  public:
   OpDec(uint32_t rindex) : rindex_(rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpDec; }
+  uint32_t rindex() const { return rindex_; }
  private:
   uint32_t rindex_;
 };
 
 class OpPrint : public Instruction {
  public:
-  OpPrint(const std::list<Printable*>& printables) : printables_(printables) {}
+  // Copies the list into an array allocated from arena.
+  OpPrint(Arena& arena, const std::vector<Printable*>& printables);
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpPrint; }
+  bool Link(AsmMachine& vm);
+  Printable* const* printables() const { return printables_; }
+  uint32_t printable_count() const { return printable_count_; }
  private:
-  std::list<Printable*> printables_;
+  Printable** printables_;
+  uint32_t printable_count_;
 };
 
 class OpStore : public Instruction {
  public:
   OpStore(Source* src, Address* address) : src_(src), address_(address) {}
-  virtual ~OpStore() {
-    delete src_;
-    delete address_;
-  }
+  bool Link(AsmMachine& vm) { return src_->Link(vm) && address_->Link(vm); }
+  const Source* src() const { return src_; }
+  const Address* address() const { return address_; }
  protected:
   Source* src_;
   Address* address_;
@@ -263,33 +337,62 @@ class OpSt1 : public OpStore {
  public:
   OpSt1(Source* src, Address* address) : OpStore(src, address) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpSt1; }
 };
 
 class OpSt2 : public OpStore {
  public:
   OpSt2(Source* src, Address* address) : OpStore(src, address) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpSt2; }
 };
 
 class OpSt4 : public OpStore {
  public:
   OpSt4(Source* src, Address* address) : OpStore(src, address) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpSt4; }
 };
 
-class OpSysCall : public Instruction {
+// ST4 with release ordering, for data other threads read with LD4A.
+class OpSt4Release : public OpStore {
  public:
-  OpSysCall(Source* src, uint32_t rindex) : src_(src), rindex_(rindex) {}
+  OpSt4Release(Source* src, Address* address) : OpStore(src, address) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpSt4Release; }
+};
+
+// Calls a host function (see host_functions.h). Immediate numbers and names
+// are bound to their function at link time; a number in a register is looked
+// up when the instruction runs.
+class OpSysCall : public Instruction {
+ public:
+  OpSysCall(Source* src, uint32_t rindex) : src_(src), name_(NULL), rindex_(rindex), function_(NULL) {}
+  OpSysCall(const char* name, uint32_t rindex) : src_(NULL), name_(name), rindex_(rindex), function_(NULL) {}
+  int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpSysCall; }
+  bool Link(AsmMachine& vm);
+  // Either src or name is NULL.
+  const Source* src() const { return src_; }
+  const char* name() const { return name_; }
+  uint32_t rindex() const { return rindex_; }
+  // The function bound at link time, NULL for numbers in registers.
+  const HostFunction* function() const { return function_; }
+  // Number of the function this call runs, kNoHostNumber for name-only ones.
+  int32_t number(AsmMachine& vm) const;
  private:
   Source* src_;
+  const char* name_;
   uint32_t rindex_;
+  const HostFunction* function_;
 };
 
 class OpPushN : public Instruction {
  public:
   OpPushN(uint32_t bytes) : bytes_(bytes) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpPushN; }
+  uint32_t bytes() const { return bytes_; }
  private:
   uint32_t bytes_; 
 };
@@ -298,6 +401,8 @@ class OpPopN : public Instruction {
  public:
   OpPopN(uint32_t bytes) : bytes_(bytes) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpPopN; }
+  uint32_t bytes() const { return bytes_; }
  private:
   uint32_t bytes_; 
 };
@@ -306,21 +411,149 @@ class OpFprint : public Instruction {
  public:
   OpFprint(uint32_t rindex) : rindex_(rindex) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpFprint; }
+  uint32_t rindex() const { return rindex_; }
  private:
   uint32_t rindex_;
 };
 
+// Prints the string stored at a register or variable address.
 class OpSprint : public Instruction {
  public:
-  OpSprint(uint32_t rindex) : rindex_(rindex), reg_(true), str_(NULL) {}
-  OpSprint(const char* str) : rindex_(0), reg_(false), str_(str) {}
+  OpSprint(BaseAddress* str) : str_(str) {}
   int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpSprint; }
+  bool Link(AsmMachine& vm) { return str_->Link(vm); }
+  const BaseAddress* str() const { return str_; }
  private:
+  BaseAddress* str_;
+};
+
+// Opens a frame of bytes bytes, a constant, for locals on the data stack and
+// sets rindex to its base. The frame belongs to the current call and is closed by LEAVE,
+// which must come before RET.
+class OpEnter : public Instruction {
+ public:
+  OpEnter(uint32_t bytes, uint32_t rindex) : bytes_(bytes), rindex_(rindex) {}
+  int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpEnter; }
+  uint32_t bytes() const { return bytes_; }
+  uint32_t rindex() const { return rindex_; }
+ private:
+  uint32_t bytes_;
   uint32_t rindex_;
-  bool reg_;
-  const char* str_;
 };
 
+// Drops the frame opened by ENTER, restoring ST.
+class OpLeave : public Instruction {
+ public:
+  OpLeave() {}
+  int32_t Exec(AsmMachine& vm);
+  Opcode opcode() const { return kOpLeave; }
+};
+
+// Superinstructions made by ApplyProfile (see profile.h) out of an
+// instruction of a hot block and the JZ or JNZ after it, run in one dispatch
+// with the condition tested inline. The jump stays in the program after
+// them, unreached.
+class FusedJump : public Instruction {
+ public:
+  explicit FusedJump(ConditionalJump* jump)
+    : jump_(jump), if_zero_(jump->opcode() == kOpJz), target_(jump->target()) {}
+  bool Link(AsmMachine& vm);
+ protected:
+  // The jump, once the first instruction has run.
+  int32_t Jump(AsmMachine& vm) {
+    int32_t next = vm.reg_PC() + 1;
+    vm.set_register(kRegisterIndexPc, next);
+    bool zero = vm.get_register(jump_->rindex()) == 0;
+    return vm.Branch(zero == if_zero_ ? target_ : next + 1);
+  }
+ private:
+  ConditionalJump* jump_;
+  bool if_zero_;
+  int32_t target_;
+};
+
+// INC or DEC, a loop counter.
+class OpStepJump : public FusedJump {
+ public:
+  OpStepJump(uint32_t rindex, int32_t step, ConditionalJump* jump)
+    : FusedJump(jump), rindex_(rindex), step_(step) {}
+  int32_t Exec(AsmMachine& vm) {
+    vm.set_register(rindex_, vm.get_register(rindex_) + step_);
+    return Jump(vm);
+  }
+  Opcode opcode() const { return kOpStepJump; }
+ private:
+  uint32_t rindex_;
+  int32_t step_;
+};
+
+// ADD, SUB or AND, a comparison or a test of bits.
+template <Instruction::Opcode kArith> class OpArithJump : public FusedJump {
+ public:
+  OpArithJump(TernaryInstruction* arith, ConditionalJump* jump)
+    : FusedJump(jump), arith_(arith) {}
+  int32_t Exec(AsmMachine& vm) {
+    int32_t a = arith_->param1()->value(vm);
+    int32_t b = arith_->param2()->value(vm);
+    vm.set_register(arith_->output_rindex(),
+                    kArith == kOpAdd ? a + b : kArith == kOpSub ? a - b : a & b);
+    return Jump(vm);
+  }
+  Opcode opcode() const { return kOpArithJump; }
+  bool Link(AsmMachine& vm) { return arith_->Link(vm) && FusedJump::Link(vm); }
+ private:
+  TernaryInstruction* arith_;
+};
+
+// Loads, stores, PUSH and POP of guarded machines (see
+// AsmMachine::EnableGuardPages), which leave the checks to the guard pages.
+// Same opcodes and operands as the instructions they replace.
+template <class Op, typename T> class UncheckedLoad : public Op {
+ public:
+  explicit UncheckedLoad(const Op& op) : Op(op) {}
+  int32_t Exec(AsmMachine& vm) {
+    vm.set_register(this->rindex_, vm.load_unchecked<T>(this->address_->address(vm)));
+    return vm.reg_PC() + 1;
+  }
+};
+
+template <class Op, typename T> class UncheckedStore : public Op {
+ public:
+  explicit UncheckedStore(const Op& op) : Op(op) {}
+  int32_t Exec(AsmMachine& vm) {
+    vm.store_unchecked(this->address_->address(vm), T(this->src_->value(vm)));
+    return vm.reg_PC() + 1;
+  }
+};
+
+class UncheckedPush : public OpPush {
+ public:
+  explicit UncheckedPush(const OpPush& op) : OpPush(op) {}
+  int32_t Exec(AsmMachine& vm) {
+    vm.store_unchecked(vm.reg_ST(), src()->value(vm));
+    vm.set_register(kRegisterIndexSt, vm.reg_ST() + sizeof(int32_t));
+    return vm.reg_PC() + 1;
+  }
+};
+
+class UncheckedPop : public OpPop {
+ public:
+  explicit UncheckedPop(const OpPop& op) : OpPop(op) {}
+  int32_t Exec(AsmMachine& vm) {
+    uint32_t address = vm.reg_ST() - sizeof(int32_t);
+    int32_t value = vm.load_unchecked<int32_t>(address);
+    if (store_value()) vm.set_register(rindex(), value);
+    vm.set_register(kRegisterIndexSt, address);
+    return vm.reg_PC() + 1;
+  }
+};
+
+// The unchecked replacement of ins allocated in code, or NULL if it has none.
+Instruction* NewUncheckedInstruction(Arena& code, Instruction* ins);
+
 
 } // namespace asmvm
 
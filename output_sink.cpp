@@ -0,0 +1,15 @@
+#include "output_sink.h"
+
+namespace asmvm {
+
+FileSink* FileSink::Stdout() {
+  static FileSink sink(stdout);
+  return &sink;
+}
+
+FileSink* FileSink::Stderr() {
+  static FileSink sink(stderr);
+  return &sink;
+}
+
+} // namespace asmvm
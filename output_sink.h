@@ -0,0 +1,47 @@
+#ifndef ASMVM_OUTPUT_SINK_H
+#define ASMVM_OUTPUT_SINK_H
+
+#include <string>
+#include <stdio.h>
+#include <stddef.h>
+
+namespace asmvm {
+
+// Destination of what a machine prints: program output (PRINT, FPRINT,
+// SPRINT, EXIT and runtime errors) and diagnostics (parse and link errors).
+class OutputSink {
+ public:
+  virtual ~OutputSink() {}
+  virtual void Write(const char* data, size_t size) = 0;
+  // Called where the VM used to fflush(stdout), after each PRINT.
+  virtual void Flush() {}
+};
+
+class FileSink : public OutputSink {
+ public:
+  explicit FileSink(FILE* file) : file_(file) {}
+  void Write(const char* data, size_t size) { fwrite(data, 1, size, file_); }
+  void Flush() { fflush(file_); }
+
+  // Defaults of every machine.
+  static FileSink* Stdout();
+  static FileSink* Stderr();
+
+ private:
+  FILE* file_;
+};
+
+// Collects everything written to it, e.g. to return program output inline.
+class StringSink : public OutputSink {
+ public:
+  void Write(const char* data, size_t size) { buffer_.append(data, size); }
+  const std::string& str() const { return buffer_; }
+  void clear() { buffer_.clear(); }
+
+ private:
+  std::string buffer_;
+};
+
+} // namespace asmvm
+
+#endif
@@ -8,15 +8,16 @@
 
 namespace asmvm {
 
+// Operands are allocated from the program arena (see arena.h) and are never
+// deleted one by one, hence no virtual destructors here.
 class Printable {
  public:
-  virtual ~Printable() {}
   virtual std::string str(AsmMachine& vm) const = 0;
+  virtual bool Link(AsmMachine& vm) { return true; }
 };
 
 class Source : public Printable {
  public:
-  virtual ~Source() {}
   virtual int32_t value(AsmMachine& vm) const = 0;
   
   std::string str(AsmMachine& vm) const {
@@ -28,29 +29,20 @@ class Source : public Printable {
 
 class BaseAddress {
  public:
-  virtual ~BaseAddress() {}
   virtual uint32_t base_address(AsmMachine& vm) const = 0;
+  virtual bool Link(AsmMachine& vm) { return true; }
 };
 
 class Address {
  public:
   explicit Address(BaseAddress* base) : base_(base), offset_(NULL) {}
   Address(BaseAddress* base, Source* offset) : base_(base), offset_(offset) {}
-  Address(const Address& address) : base_(address.base_), offset_(address.offset_) {}
-  ~Address() {
-    delete base_;
-    delete offset_;
-  }
-  Address& operator = (const Address& address) {
-    base_ = address.base_;
-    offset_ = address.offset_;
-    return *this;
-  }
   BaseAddress* base() { return base_; }
   const BaseAddress* base() const { return base_; }
   Source* offset() { return offset_; }
   const Source* offset() const { return offset_; }
   uint32_t address(AsmMachine& vm) const { return base_->base_address(vm) + ((offset_ == NULL)?0:offset_->value(vm)); }
+  bool Link(AsmMachine& vm) { return base_->Link(vm) && (offset_ == NULL || offset_->Link(vm)); }
  private:
   BaseAddress* base_;
   Source* offset_;
@@ -58,28 +50,31 @@ class Address {
 
 class StringValue : public Value, public Printable {
  public:
-  explicit StringValue(ValueKind kind) : Value(kind) {}
-  StringValue(ValueKind kind, const std::string& value) : Value(kind), value_(value), local_(true) {}
-  StringValue(ValueKind kind, uint32_t address) : Value(kind), address_(address), local_(false) {}
-  StringValue(const StringValue& sv) : Value(sv.kind()), value_(sv.value_), address_(sv.address_), local_(sv.local_) {}
+  explicit StringValue(ValueKind kind) : Value(kind), value_("") {}
+  // value must outlive the StringValue; it usually lives in the program arena.
+  StringValue(ValueKind kind, const char* value) : Value(kind), value_(value) {}
+  StringValue(const StringValue& sv) : Value(sv.kind()), value_(sv.value_) {}
   StringValue& operator = (const StringValue& sv) {
     value_ = sv.value_;
-    address_ = sv.address_;
-    local_ = sv.local_;
     return *this;
   }
   ValueType type() const { return kValueTypeString; }
-  std::string value() const { return value_; }
-  std::string str(AsmMachine& vm) const {
-    if (local_)
-      return value_;
-    else
-      return std::string((const char*)vm.data() + address_);
-  }
+  const char* value() const { return value_; }
+  std::string str(AsmMachine& vm) const { return value_; }
+ private:
+  const char* value_;
+};
+
+// String variable printed by name (PRINT identifier).
+class SymbolString : public Printable {
+ public:
+  explicit SymbolString(SymbolId symbol) : symbol_(symbol), address_(0) {}
+  SymbolId symbol() const { return symbol_; }
+  std::string str(AsmMachine& vm) const { return std::string((const char*)vm.data() + address_); }
+  bool Link(AsmMachine& vm) { return vm.ResolveSymbol(symbol_, Symbol::kSymbolVar, &address_); }
  private:
-  std::string value_;
-  bool local_;
-  uint32_t address_;
+  SymbolId symbol_;
+  int32_t address_;
 };
 
 class IntegerValue : public Value, public Source {
@@ -98,9 +93,23 @@ class IntegerValue : public Value, public Source {
   int32_t value_;
 };
 
+// Value of a variable (its address) or of a label (its instruction index),
+// fixed at link time.
+class SymbolSource : public Source {
+ public:
+  explicit SymbolSource(SymbolId symbol) : symbol_(symbol), value_(0) {}
+  SymbolId symbol() const { return symbol_; }
+  int32_t value(AsmMachine& vm) const { return value_; }
+  bool Link(AsmMachine& vm) { return vm.ResolveSymbol(symbol_, Symbol::kSymbolUndefined, &value_); }
+ private:
+  SymbolId symbol_;
+  int32_t value_;
+};
+
 class RegisterSource : public Source {
  public:
   explicit RegisterSource(uint32_t rindex) : rindex_(rindex) {}
+  uint32_t rindex() const { return rindex_; }
   int32_t value(AsmMachine& vm) const { return vm.get_register(rindex_); }
  private:
   uint32_t rindex_;
@@ -109,6 +118,7 @@ class RegisterSource : public Source {
 class BaseAddressRegister : public BaseAddress {
  public:
   explicit BaseAddressRegister(uint32_t rindex) : rindex_(rindex) {}
+  uint32_t rindex() const { return rindex_; }
   uint32_t base_address(AsmMachine& vm) const { return uint32_t(vm.get_register(rindex_)); }
  private:
   uint32_t rindex_;
@@ -117,22 +127,22 @@ class BaseAddressRegister : public BaseAddress {
 class BaseAddressHex : public BaseAddress {
  public:
   explicit BaseAddressHex(uint32_t hex) : hex_(hex) {}
+  uint32_t hex() const { return hex_; }
   uint32_t base_address(AsmMachine& vm) const { return hex_; }
  private:
   uint32_t hex_;
 };
 
+// Address of a variable, fixed at link time.
 class BaseAddressVar : public BaseAddress {
  public:
-  explicit BaseAddressVar(const std::string& symbol) : symbol_(symbol) {}
-  uint32_t base_address(AsmMachine& vm) const { 
-    Value* v;
-    vm.GetSymbolValue(symbol_, &v);
-    IntegerValue* int_value = static_cast<IntegerValue*>(v);
-    return int_value->value();
-  }
+  explicit BaseAddressVar(SymbolId symbol) : symbol_(symbol), address_(0) {}
+  SymbolId symbol() const { return symbol_; }
+  uint32_t base_address(AsmMachine& vm) const { return address_; }
+  bool Link(AsmMachine& vm) { return vm.ResolveSymbol(symbol_, Symbol::kSymbolVar, &address_); }
  private:
-  std::string symbol_;
+  SymbolId symbol_;
+  int32_t address_;
 };
 
 } // namespace asmvm
@@ -1,9 +1,42 @@
 #include "parser_aid.h"
 
+#include <mutex>
+
+#include "module.h"
+
+extern int yyparse();
+extern bool lexer_scan_buffer(char* buffer, size_t size);
+extern void lexer_release_buffer();
+
 namespace asmvm {
 namespace parser {
 
 StaticHolder StaticHolder::instance_;
 
+static std::mutex parse_mutex;
+
+// Runs the parser alone; the rest is up to the caller.
+static bool ParseLocked(asmvm::SourceBuffer& source, asmvm::AsmMachine* vm) {
+  std::lock_guard<std::mutex> lock(parse_mutex);
+  StaticHolder& holder = StaticHolder::instance();
+  if (!lexer_scan_buffer(source.data(), source.size())) return false;
+  holder.set_vm(vm);
+  holder.clear();
+  bool ok = yyparse() == 0;
+  holder.set_vm(NULL);
+  lexer_release_buffer();
+  return ok;
+}
+
+bool Parse(asmvm::SourceBuffer& source, asmvm::AsmMachine* vm) {
+  // Imports may have to be parsed too, so they are linked after the lock is
+  // released.
+  return ParseLocked(source, vm) && LinkImports(vm) && vm->Link();
+}
+
+bool ParseModule(asmvm::SourceBuffer& source, asmvm::AsmMachine* vm) {
+  return ParseLocked(source, vm);
+}
+
 } // namespace parser
 } // namespace asmvm
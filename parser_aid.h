@@ -1,13 +1,18 @@
-#include <list>
+#ifndef ASMVM_PARSER_AID_H
+#define ASMVM_PARSER_AID_H
+
+#include <vector>
 
 #include "asmvm.h"
 #include "params.h"
+#include "source_buffer.h"
 
 namespace asmvm {
 namespace parser {
 
 class StaticHolder {
  public:
+  StaticHolder() : vm_(NULL) {}
   static StaticHolder& instance() { return instance_; }
   void add(asmvm::Printable* prt) {
     print_arg_list_.push_back(prt);
@@ -15,13 +20,25 @@ class StaticHolder {
   void clear() {
     print_arg_list_.clear();
   }
-  const std::list<asmvm::Printable*>& print_arg_list() const { return print_arg_list_; }
-  asmvm::AsmMachine& vm() { return vm_; }
+  const std::vector<asmvm::Printable*>& print_arg_list() const { return print_arg_list_; }
+  asmvm::AsmMachine& vm() { return *vm_; }
+  void set_vm(asmvm::AsmMachine* vm) { vm_ = vm; }
  private:
-  std::list<asmvm::Printable*> print_arg_list_;
-  asmvm::AsmMachine vm_;
+  std::vector<asmvm::Printable*> print_arg_list_;
+  asmvm::AsmMachine* vm_;
   static StaticHolder instance_;
 };
 
+// Parses and links the whole program in source into vm, along with the
+// modules it imports. The lexer scans the buffer in place (and writes to it
+// while doing so). The parser keeps global state (flex/bison), so concurrent
+// calls are serialized.
+bool Parse(asmvm::SourceBuffer& source, asmvm::AsmMachine* vm);
+
+// Parses a module (see module.h) into vm, which is left unlinked.
+bool ParseModule(asmvm::SourceBuffer& source, asmvm::AsmMachine* vm);
+
 } // namespace parser
 } // namespace asmvm
+
+#endif
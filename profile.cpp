@@ -0,0 +1,412 @@
+#include "profile.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "op.h"
+
+namespace asmvm {
+
+namespace {
+
+const char kProfileHeader[] = "asmvm-profile";
+
+bool EndsBlock(Instruction::Opcode opcode) {
+  switch (opcode) {
+  case Instruction::kOpJmp:
+  case Instruction::kOpJz:
+  case Instruction::kOpJnz:
+  case Instruction::kOpRet:
+  case Instruction::kOpExit:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool IsPc(const Source* src) {
+  const RegisterSource* reg = dynamic_cast<const RegisterSource*>(src);
+  return reg != NULL && reg->rindex() == kRegisterIndexPc;
+}
+
+bool IsPc(const Address* address) {
+  const BaseAddressRegister* reg = dynamic_cast<const BaseAddressRegister*>(address->base());
+  return (reg != NULL && reg->rindex() == kRegisterIndexPc) ||
+         (address->offset() != NULL && IsPc(address->offset()));
+}
+
+// Whether ins reads or writes PC, whose values are instruction indices and
+// so change with the layout. Writes are computed jumps.
+bool UsesPc(const Instruction* ins) {
+  switch (ins->opcode()) {
+  case Instruction::kOpAdd:
+  case Instruction::kOpSub:
+  case Instruction::kOpMul:
+  case Instruction::kOpDiv:
+  case Instruction::kOpMod:
+  case Instruction::kOpAnd:
+  case Instruction::kOpOr:
+  case Instruction::kOpXor:
+  case Instruction::kOpShl:
+  case Instruction::kOpShr: {
+      const TernaryInstruction* op = static_cast<const TernaryInstruction*>(ins);
+      return IsPc(op->param1()) || IsPc(op->param2()) ||
+             op->output_rindex() == kRegisterIndexPc;
+    }
+  case Instruction::kOpNot: {
+      const OpNot* op = static_cast<const OpNot*>(ins);
+      return op->rindex1() == kRegisterIndexPc || op->rindex2() == kRegisterIndexPc;
+    }
+  case Instruction::kOpJz:
+  case Instruction::kOpJnz:
+    return static_cast<const ConditionalJump*>(ins)->rindex() == kRegisterIndexPc;
+  case Instruction::kOpMov: {
+      const OpMov* op = static_cast<const OpMov*>(ins);
+      return op->rindex_dst() == kRegisterIndexPc || IsPc(op->src());
+    }
+  case Instruction::kOpPush:
+    return IsPc(static_cast<const OpPush*>(ins)->src());
+  case Instruction::kOpPop: {
+      const OpPop* op = static_cast<const OpPop*>(ins);
+      return op->store_value() && op->rindex() == kRegisterIndexPc;
+    }
+  case Instruction::kOpLd1:
+  case Instruction::kOpLd2:
+  case Instruction::kOpLd4:
+  case Instruction::kOpLd4Acquire:
+  case Instruction::kOpXadd: {
+      const OpLoad* op = static_cast<const OpLoad*>(ins);
+      return op->rindex() == kRegisterIndexPc || IsPc(op->address());
+    }
+  case Instruction::kOpCas: {
+      const OpCas* op = static_cast<const OpCas*>(ins);
+      return op->rindex() == kRegisterIndexPc || op->desired() == kRegisterIndexPc ||
+             IsPc(op->address());
+    }
+  case Instruction::kOpSt1:
+  case Instruction::kOpSt2:
+  case Instruction::kOpSt4:
+  case Instruction::kOpSt4Release: {
+      const OpStore* op = static_cast<const OpStore*>(ins);
+      return IsPc(op->src()) || IsPc(op->address());
+    }
+  case Instruction::kOpExit:
+    return IsPc(static_cast<const OpExit*>(ins)->code());
+  case Instruction::kOpInc:
+    return static_cast<const OpInc*>(ins)->rindex() == kRegisterIndexPc;
+  case Instruction::kOpDec:
+    return static_cast<const OpDec*>(ins)->rindex() == kRegisterIndexPc;
+  case Instruction::kOpPrint: {
+      const OpPrint* op = static_cast<const OpPrint*>(ins);
+      for (uint32_t i = 0; i < op->printable_count(); ++i) {
+        if (IsPc(dynamic_cast<const Source*>(op->printables()[i]))) return true;
+      }
+      return false;
+    }
+  case Instruction::kOpSysCall: {
+      const OpSysCall* op = static_cast<const OpSysCall*>(ins);
+      return op->rindex() == kRegisterIndexPc || (op->src() != NULL && IsPc(op->src()));
+    }
+  case Instruction::kOpFprint:
+    return static_cast<const OpFprint*>(ins)->rindex() == kRegisterIndexPc;
+  case Instruction::kOpSprint: {
+      const BaseAddressRegister* reg =
+          dynamic_cast<const BaseAddressRegister*>(static_cast<const OpSprint*>(ins)->str());
+      return reg != NULL && reg->rindex() == kRegisterIndexPc;
+    }
+  case Instruction::kOpEnter:
+    return static_cast<const OpEnter*>(ins)->rindex() == kRegisterIndexPc;
+  default:
+    return false;
+  }
+}
+
+const int32_t kNoBlock = -1;
+
+struct Block {
+  Block(uint32_t begin)
+    : begin(begin), end(begin), taken(kNoBlock), fall(kNoBlock), taken_weight(0),
+      fall_weight(0), next(kNoBlock), prev(kNoBlock), chain(0) {}
+  uint32_t begin;
+  uint32_t end;
+  // Successors, by jump and by falling through, and how often each was
+  // followed.
+  int32_t taken;
+  int32_t fall;
+  uint64_t taken_weight;
+  uint64_t fall_weight;
+  // Neighbours in the layout.
+  int32_t next;
+  int32_t prev;
+  uint32_t chain;
+};
+
+struct Edge {
+  Edge(int32_t from, int32_t to, uint64_t weight) : from(from), to(to), weight(weight) {}
+  bool operator < (const Edge& other) const { return weight > other.weight; }
+  int32_t from;
+  int32_t to;
+  uint64_t weight;
+};
+
+bool ByHeat(const std::pair<uint64_t, int32_t>& a, const std::pair<uint64_t, int32_t>& b) {
+  return a.first > b.first;
+}
+
+// A label at instruction index begin, made up if the program has none.
+SymbolId LabelAt(AsmMachine* vm, std::vector<SymbolId>* labels, uint32_t begin) {
+  if ((*labels)[begin] != kNoSymbol) return (*labels)[begin];
+  char name[32];
+  snprintf(name, sizeof(name), ".pgo%u", begin);
+  SymbolId id = vm->symbols().Intern(name, strlen(name), 0);
+  vm->symbols().Define(id, Symbol::kSymbolLabel, begin, 0);
+  (*labels)[begin] = id;
+  return id;
+}
+
+// The superinstruction for ins followed by jump, or NULL if there is none.
+Instruction* NewFusedJump(Arena& code, Instruction* ins, ConditionalJump* jump) {
+  switch (ins->opcode()) {
+  case Instruction::kOpInc:
+    return code.New<OpStepJump>(static_cast<OpInc*>(ins)->rindex(), 1, jump);
+  case Instruction::kOpDec:
+    return code.New<OpStepJump>(static_cast<OpDec*>(ins)->rindex(), -1, jump);
+  case Instruction::kOpAdd:
+    return code.New<OpArithJump<Instruction::kOpAdd> >(static_cast<TernaryInstruction*>(ins), jump);
+  case Instruction::kOpSub:
+    return code.New<OpArithJump<Instruction::kOpSub> >(static_cast<TernaryInstruction*>(ins), jump);
+  case Instruction::kOpAnd:
+    return code.New<OpArithJump<Instruction::kOpAnd> >(static_cast<TernaryInstruction*>(ins), jump);
+  default:
+    return NULL;
+  }
+}
+
+} // namespace
+
+bool Profile::Save(const std::string& path) const {
+  FILE* f = fopen(path.c_str(), "w");
+  if (f == NULL) return false;
+  fprintf(f, "%s %u\nhash %016" PRIx64 "\ninstructions %zu\n", kProfileHeader, kProfileVersion,
+          hash, counts.size());
+  for (size_t pc = 0; pc < counts.size(); ++pc) {
+    if (counts[pc] == 0) continue;
+    fprintf(f, "%zu %" PRIu64 " %" PRIu64 "\n", pc, counts[pc], taken[pc]);
+  }
+  bool ok = !ferror(f);
+  return (fclose(f) == 0) && ok;
+}
+
+bool Profile::Load(const std::string& path, uint64_t expected_hash, size_t size) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (f == NULL) return false;
+  char header[sizeof(kProfileHeader)];
+  unsigned version = 0;
+  size_t instructions = 0;
+  bool ok = fscanf(f, "%13s %u hash %" SCNx64 " instructions %zu", header, &version, &hash,
+                   &instructions) == 4 &&
+            !strcmp(header, kProfileHeader) && version == kProfileVersion &&
+            hash == expected_hash && instructions == size;
+  counts.assign(size, 0);
+  taken.assign(size, 0);
+  size_t pc;
+  uint64_t count, branches;
+  while (ok && fscanf(f, "%zu %" SCNu64 " %" SCNu64, &pc, &count, &branches) == 3) {
+    ok = pc < size && branches <= count;
+    if (ok) {
+      counts[pc] = count;
+      taken[pc] = branches;
+    }
+  }
+  ok = ok && feof(f);
+  fclose(f);
+  return ok;
+}
+
+bool ApplyProfile(AsmMachine* vm, const Profile& profile) {
+  const std::vector<Instruction*>& program = vm->program();
+  uint32_t size = program.size();
+  if (size == 0 || profile.counts.size() != size) return false;
+  for (uint32_t i = 0; i < size; ++i) {
+    if (UsesPc(program[i])) return false;
+  }
+
+  // Blocks start at labels and after the instructions that leave them.
+  std::vector<SymbolId> labels(size + 1, kNoSymbol);
+  std::vector<bool> leaders(size + 1, false);
+  leaders[0] = true;
+  SymbolTable& symbols = vm->symbols();
+  for (SymbolId id = 0; id < symbols.size(); ++id) {
+    const Symbol& symbol = symbols[id];
+    if (symbol.kind != Symbol::kSymbolLabel || symbol.value < 0 || uint32_t(symbol.value) > size) {
+      continue;
+    }
+    leaders[symbol.value] = true;
+    if (labels[symbol.value] == kNoSymbol) labels[symbol.value] = id;
+  }
+  for (uint32_t i = 0; i < size; ++i) {
+    if (EndsBlock(program[i]->opcode())) leaders[i + 1] = true;
+  }
+  std::vector<Block> blocks;
+  std::vector<int32_t> block_of(size + 1, kNoBlock);
+  for (uint32_t i = 0; i < size; ++i) {
+    if (leaders[i]) blocks.push_back(Block(i));
+    blocks.back().end = i + 1;
+    block_of[i] = blocks.size() - 1;
+  }
+  Instruction::Opcode final = program[size - 1]->opcode();
+  if (final != Instruction::kOpJmp && final != Instruction::kOpRet && final != Instruction::kOpExit) {
+    return false;
+  }
+
+  std::vector<Edge> edges;
+  for (size_t b = 0; b < blocks.size(); ++b) {
+    Block& block = blocks[b];
+    uint32_t last = block.end - 1;
+    uint64_t count = profile.counts[last];
+    switch (program[last]->opcode()) {
+    case Instruction::kOpJmp:
+      block.taken = block_of[static_cast<OpJmp*>(program[last])->target()];
+      block.taken_weight = count;
+      break;
+    case Instruction::kOpJz:
+    case Instruction::kOpJnz:
+      block.taken = block_of[static_cast<ConditionalJump*>(program[last])->target()];
+      block.taken_weight = profile.taken[last];
+      block.fall = b + 1;
+      block.fall_weight = count - profile.taken[last];
+      break;
+    case Instruction::kOpRet:
+    case Instruction::kOpExit:
+      break;
+    default:
+      block.fall = b + 1;
+      block.fall_weight = count;
+      break;
+    }
+    block.chain = b;
+    if (block.taken != kNoBlock) edges.push_back(Edge(b, block.taken, block.taken_weight));
+    if (block.fall != kNoBlock) edges.push_back(Edge(b, block.fall, block.fall_weight));
+  }
+
+  // Chains the blocks along the hottest edges first. Block 0 stays at the
+  // head of its chain, which comes first.
+  std::stable_sort(edges.begin(), edges.end());
+  std::vector<std::vector<int32_t> > chains(blocks.size());
+  for (size_t b = 0; b < blocks.size(); ++b) chains[b].push_back(b);
+  for (size_t e = 0; e < edges.size(); ++e) {
+    Block& from = blocks[edges[e].from];
+    Block& to = blocks[edges[e].to];
+    if (edges[e].weight == 0 || edges[e].to == 0 || from.next != kNoBlock ||
+        to.prev != kNoBlock || from.chain == to.chain) {
+      continue;
+    }
+    from.next = edges[e].to;
+    to.prev = edges[e].from;
+    // The smaller chain joins the bigger one.
+    uint32_t keep = from.chain, merged = to.chain;
+    if (chains[keep].size() < chains[merged].size()) std::swap(keep, merged);
+    for (size_t i = 0; i < chains[merged].size(); ++i) {
+      blocks[chains[merged][i]].chain = keep;
+      chains[keep].push_back(chains[merged][i]);
+    }
+    chains[merged].clear();
+  }
+  // Then the other chains, hottest first and never run ones in program order.
+  std::vector<std::pair<uint64_t, int32_t> > heads;
+  for (size_t b = 1; b < blocks.size(); ++b) {
+    if (blocks[b].prev == kNoBlock) heads.push_back(std::make_pair(profile.counts[blocks[b].begin], b));
+  }
+  std::stable_sort(heads.begin(), heads.end(), ByHeat);
+  heads.insert(heads.begin(), std::make_pair(0, 0));
+  std::vector<int32_t> order;
+  for (size_t h = 0; h < heads.size(); ++h) {
+    for (int32_t b = heads[h].second; b != kNoBlock; b = blocks[b].next) order.push_back(b);
+  }
+
+  // Put back if the rewritten program fails to link.
+  std::vector<Instruction*> original(program);
+  std::vector<Symbol> original_symbols;
+  for (SymbolId id = 0; id < symbols.size(); ++id) original_symbols.push_back(symbols[id]);
+
+  // Lays the blocks out, turning jumps to the next block into fall-throughs
+  // and adding jumps where the block falling through is elsewhere.
+  Arena& code = vm->code_arena();
+  std::vector<Instruction*> laid_out;
+  std::vector<uint64_t> counts;
+  std::vector<uint32_t> new_begin(blocks.size());
+  for (size_t k = 0; k < order.size(); ++k) {
+    const Block& block = blocks[order[k]];
+    int32_t next = k + 1 < order.size() ? order[k + 1] : kNoBlock;
+    new_begin[order[k]] = laid_out.size();
+    uint32_t last = block.end - 1;
+    for (uint32_t i = block.begin; i < last; ++i) {
+      laid_out.push_back(program[i]);
+      counts.push_back(profile.counts[i]);
+    }
+    Instruction* ins = program[last];
+    Instruction::Opcode opcode = ins->opcode();
+    if (opcode == Instruction::kOpJmp && block.taken == next && next != kNoBlock) continue;
+    if ((opcode == Instruction::kOpJz || opcode == Instruction::kOpJnz) && block.fall != next &&
+        block.taken == next && next != kNoBlock) {
+      // Inverted, to fall through to where it jumped.
+      SymbolId label = LabelAt(vm, &labels, blocks[block.fall].begin);
+      uint32_t rindex = static_cast<ConditionalJump*>(ins)->rindex();
+      if (opcode == Instruction::kOpJz) {
+        ins = code.New<OpJnz>(rindex, label);
+      } else {
+        ins = code.New<OpJz>(rindex, label);
+      }
+      laid_out.push_back(ins);
+      counts.push_back(profile.counts[last]);
+      continue;
+    }
+    laid_out.push_back(ins);
+    counts.push_back(profile.counts[last]);
+    if (block.fall != kNoBlock && block.fall != next) {
+      laid_out.push_back(code.New<OpJmp>(LabelAt(vm, &labels, blocks[block.fall].begin)));
+      counts.push_back(block.fall_weight);
+    }
+  }
+  for (SymbolId id = 0; id < symbols.size(); ++id) {
+    Symbol& symbol = symbols[id];
+    if (symbol.kind != Symbol::kSymbolLabel || symbol.value < 0 || uint32_t(symbol.value) > size) {
+      continue;
+    }
+    symbol.value = uint32_t(symbol.value) == size ? laid_out.size() : new_begin[block_of[symbol.value]];
+  }
+  vm->set_program(laid_out);
+  if (!vm->Link()) {
+    // The labels LabelAt added are not referred to by the original program.
+    for (SymbolId id = 0; id < symbols.size(); ++id) {
+      if (id < original_symbols.size()) {
+        symbols[id] = original_symbols[id];
+      } else {
+        symbols[id].kind = Symbol::kSymbolUndefined;
+      }
+    }
+    vm->set_program(original);
+    vm->Link();
+    return false;
+  }
+
+  // Superinstructions for the jumps that end hot blocks, once their targets
+  // are known.
+  uint64_t hottest = *std::max_element(counts.begin(), counts.end());
+  std::vector<Instruction*> fused = vm->program();
+  for (size_t k = 0; k < order.size(); ++k) {
+    uint32_t begin = new_begin[order[k]];
+    uint32_t end = k + 1 < order.size() ? new_begin[order[k + 1]] : fused.size();
+    if (end - begin < 2 || counts[begin] == 0 || counts[begin] * kHotBlockRatio < hottest) continue;
+    Instruction::Opcode opcode = fused[end - 1]->opcode();
+    if (opcode != Instruction::kOpJz && opcode != Instruction::kOpJnz) continue;
+    Instruction* ins = NewFusedJump(code, fused[end - 2], static_cast<ConditionalJump*>(fused[end - 1]));
+    if (ins != NULL) fused[end - 2] = ins;
+  }
+  vm->set_program(fused);
+  return true;
+}
+
+} // namespace asmvm
@@ -0,0 +1,72 @@
+#ifndef ASMVM_PROFILE_H
+#define ASMVM_PROFILE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "run_hooks.h"
+
+namespace asmvm {
+
+const uint32_t kProfileVersion = 1;
+// Blocks entered at least 1/kHotBlockRatio as often as the hottest
+// instruction runs get superinstructions.
+const uint64_t kHotBlockRatio = 64;
+
+// Execution counts of a program, by instruction index: how often each
+// instruction ran and, for JZ and JNZ, how often the branch was taken. Kept
+// along with the hash of the source (see HashSource) it was taken from, so a
+// profile of another version of the program is rejected.
+//
+// The file is text, a header line, the hash and the number of instructions,
+// then a line "pc count taken" for each instruction that ran.
+struct Profile {
+  Profile() : hash(0) {}
+  // Empty profile of a program of size instructions.
+  Profile(uint64_t hash, size_t size) : hash(hash), counts(size), taken(size) {}
+
+  bool Save(const std::string& path) const;
+  // False if path is not a profile, or is one of another source than that
+  // of hash, of size instructions.
+  bool Load(const std::string& path, uint64_t expected_hash, size_t size);
+
+  uint64_t hash;
+  std::vector<uint64_t> counts;
+  std::vector<uint64_t> taken;
+};
+
+// Run hooks that fill a profile of the machine's program.
+struct ProfileHooks : public NoHooks {
+  static const bool kInstructionHooks = true;
+  static const bool kControlHooks = true;
+
+  explicit ProfileHooks(Profile* profile) : profile_(profile) {}
+
+  void on_instruction(AsmMachine& vm, uint32_t pc, const Instruction& ins) {
+    ++profile_->counts[pc];
+  }
+  void on_branch(AsmMachine& vm, uint32_t pc, int32_t target) {
+    if (target != int32_t(pc + 1)) ++profile_->taken[pc];
+  }
+
+  Profile* profile_;
+};
+
+// Rewrites the linked program of vm after profile, which must be of it:
+// basic blocks are laid out so that the likelier successor of each block
+// follows it, chaining the hottest edges first, and the jumps that become
+// fall-throughs are dropped or inverted; labels are moved to the new indices
+// and the program linked again. Then the hot blocks that end in JZ or JNZ
+// after INC, DEC, ADD, SUB or AND get the pair fused into a superinstruction.
+//
+// Instruction indices, and so PC, change, and the fused instructions are
+// unknown to images, to the AOT translator and to the control run hooks: the
+// result is only to be run.
+// False, leaving the program as it was, if it could fall off its end or it
+// reads or writes PC.
+bool ApplyProfile(AsmMachine* vm, const Profile& profile);
+
+} // namespace asmvm
+
+#endif
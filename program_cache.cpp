@@ -0,0 +1,253 @@
+#include "program_cache.h"
+
+#include <algorithm>
+#include <vector>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "image.h"
+#include "parser_aid.h"
+
+namespace asmvm {
+
+uint64_t HashSource(const char* source, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= uint8_t(source[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool ReadSourceFile(const std::string& path, std::string* out_source) {
+  FILE* f = ::fopen(path.c_str(), "rb");
+  if (f == NULL) return false;
+  out_source->clear();
+  char buffer[64 * 1024];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    out_source->append(buffer, n);
+  }
+  bool ok = !ferror(f);
+  ::fclose(f);
+  return ok;
+}
+
+ProgramCache::ProgramCache(size_t capacity)
+  : capacity_(capacity == 0 ? 1 : capacity), uncached_(NULL), hits_(0), misses_(0) {}
+
+ProgramCache::~ProgramCache() {
+  delete uncached_;
+  for (LruList::iterator i = lru_.begin(); i != lru_.end(); ++i) {
+    delete i->vm;
+  }
+}
+
+AsmMachine* ProgramCache::Touch(LruList::iterator entry) {
+  lru_.splice(lru_.begin(), lru_, entry);
+  ++hits_;
+  return entry->vm;
+}
+
+AsmMachine* ProgramCache::Get(const std::string& path) {
+  delete uncached_;
+  uncached_ = NULL;
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return NULL;
+
+  std::map<std::string, FileStamp>::iterator stamp = by_path_.find(path);
+  if (stamp != by_path_.end() && stamp->second.mtime == st.st_mtim.tv_sec &&
+      stamp->second.mtime_nsec == st.st_mtim.tv_nsec && stamp->second.size == st.st_size) {
+    std::map<uint64_t, LruList::iterator>::iterator cached = by_hash_.find(stamp->second.hash);
+    if (cached != by_hash_.end()) return Touch(cached->second);
+  }
+
+  // Parsing the very bytes that were hashed keeps the entry consistent even if
+  // the file changes in the meantime.
+  SourceBuffer source;
+  if (!source.Open(path)) return NULL;
+  uint64_t hash = HashSource(source);
+  FileStamp& new_stamp = by_path_[path];
+  new_stamp.mtime = st.st_mtim.tv_sec;
+  new_stamp.mtime_nsec = st.st_mtim.tv_nsec;
+  new_stamp.size = st.st_size;
+  new_stamp.hash = hash;
+
+  std::map<uint64_t, LruList::iterator>::iterator cached = by_hash_.find(hash);
+  if (cached != by_hash_.end()) return Touch(cached->second);
+
+  ++misses_;
+  AsmMachine* vm = new AsmMachine();
+  if (!parser::Parse(source, vm)) {
+    delete vm;
+    by_path_.erase(path);
+    return NULL;
+  }
+  // The stamp and hash do not cover the modules a program imports, which may
+  // change on their own.
+  if (!vm->imports().empty()) {
+    by_path_.erase(path);
+    uncached_ = vm;
+    return vm;
+  }
+  Entry entry = { hash, vm };
+  lru_.push_front(entry);
+  by_hash_[hash] = lru_.begin();
+  while (lru_.size() > capacity_) {
+    by_hash_.erase(lru_.back().hash);
+    delete lru_.back().vm;
+    lru_.pop_back();
+  }
+  return vm;
+}
+
+namespace {
+
+const char kImageSuffix[] = ".img";
+const char kTempMarker[] = ".tmp.";
+const time_t kStaleTempSeconds = 3600;
+
+bool MakeDirectories(const std::string& path) {
+  for (size_t pos = 1; pos <= path.size(); ++pos) {
+    if (pos == path.size() || path[pos] == '/') {
+      if (mkdir(path.substr(0, pos).c_str(), 0755) != 0 && errno != EEXIST) return false;
+    }
+  }
+  return true;
+}
+
+bool EndsWith(const std::string& str, const char* suffix) {
+  size_t n = strlen(suffix);
+  return str.size() >= n && str.compare(str.size() - n, n, suffix) == 0;
+}
+
+struct CachedImage {
+  time_t mtime;
+  off_t size;
+  std::string path;
+  bool operator < (const CachedImage& other) const { return mtime < other.mtime; }
+};
+
+} // namespace
+
+DiskCache::DiskCache(const std::string& directory, uint64_t max_bytes)
+  : directory_(directory), max_bytes_(max_bytes) {}
+
+std::string DiskCache::DefaultDirectory() {
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  if (xdg != NULL && xdg[0] == '/') return std::string(xdg) + "/asmvm";
+  const char* home = getenv("HOME");
+  if (home != NULL && home[0] != '\0') return std::string(home) + "/.cache/asmvm";
+  return std::string();
+}
+
+std::string DiskCache::ImagePath(uint64_t source_hash) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx", (unsigned long long)source_hash);
+  return directory_ + name + kImageSuffix;
+}
+
+bool DiskCache::Load(uint64_t source_hash, AsmMachine* vm) {
+  if (directory_.empty()) return false;
+  std::string path = ImagePath(source_hash);
+  std::string image;
+  if (!ReadSourceFile(path, &image) || !LoadImage(image, source_hash, vm)) return false;
+  // The mtime doubles as the last use time for LRU eviction.
+  utimensat(AT_FDCWD, path.c_str(), NULL, 0);
+  return true;
+}
+
+void DiskCache::Store(uint64_t source_hash, const AsmMachine& vm) {
+  // The source hash does not cover the modules a program imports, which may
+  // change on their own.
+  if (!vm.imports().empty()) return;
+  std::string image;
+  if (directory_.empty() || !SaveImage(vm, source_hash, &image) || !MakeDirectories(directory_)) return;
+
+  std::string path = ImagePath(source_hash);
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "%s%d", kTempMarker, int(getpid()));
+  std::string temp_path = path + suffix;
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return;
+  bool ok = write(fd, image.data(), image.size()) == ssize_t(image.size());
+  ok = (close(fd) == 0) && ok;
+  if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return;
+  }
+  Evict();
+}
+
+void DiskCache::Evict() {
+  DIR* dir = opendir(directory_.c_str());
+  if (dir == NULL) return;
+  std::vector<CachedImage> images;
+  uint64_t total = 0;
+  time_t now = time(NULL);
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    std::string path = directory_ + "/" + entry->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) continue;
+    if (strstr(entry->d_name, kTempMarker) != NULL) {
+      // Left behind by an invocation that died before renaming it.
+      if (now - st.st_mtime > kStaleTempSeconds) unlink(path.c_str());
+    } else if (EndsWith(entry->d_name, kImageSuffix)) {
+      CachedImage image = { st.st_mtime, st.st_size, path };
+      images.push_back(image);
+      total += st.st_size;
+    }
+  }
+  closedir(dir);
+
+  std::sort(images.begin(), images.end());
+  for (size_t i = 0; i < images.size() && total > max_bytes_; ++i) {
+    // Another invocation may be evicting concurrently; a failed unlink is fine.
+    unlink(images[i].path.c_str());
+    total -= images[i].size;
+  }
+}
+
+bool DiskCache::UpdateCounters(uint64_t add_hits, uint64_t add_misses, uint64_t* hits, uint64_t* misses) {
+  if (directory_.empty() || !MakeDirectories(directory_)) return false;
+  std::string path = directory_ + "/stats";
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return false;
+  bool ok = false;
+  if (flock(fd, LOCK_EX) == 0) {
+    char buffer[64];
+    ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    buffer[n > 0 ? n : 0] = '\0';
+    unsigned long long h = 0, m = 0;
+    sscanf(buffer, "%llu %llu", &h, &m);
+    *hits = h + add_hits;
+    *misses = m + add_misses;
+    ok = true;
+    if (add_hits != 0 || add_misses != 0) {
+      n = snprintf(buffer, sizeof(buffer), "%llu %llu\n", (unsigned long long)*hits, (unsigned long long)*misses);
+      ok = pwrite(fd, buffer, n, 0) == n && ftruncate(fd, n) == 0;
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+void DiskCache::Count(bool hit) {
+  uint64_t hits, misses;
+  UpdateCounters(hit ? 1 : 0, hit ? 0 : 1, &hits, &misses);
+}
+
+bool DiskCache::ReadCounters(uint64_t* hits, uint64_t* misses) {
+  return UpdateCounters(0, 0, hits, misses);
+}
+
+} // namespace asmvm
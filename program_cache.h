@@ -0,0 +1,99 @@
+#ifndef ASMVM_PROGRAM_CACHE_H
+#define ASMVM_PROGRAM_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "asmvm.h"
+#include "source_buffer.h"
+
+namespace asmvm {
+
+const uint64_t kDefaultDiskCacheBytes = 64 * 1024 * 1024;
+
+// 64-bit FNV-1a hash of a program source.
+uint64_t HashSource(const char* source, size_t size);
+inline uint64_t HashSource(const SourceBuffer& source) { return HashSource(source.data(), source.size()); }
+
+bool ReadSourceFile(const std::string& path, std::string* out_source);
+
+// Keeps parsed programs in memory, keyed by the hash of their source. Entries
+// are evicted in LRU order once there are more than capacity programs. Each
+// path remembers the mtime/size it was hashed with, so an unchanged file is
+// not even re-read, and a touched file is re-hashed (and re-parsed only if its
+// contents actually changed). Programs with imports are parsed on every Get.
+class ProgramCache {
+ public:
+  explicit ProgramCache(size_t capacity);
+  ~ProgramCache();
+
+  // Returns the parsed program stored in path, or NULL if it could not be
+  // read or parsed. The cache keeps ownership of the returned machine, which
+  // stays valid until the next call to Get.
+  AsmMachine* Get(const std::string& path);
+
+  size_t size() const { return lru_.size(); }
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    AsmMachine* vm;
+  };
+  struct FileStamp {
+    time_t mtime;
+    long mtime_nsec;
+    off_t size;
+    uint64_t hash;
+  };
+  typedef std::list<Entry> LruList;
+
+  AsmMachine* Touch(LruList::iterator entry);
+
+  size_t capacity_;
+  LruList lru_;
+  std::map<uint64_t, LruList::iterator> by_hash_;
+  std::map<std::string, FileStamp> by_path_;
+  // The last program with imports returned, until the next Get.
+  AsmMachine* uncached_;
+  uint64_t hits_;
+  uint64_t misses_;
+};
+
+// Compiled program images (see image.h) stored as <directory>/<hash>.img so
+// that repeated runs of the same source skip the parser. Images are published
+// with write-temp-then-rename, so concurrent invocations never observe a
+// partial file. Loading an image refreshes its mtime, and once the directory
+// grows over max_bytes the images with the oldest mtime are evicted first.
+class DiskCache {
+ public:
+  DiskCache(const std::string& directory, uint64_t max_bytes);
+
+  // $XDG_CACHE_HOME/asmvm, falling back to $HOME/.cache/asmvm.
+  static std::string DefaultDirectory();
+
+  // Fills the empty vm with the image of source_hash. On failure vm may be
+  // partially filled and must be discarded.
+  bool Load(uint64_t source_hash, AsmMachine* vm);
+  void Store(uint64_t source_hash, const AsmMachine& vm);
+
+  // Hit/miss counters, shared by every process using the directory.
+  void Count(bool hit);
+  bool ReadCounters(uint64_t* hits, uint64_t* misses);
+
+ private:
+  std::string ImagePath(uint64_t source_hash) const;
+  bool UpdateCounters(uint64_t add_hits, uint64_t add_misses, uint64_t* hits, uint64_t* misses);
+  void Evict();
+
+  std::string directory_;
+  uint64_t max_bytes_;
+};
+
+} // namespace asmvm
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef ASMVM_RUN_HOOKS_H
+#define ASMVM_RUN_HOOKS_H
+
+#include "asmvm.h"
+#include "op.h"
+
+namespace asmvm {
+
+// Hooks policy for AsmMachine::Continue(fuel, hooks). Policies derive from
+// NoHooks, turn on the groups of events they want and hide the matching
+// methods:
+//
+//   struct Tracer : public asmvm::NoHooks {
+//     static const bool kControlHooks = true;
+//     void on_call(asmvm::AsmMachine& vm, uint32_t pc, int32_t target) { ... }
+//   };
+//
+// Disabled groups are tested at compile time, so the loop instantiated with
+// NoHooks itself is the plain dispatch loop with nothing added to it.
+struct NoHooks {
+  // on_instruction, before every instruction.
+  static const bool kInstructionHooks = false;
+  // on_branch (JMP, JZ, JNZ), on_call and on_ret, after the instruction ran.
+  // target is where execution continues (also when the machine suspends).
+  static const bool kControlHooks = false;
+  // on_memory_access, before loads, stores, PUSH and POP.
+  static const bool kMemoryHooks = false;
+  // on_syscall, before SYSCALL, with the number of the host function.
+  static const bool kSyscallHooks = false;
+
+  void on_instruction(AsmMachine& vm, uint32_t pc, const Instruction& ins) {}
+  void on_branch(AsmMachine& vm, uint32_t pc, int32_t target) {}
+  void on_call(AsmMachine& vm, uint32_t pc, int32_t target) {}
+  void on_ret(AsmMachine& vm, uint32_t pc, int32_t target) {}
+  void on_memory_access(AsmMachine& vm, uint32_t pc, uint32_t address, uint32_t size, bool write) {}
+  void on_syscall(AsmMachine& vm, uint32_t pc, int32_t function_code) {}
+};
+
+template <class Hooks>
+void AsmMachine::BeforeExec(Hooks& hooks, const Instruction& ins) {
+  uint32_t pc = reg_PC();
+  if (Hooks::kInstructionHooks) hooks.on_instruction(*this, pc, ins);
+  if (Hooks::kMemoryHooks) {
+    switch (ins.opcode()) {
+      case Instruction::kOpLd1:
+      case Instruction::kOpLd2:
+      case Instruction::kOpLd4:
+      case Instruction::kOpLd4Acquire:
+        hooks.on_memory_access(*this, pc, static_cast<const OpLoad&>(ins).address()->address(*this),
+                               ins.opcode() == Instruction::kOpLd1 ? 1 :
+                               ins.opcode() == Instruction::kOpLd2 ? 2 : 4, false);
+        break;
+      case Instruction::kOpSt1:
+      case Instruction::kOpSt2:
+      case Instruction::kOpSt4:
+      case Instruction::kOpSt4Release:
+        hooks.on_memory_access(*this, pc, static_cast<const OpStore&>(ins).address()->address(*this),
+                               ins.opcode() == Instruction::kOpSt1 ? 1 :
+                               ins.opcode() == Instruction::kOpSt2 ? 2 : 4, true);
+        break;
+      case Instruction::kOpXadd:
+      case Instruction::kOpCas:
+        // Read-modify-write, reported as a write.
+        hooks.on_memory_access(*this, pc, static_cast<const OpLoad&>(ins).address()->address(*this),
+                               sizeof(int32_t), true);
+        break;
+      case Instruction::kOpPush:
+        hooks.on_memory_access(*this, pc, reg_ST(), sizeof(int32_t), true);
+        break;
+      case Instruction::kOpPop:
+        hooks.on_memory_access(*this, pc, reg_ST() - sizeof(int32_t), sizeof(int32_t), false);
+        break;
+      default:
+        break;
+    }
+  }
+  if (Hooks::kSyscallHooks && ins.opcode() == Instruction::kOpSysCall) {
+    hooks.on_syscall(*this, pc, static_cast<const OpSysCall&>(ins).number(*this));
+  }
+}
+
+template <class Hooks>
+void AsmMachine::AfterExec(Hooks& hooks, const Instruction& ins, int32_t next_pc) {
+  uint32_t pc = reg_PC();
+  int32_t target = (next_pc == kPcSuspend && resume_pc_ >= 0) ? resume_pc_ : next_pc;
+  switch (ins.opcode()) {
+    case Instruction::kOpJmp:
+    case Instruction::kOpJz:
+    case Instruction::kOpJnz:
+      hooks.on_branch(*this, pc, target);
+      break;
+    case Instruction::kOpCall:
+      hooks.on_call(*this, pc, target);
+      break;
+    case Instruction::kOpRet:
+      hooks.on_ret(*this, pc, target);
+      break;
+    default:
+      break;
+  }
+}
+
+template <class Hooks>
+AsmMachine::RunState AsmMachine::Continue(int64_t fuel, Hooks& hooks) {
+  fuel_ = fuel;
+  metered_ = fuel != kUnlimitedFuel;
+  resume_pc_ = -1;
+  blocked_ = false;
+  // Faults come back here, in place of the checks of unguarded machines.
+  FaultTrap trap;
+  if (guarded()) {
+    if (sigsetjmp(trap.jump, 0) != 0) return Fault(fuel, trap);
+    EnterTrap(&trap);
+  }
+  Instruction *ins = program_[reg_PC()];
+  int32_t temp_PC;
+  for (;;) {
+    if (Hooks::kInstructionHooks || Hooks::kMemoryHooks || Hooks::kSyscallHooks) {
+      BeforeExec(hooks, *ins);
+    }
+    temp_PC = ins->Exec(*this);
+    if (Hooks::kControlHooks) AfterExec(hooks, *ins, temp_PC);
+    if (temp_PC < 0) break;
+    ins = program_[temp_PC];
+    set_register(kRegisterIndexPc, temp_PC);
+  }
+  if (guarded()) LeaveTrap(&trap);
+  return Stop(fuel, temp_PC);
+}
+
+} // namespace asmvm
+
+#endif
@@ -0,0 +1,120 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace asmvm {
+
+namespace {
+
+// vruntime advances by instructions * kWeightScale / weight.
+const uint64_t kWeightScale = 1024;
+// Pause once every pending job has blocked without making progress.
+const int kIdleSleepMicros = 50;
+
+} // namespace
+
+Scheduler::Scheduler(size_t threads, int64_t slice_fuel, int64_t job_fuel)
+  : threads_(threads == 0 ? 1 : threads),
+    slice_fuel_(slice_fuel <= 0 ? kDefaultSliceFuel : slice_fuel),
+    job_fuel_(job_fuel <= 0 ? kUnlimitedFuel : job_fuel),
+    pending_(0), idle_slices_(0) {}
+
+uint32_t Scheduler::AddTenant(const std::string& name, uint32_t weight) {
+  Tenant tenant;
+  tenant.name = name;
+  tenant.weight = weight == 0 ? 1 : weight;
+  tenant.instructions = 0;
+  tenant.slices = 0;
+  tenant.blocked_slices = 0;
+  tenant.vruntime = 0;
+  tenants_.push_back(tenant);
+  return tenants_.size() - 1;
+}
+
+size_t Scheduler::Submit(uint32_t tenant, AsmMachine* vm, const std::string& name) {
+  Job job;
+  job.vm = vm;
+  job.tenant = tenant;
+  job.name = name;
+  job.done = false;
+  job.suspended = false;
+  job.exit_code = 0;
+  vm->Reset();
+  vm->set_yield_on_block(true);
+  jobs_.push_back(job);
+  tenants_[tenant].runnable.push_back(jobs_.size() - 1);
+  ++pending_;
+  return jobs_.size() - 1;
+}
+
+void Scheduler::Run() {
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads_; ++i) {
+    workers.push_back(std::thread(&Scheduler::Work, this));
+  }
+  Work();
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i].join();
+  }
+}
+
+int32_t Scheduler::PickTenant() const {
+  int32_t best = -1;
+  for (size_t i = 0; i < tenants_.size(); ++i) {
+    if (tenants_[i].runnable.empty()) continue;
+    if (best < 0 || tenants_[i].vruntime < tenants_[best].vruntime) best = i;
+  }
+  return best;
+}
+
+void Scheduler::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (pending_ > 0) {
+    int32_t t = PickTenant();
+    if (t < 0) {
+      // Every job left is running on another thread.
+      wakeup_.wait(lock);
+      continue;
+    }
+    size_t j = tenants_[t].runnable.front();
+    tenants_[t].runnable.pop_front();
+    Job& job = jobs_[j];
+
+    lock.unlock();
+    uint64_t before = job.vm->instructions();
+    int64_t fuel = std::min<int64_t>(slice_fuel_, job_fuel_ - before);
+    AsmMachine::RunState state = job.vm->Continue(fuel);
+    uint64_t used = job.vm->instructions() - before;
+    lock.lock();
+
+    Tenant& tenant = tenants_[t];
+    tenant.instructions += used;
+    tenant.vruntime += used * kWeightScale / tenant.weight;
+    ++tenant.slices;
+    bool blocked = state == AsmMachine::kRunSuspended && job.vm->blocked();
+    if (blocked) ++tenant.blocked_slices;
+    if (state == AsmMachine::kRunSuspended && job.vm->instructions() < uint64_t(job_fuel_)) {
+      tenant.runnable.push_back(j);
+    } else {
+      job.done = true;
+      job.suspended = state == AsmMachine::kRunSuspended;
+      job.exit_code = job.vm->exit_code();
+      --pending_;
+    }
+    wakeup_.notify_all();
+    if (!blocked || used > 0) {
+      idle_slices_ = 0;
+    } else if (++idle_slices_ > pending_) {
+      // Everything is waiting on a channel, to be fed by a machine outside
+      // the scheduler or a job a thread is still running.
+      idle_slices_ = 0;
+      lock.unlock();
+      std::this_thread::sleep_for(std::chrono::microseconds(kIdleSleepMicros));
+      lock.lock();
+    }
+  }
+}
+
+} // namespace asmvm
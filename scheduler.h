@@ -0,0 +1,86 @@
+#ifndef ASMVM_SCHEDULER_H
+#define ASMVM_SCHEDULER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asmvm.h"
+
+namespace asmvm {
+
+const int64_t kDefaultSliceFuel = 100000;
+
+// Time-slices many machines across a fixed pool of threads. Every job belongs
+// to a tenant; each slice goes to the tenant with the least weighted work so
+// far (instructions / weight), so a tenant with weight 2 gets about twice the
+// instructions of one with weight 1 while both have runnable jobs, however
+// many jobs each of them submitted. A job runs for slice_fuel instructions,
+// is suspended and goes back to the end of its tenant queue until it exits or
+// has used up job_fuel instructions (0 for no limit). A job stopped that way
+// is left suspended: its machine can still be continued by the caller.
+//
+// Jobs run with AsmMachine::yield_on_block, so a job waiting on a channel
+// gives its slice back instead of holding a thread, and goes back to its
+// queue to retry the wait on its next slice.
+class Scheduler {
+ public:
+  struct Tenant {
+    std::string name;
+    uint32_t weight;
+    uint64_t instructions;
+    uint64_t slices;
+    uint64_t blocked_slices;  // Ended waiting on a channel.
+    uint64_t vruntime;
+    std::deque<size_t> runnable;
+  };
+
+  struct Job {
+    AsmMachine* vm;
+    uint32_t tenant;
+    std::string name;
+    bool done;
+    bool suspended;
+    int32_t exit_code;
+  };
+
+  Scheduler(size_t threads, int64_t slice_fuel, int64_t job_fuel);
+
+  // weight must be at least 1.
+  uint32_t AddTenant(const std::string& name, uint32_t weight);
+  // vm is not owned and must outlive Run(). Returns the job index.
+  size_t Submit(uint32_t tenant, AsmMachine* vm, const std::string& name);
+
+  // Runs every submitted job to completion.
+  void Run();
+
+  const std::vector<Tenant>& tenants() const { return tenants_; }
+  const std::vector<Job>& jobs() const { return jobs_; }
+
+ private:
+  Scheduler(const Scheduler&);
+  Scheduler& operator = (const Scheduler&);
+
+  void Work();
+  // Called with mutex_ held. Returns the tenant owed the next slice, or -1.
+  int32_t PickTenant() const;
+
+  size_t threads_;
+  int64_t slice_fuel_;
+  int64_t job_fuel_;
+  std::vector<Tenant> tenants_;
+  std::vector<Job> jobs_;
+  size_t pending_;
+  // Slices in a row that ended blocked without running an instruction.
+  size_t idle_slices_;
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+};
+
+} // namespace asmvm
+
+#endif
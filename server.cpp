@@ -0,0 +1,237 @@
+#include "server.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+namespace asmvm {
+namespace server {
+
+namespace {
+
+// Requests are a single SOCK_SEQPACKET message "cwd\0path\0" carrying the
+// client stdin, stdout and stderr as SCM_RIGHTS. The answer is a Response.
+const int kPassedFds = 3;
+const size_t kMaxRequestSize = 2 * PATH_MAX + 2;
+
+struct Response {
+  int32_t status;
+  int32_t exit_code;
+};
+
+enum ResponseStatus {
+  kStatusOk = 0,
+  kStatusBadRequest,
+  kStatusCompileError
+};
+
+bool FillAddress(const std::string& path, struct sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr->sun_path)) return false;
+  strcpy(addr->sun_path, path.c_str());
+  return true;
+}
+
+void SendResponse(int conn, int32_t status, int32_t exit_code) {
+  Response response = { status, exit_code };
+  send(conn, &response, sizeof(response), MSG_NOSIGNAL);
+}
+
+} // namespace
+
+Server::Server(const std::string& socket_path, size_t cache_capacity, size_t max_workers)
+  : socket_path_(socket_path), cache_(cache_capacity),
+    max_workers_(max_workers == 0 ? 1 : max_workers), workers_(0), listen_fd_(-1) {}
+
+Server::~Server() {
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+  }
+  Reap(true);
+}
+
+int Server::Serve() {
+  struct sockaddr_un addr;
+  if (!FillAddress(socket_path_, &addr)) {
+    fprintf(stderr, "Caminho de socket muito longo: %s\n", socket_path_.c_str());
+    return 1;
+  }
+  listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (listen_fd_ < 0) {
+    perror("socket");
+    return 1;
+  }
+  unlink(socket_path_.c_str());
+  if (bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd_, 64) != 0) {
+    perror(socket_path_.c_str());
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  for (;;) {
+    int conn = accept(listen_fd_, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR) continue;
+      perror("accept");
+      return 1;
+    }
+    Handle(conn);
+    close(conn);
+    Reap(false);
+  }
+}
+
+void Server::Handle(int conn) {
+  char payload[kMaxRequestSize + 1];
+  char control[CMSG_SPACE(kPassedFds * sizeof(int))];
+  struct iovec iov = { payload, kMaxRequestSize };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  // Keeps the first kPassedFds descriptors received and closes the rest. Any
+  // other control message, or another count, makes the request bad.
+  int fds[kPassedFds];
+  int nfds = 0;
+  bool bad_control = false;
+  for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+      bad_control = true;
+      continue;
+    }
+    int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (count != kPassedFds || nfds != 0) bad_control = true;
+    for (int i = 0; i < count; ++i) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+      if (nfds < kPassedFds) {
+        fds[nfds++] = fd;
+      } else {
+        close(fd);
+      }
+    }
+  }
+  if (n <= 0) {
+    for (int i = 0; i < nfds; ++i) close(fds[i]);
+    return;
+  }
+  payload[n] = '\0';
+  const char* cwd = payload;
+  const char* path = payload + strlen(cwd) + 1;
+  if (bad_control || nfds != kPassedFds || path >= payload + n ||
+      (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+    SendResponse(conn, kStatusBadRequest, 0);
+    for (int i = 0; i < nfds; ++i) close(fds[i]);
+    return;
+  }
+
+  AsmMachine* vm = cache_.Get(path);
+  if (vm == NULL) {
+    SendResponse(conn, kStatusCompileError, 0);
+  } else {
+    while (workers_ >= max_workers_) Reap(true);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+      // Worker: becomes the client for the duration of one run.
+      close(listen_fd_);
+      for (int i = 0; i < kPassedFds; ++i) dup2(fds[i], i);
+      if (chdir(cwd) != 0) perror(cwd);
+      int32_t exit_code = vm->Run();
+      fflush(stdout);
+      fflush(stderr);
+      SendResponse(conn, kStatusOk, exit_code);
+      _exit(0);
+    } else if (pid > 0) {
+      ++workers_;
+    } else {
+      perror("fork");
+      SendResponse(conn, kStatusBadRequest, 0);
+    }
+  }
+  for (int i = 0; i < nfds; ++i) close(fds[i]);
+}
+
+void Server::Reap(bool block) {
+  while (workers_ > 0) {
+    pid_t pid = waitpid(-1, NULL, block ? 0 : WNOHANG);
+    if (pid > 0) {
+      --workers_;
+      block = false;
+    } else if (pid < 0 && errno == EINTR) {
+      continue;
+    } else {
+      break;
+    }
+  }
+}
+
+int RunRemote(const std::string& socket_path, const std::string& program_path) {
+  struct sockaddr_un addr;
+  char cwd[PATH_MAX];
+  char path[PATH_MAX];
+  if (!FillAddress(socket_path, &addr) || getcwd(cwd, sizeof(cwd)) == NULL ||
+      realpath(program_path.c_str(), path) == NULL) {
+    fprintf(stderr, "Erro ao tentar abrir o arquivo %s!\n", program_path.c_str());
+    return 1;
+  }
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Não foi possível conectar ao servidor %s!\n", socket_path.c_str());
+    if (fd >= 0) close(fd);
+    return 1;
+  }
+
+  std::string payload = std::string(cwd) + '\0' + path + '\0';
+  int fds[kPassedFds] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  struct iovec iov = { const_cast<char*>(payload.data()), payload.size() };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+  fflush(stdout);
+  Response response;
+  if (sendmsg(fd, &msg, 0) < 0 || recv(fd, &response, sizeof(response), 0) != sizeof(response)) {
+    fprintf(stderr, "Conexão com o servidor %s interrompida!\n", socket_path.c_str());
+    close(fd);
+    return 1;
+  }
+  close(fd);
+  switch (response.status) {
+  case kStatusOk:
+    return response.exit_code;
+  case kStatusCompileError:
+    fprintf(stderr, "Não foi possível compilar %s!\n", program_path.c_str());
+    return 1;
+  default:
+    fprintf(stderr, "Requisição inválida.\n");
+    return 1;
+  }
+}
+
+} // namespace server
+} // namespace asmvm
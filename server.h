@@ -0,0 +1,48 @@
+#ifndef ASMVM_SERVER_H
+#define ASMVM_SERVER_H
+
+#include <string>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "program_cache.h"
+
+namespace asmvm {
+namespace server {
+
+const size_t kDefaultCacheCapacity = 64;
+const size_t kDefaultMaxWorkers = 4;
+
+// Long running "asmvm serve" daemon. Clients connect to a local Unix socket
+// and ask for a program to be run; the server parses it once, keeps it in a
+// ProgramCache and forks a worker per run from the cached machine, so a run
+// costs neither the exec nor the parse. The client passes its own
+// stdin/stdout/stderr descriptors along with the request, so program output
+// is streamed straight to the caller.
+class Server {
+ public:
+  Server(const std::string& socket_path, size_t cache_capacity, size_t max_workers);
+  ~Server();
+
+  // Accepts requests until a fatal error happens. Returns the process exit code.
+  int Serve();
+
+ private:
+  void Handle(int conn);
+  void Reap(bool block);
+
+  std::string socket_path_;
+  ProgramCache cache_;
+  size_t max_workers_;
+  size_t workers_;
+  int listen_fd_;
+};
+
+// Asks the server listening at socket_path to run program_path on behalf of
+// the calling process. Returns the program exit code.
+int RunRemote(const std::string& socket_path, const std::string& program_path);
+
+} // namespace server
+} // namespace asmvm
+
+#endif
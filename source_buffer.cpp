@@ -0,0 +1,79 @@
+#include "source_buffer.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace asmvm {
+
+namespace {
+
+// flex needs two YY_END_OF_BUFFER_CHAR after the text.
+const size_t kPadding = 2;
+
+} // namespace
+
+void SourceBuffer::Release() {
+  if (mapped_) {
+    munmap(data_, size_ + kPadding);
+  } else {
+    free(data_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  mapped_ = false;
+}
+
+void SourceBuffer::Assign(const char* data, size_t size) {
+  Release();
+  data_ = static_cast<char*>(malloc(size + kPadding));
+  memcpy(data_, data, size);
+  memset(data_ + size, 0, kPadding);
+  size_ = size;
+}
+
+bool SourceBuffer::Open(const std::string& path) {
+  Release();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (size > 0 && size % page != 0 && page - size % page >= kPadding) {
+    // Bytes past EOF in the last page read as zero, which is the padding.
+    void* map = mmap(NULL, size + kPadding, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      close(fd);
+      madvise(map, size + kPadding, MADV_SEQUENTIAL);
+      data_ = static_cast<char*>(map);
+      size_ = size;
+      mapped_ = true;
+      return true;
+    }
+  }
+
+  data_ = static_cast<char*>(malloc(size + kPadding));
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(fd, data_ + done, size - done);
+    if (n <= 0) break;
+    done += n;
+  }
+  close(fd);
+  if (done != size) {
+    Release();
+    return false;
+  }
+  memset(data_ + size, 0, kPadding);
+  size_ = size;
+  return true;
+}
+
+} // namespace asmvm
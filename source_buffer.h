@@ -0,0 +1,38 @@
+#ifndef ASMVM_SOURCE_BUFFER_H
+#define ASMVM_SOURCE_BUFFER_H
+
+#include <string>
+#include <stddef.h>
+
+namespace asmvm {
+
+// Whole program source in one writable block followed by two '\0' bytes, the
+// layout flex scans in place (yy_scan_buffer) without any stdio copies. Files
+// are mapped copy-on-write when the padding fits in the tail of their last
+// page and read with a single large read() otherwise.
+class SourceBuffer {
+ public:
+  SourceBuffer() : data_(NULL), size_(0), mapped_(false) {}
+  ~SourceBuffer() { Release(); }
+
+  bool Open(const std::string& path);
+  void Assign(const char* data, size_t size);
+
+  char* data() { return data_; }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  SourceBuffer(const SourceBuffer&);
+  SourceBuffer& operator = (const SourceBuffer&);
+
+  void Release();
+
+  char* data_;
+  size_t size_;
+  bool mapped_;
+};
+
+} // namespace asmvm
+
+#endif
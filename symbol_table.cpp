@@ -0,0 +1,33 @@
+#include "symbol_table.h"
+
+namespace asmvm {
+
+SymbolId SymbolTable::Intern(const char* name, size_t length, int32_t line) {
+  std::pair<std::unordered_map<std::string, SymbolId>::iterator, bool> inserted =
+      ids_.insert(std::make_pair(std::string(name, length), SymbolId(symbols_.size())));
+  if (inserted.second) {
+    // Keys of an unordered_map never move, so the symbol can point into them.
+    Symbol symbol = { inserted.first->first.c_str(), Symbol::kSymbolUndefined, 0, line, 0, false };
+    symbols_.push_back(symbol);
+  }
+  return inserted.first->second;
+}
+
+SymbolId SymbolTable::Find(const std::string& name) const {
+  std::unordered_map<std::string, SymbolId>::const_iterator i = ids_.find(name);
+  return i == ids_.end() ? kNoSymbol : i->second;
+}
+
+bool SymbolTable::Define(SymbolId id, Symbol::Kind kind, int32_t value, int32_t line) {
+  Symbol& symbol = symbols_[id];
+  if (symbol.kind != Symbol::kSymbolUndefined) {
+    if (symbol.redefined_line == 0) symbol.redefined_line = line;
+    return false;
+  }
+  symbol.kind = kind;
+  symbol.value = value;
+  symbol.line = line;
+  return true;
+}
+
+} // namespace asmvm
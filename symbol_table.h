@@ -0,0 +1,55 @@
+#ifndef ASMVM_SYMBOL_TABLE_H
+#define ASMVM_SYMBOL_TABLE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+namespace asmvm {
+
+// Dense id of an interned identifier. Ids index SymbolTable directly.
+typedef uint32_t SymbolId;
+
+const SymbolId kNoSymbol = 0xFFFFFFFF;
+
+struct Symbol {
+  enum Kind {
+    kSymbolUndefined,
+    kSymbolVar,
+    kSymbolLabel
+  };
+  const char* name;
+  Kind kind;
+  int32_t value;       // Address of a variable or instruction index of a label.
+  int32_t line;        // First line the identifier was seen on.
+  int32_t redefined_line; // Line of the first duplicate definition, or 0.
+  bool reported;       // Already diagnosed at link time.
+};
+
+// Maps every identifier of a program to a SymbolId as it is lexed. Labels and
+// variables share one namespace; definitions are recorded as the parser
+// reaches them and references are resolved by the linker afterwards.
+class SymbolTable {
+ public:
+  SymbolId Intern(const char* name, size_t length, int32_t line);
+  SymbolId Intern(const std::string& name, int32_t line) { return Intern(name.data(), name.size(), line); }
+  // kNoSymbol if the identifier never appeared in the program.
+  SymbolId Find(const std::string& name) const;
+
+  // Returns false (and remembers the duplicate for the linker) if the symbol
+  // already has a definition.
+  bool Define(SymbolId id, Symbol::Kind kind, int32_t value, int32_t line);
+
+  Symbol& operator [] (SymbolId id) { return symbols_[id]; }
+  const Symbol& operator [] (SymbolId id) const { return symbols_[id]; }
+  size_t size() const { return symbols_.size(); }
+
+ private:
+  std::unordered_map<std::string, SymbolId> ids_;
+  std::vector<Symbol> symbols_;
+};
+
+} // namespace asmvm
+
+#endif
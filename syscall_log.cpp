@@ -0,0 +1,121 @@
+#include "syscall_log.h"
+
+#include "program_cache.h"
+
+namespace asmvm {
+
+namespace {
+
+// Recordings are written out in chunks of about this size.
+const size_t kFlushSize = 65536;
+
+} // namespace
+
+SysCallLog::SysCallLog()
+  : file_(NULL), replaying_(false), diverged_(false), write_failed_(false), position_(0) {
+}
+
+SysCallLog::~SysCallLog() {
+  Close();
+}
+
+bool SysCallLog::OpenRecord(const std::string& path) {
+  file_ = fopen(path.c_str(), "wb");
+  if (file_ == NULL) return false;
+  for (int i = 0; i < 4; ++i) buffer_ += char(kSysCallLogMagic >> (8 * i));
+  for (int i = 0; i < 4; ++i) buffer_ += char(kSysCallLogVersion >> (8 * i));
+  return true;
+}
+
+bool SysCallLog::OpenReplay(const std::string& path) {
+  if (!ReadSourceFile(path, &buffer_) || buffer_.size() < 8) return false;
+  uint32_t magic = 0, version = 0;
+  for (int i = 0; i < 4; ++i) {
+    magic |= uint32_t(uint8_t(buffer_[i])) << (8 * i);
+    version |= uint32_t(uint8_t(buffer_[4 + i])) << (8 * i);
+  }
+  if (magic != kSysCallLogMagic || version != kSysCallLogVersion) return false;
+  position_ = 8;
+  replaying_ = true;
+  return true;
+}
+
+bool SysCallLog::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == NULL) return true;
+  if (fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) write_failed_ = true;
+  buffer_.clear();
+  if (fclose(file_) != 0) write_failed_ = true;
+  file_ = NULL;
+  return !write_failed_;
+}
+
+void SysCallLog::Record(const Entry& entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == NULL) return;
+  Put(uint32_t(entry.number));
+  PutSigned(entry.status);
+  PutSigned(entry.result);
+  PutSigned(entry.stack_delta);
+  Put(entry.bytes.size());
+  if (!entry.bytes.empty()) {
+    Put(entry.address);
+    buffer_ += entry.bytes;
+  }
+  if (buffer_.size() >= kFlushSize) {
+    if (fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) write_failed_ = true;
+    buffer_.clear();
+  }
+}
+
+bool SysCallLog::Replay(int32_t number, Entry* entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (diverged_) return false;
+  size_t start = position_;
+  uint64_t logged_number, size, address = 0;
+  bool ok = Get(&logged_number) && int32_t(logged_number) == number &&
+            GetSigned(&entry->status) && GetSigned(&entry->result) &&
+            GetSigned(&entry->stack_delta) && Get(&size) &&
+            (size == 0 || (Get(&address) && size <= buffer_.size() - position_));
+  if (!ok) {
+    position_ = start;
+    diverged_ = true;
+    return false;
+  }
+  entry->number = number;
+  entry->address = uint32_t(address);
+  entry->bytes.assign(buffer_, position_, size);
+  position_ += size;
+  return true;
+}
+
+void SysCallLog::Put(uint64_t value) {
+  while (value >= 0x80) {
+    buffer_ += char(value | 0x80);
+    value >>= 7;
+  }
+  buffer_ += char(value);
+}
+
+void SysCallLog::PutSigned(int32_t value) {
+  Put((uint32_t(value) << 1) ^ uint32_t(value >> 31));
+}
+
+bool SysCallLog::Get(uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && position_ < buffer_.size(); shift += 7) {
+    uint8_t byte = buffer_[position_++];
+    *value |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+bool SysCallLog::GetSigned(int32_t* value) {
+  uint64_t zigzag;
+  if (!Get(&zigzag)) return false;
+  *value = int32_t(uint32_t(zigzag >> 1) ^ -uint32_t(zigzag & 1));
+  return true;
+}
+
+} // namespace asmvm
@@ -0,0 +1,84 @@
+#ifndef ASMVM_SYSCALL_LOG_H
+#define ASMVM_SYSCALL_LOG_H
+
+#include <mutex>
+#include <string>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace asmvm {
+
+const uint32_t kSysCallLogMagic = 0x4c525341;  // "ASRL"
+const uint32_t kSysCallLogVersion = 1;
+
+// Log of the host functions whose outcome depends on the host: file opens
+// and closes, fprint, the read_* functions, sleep and now (see
+// CallHostFunction). Recording runs them and logs what the program got from
+// each: status, result, how much the stack moved and the bytes written to
+// VM memory. Replaying runs none of them and gives the program the logged
+// outcomes instead, so a run can be reproduced bit for bit without its
+// files, input or timing. Other host functions run as usual either way.
+//
+// Calls are logged in the order they happen, so a replay of a program whose
+// threads call these functions concurrently may diverge; a replay that asks
+// for another function than the log has next, or for more, is reported once
+// and fails that call and all the logged ones after it.
+//
+// The log is a header, magic and version as 32 bit little endian words,
+// followed by one record per call, all varints, signed ones zigzag encoded:
+// function number, status, result, stack delta, size of the memory written
+// and, if not 0, its address and bytes.
+class SysCallLog {
+ public:
+  struct Entry {
+    Entry() : number(0), status(0), result(0), stack_delta(0), address(0) {}
+    int32_t number;
+    int32_t status;
+    int32_t result;
+    int32_t stack_delta;
+    uint32_t address;
+    std::string bytes;
+  };
+
+  SysCallLog();
+  ~SysCallLog();
+
+  // Creates path to record to.
+  bool OpenRecord(const std::string& path);
+  // Reads a log to replay. False if it cannot be read or is not a log.
+  bool OpenReplay(const std::string& path);
+  // Writes what is still buffered of a recording. False if the log could
+  // not be written completely.
+  bool Close();
+
+  bool replaying() const { return replaying_; }
+  // Set once a replay diverged from the log.
+  bool diverged() const { return diverged_; }
+
+  void Record(const Entry& entry);
+  // The next entry, if it is one of function number. Otherwise the replay
+  // has diverged and stays so.
+  bool Replay(int32_t number, Entry* entry);
+
+ private:
+  SysCallLog(const SysCallLog&);
+  SysCallLog& operator = (const SysCallLog&);
+
+  void Put(uint64_t value);
+  void PutSigned(int32_t value);
+  bool Get(uint64_t* value);
+  bool GetSigned(int32_t* value);
+
+  std::mutex mutex_;
+  FILE* file_;
+  bool replaying_;
+  bool diverged_;
+  bool write_failed_;
+  // Records not yet written, or the whole log being replayed.
+  std::string buffer_;
+  size_t position_;
+};
+
+} // namespace asmvm
+
+#endif
@@ -0,0 +1,91 @@
+#include "threads.h"
+
+#include "asmvm.h"
+#include "metrics.h"
+
+namespace asmvm {
+
+ThreadGroup::ThreadGroup(AsmMachine* root) : root_(root), last_id_(0) {}
+
+ThreadGroup::~ThreadGroup() {
+  for (std::map<int32_t, Thread*>::iterator it = threads_.begin(); it != threads_.end(); ++it) {
+    it->second->thread.join();
+    delete it->second->vm;
+    delete it->second;
+  }
+}
+
+void ThreadGroup::Main(Thread* thread) {
+  if (thread->vm->metrics() != NULL) {
+    StackHighWater hooks(thread->vm->metrics(), thread->vm->reg_ST());
+    thread->vm->Continue(kUnlimitedFuel, hooks);
+  } else {
+    thread->vm->Continue(kUnlimitedFuel);
+  }
+  thread->result = thread->vm->exit_code();
+}
+
+int32_t ThreadGroup::Spawn(const AsmMachine& spawner, int32_t entry, int32_t arg, int32_t stack) {
+  if (spawner.metered() || spawner.yield_on_block()) return 0;
+  if (entry < 0 || size_t(entry) >= root_->program().size()) return 0;
+  if (stack < 0 || uint32_t(stack) >= root_->memory_size()) return 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (threads_.size() == kMaxThreads) return 0;
+  // Ids are not reused until they wrap around, so a stale id is not joined
+  // by mistake.
+  do {
+    last_id_ = last_id_ == INT32_MAX ? 1 : last_id_ + 1;
+  } while (threads_.count(last_id_) != 0);
+  Thread* thread = new Thread();
+  thread->vm = new AsmMachine(root_);
+  thread->vm->PrepareCall(entry);
+  thread->vm->set_register(0, arg);
+  thread->vm->set_register(kRegisterIndexSt, stack);
+  thread->result = 0;
+  thread->thread = std::thread(Main, thread);
+  threads_[last_id_] = thread;
+  return last_id_;
+}
+
+bool ThreadGroup::Join(int32_t id, int32_t* result) {
+  Thread* thread = NULL;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<int32_t, Thread*>::iterator it = threads_.find(id);
+    if (it == threads_.end()) return false;
+    thread = it->second;
+    threads_.erase(it);
+  }
+  thread->thread.join();
+  *result = thread->result;
+  delete thread->vm;
+  delete thread;
+  return true;
+}
+
+ThreadGroup::Bucket& ThreadGroup::bucket(int32_t* word) {
+  return buckets_[(reinterpret_cast<uintptr_t>(word) / sizeof(int32_t)) % kFutexBuckets];
+}
+
+int32_t ThreadGroup::Wait(int32_t* word, int32_t expected) {
+  Bucket& b = bucket(word);
+  std::unique_lock<std::mutex> lock(b.mutex);
+  // A Wake after the store that changed *word takes the bucket lock, so it
+  // cannot slip in between this check and the wait.
+  if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != expected) return 1;
+  ++b.waiters[word];
+  b.wakeup.wait(lock);
+  if (--b.waiters[word] == 0) b.waiters.erase(word);
+  return 0;
+}
+
+int32_t ThreadGroup::Wake(int32_t* word, int32_t count) {
+  Bucket& b = bucket(word);
+  std::lock_guard<std::mutex> lock(b.mutex);
+  std::map<int32_t*, int32_t>::iterator it = b.waiters.find(word);
+  if (it == b.waiters.end()) return 0;
+  b.wakeup.notify_all();
+  return it->second < count ? it->second : count;
+}
+
+} // namespace asmvm
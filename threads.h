@@ -0,0 +1,80 @@
+#ifndef ASMVM_THREADS_H
+#define ASMVM_THREADS_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+namespace asmvm {
+
+class AsmMachine;
+
+// Threads of a program that are not joined yet.
+const uint32_t kMaxThreads = 64;
+
+// OS threads running functions of one program over the memory of its root
+// machine (SYSCALL "spawn"/"join"), and futex-style waiting on words of that
+// memory (SYSCALL "futex_wait"/"futex_wake"). Each thread has a machine of its
+// own for registers and call stack, and its data stack wherever the spawner
+// placed it.
+class ThreadGroup {
+ public:
+  explicit ThreadGroup(AsmMachine* root);
+  // Joins the threads the program did not join.
+  ~ThreadGroup();
+
+  // Starts the function at instruction entry with R1 = arg and ST = stack.
+  // The thread ends when the function returns (result R1) or EXITs (result
+  // the exit code). Returns the thread id, or 0 if it could not be started
+  // or kMaxThreads threads are not joined yet.
+  //
+  // Threads run without a fuel limit, so spawner may not be metered or run
+  // by a Scheduler (see AsmMachine::metered and yield_on_block): the thread
+  // would escape the budget and preemption of its program. Returns 0 then.
+  int32_t Spawn(const AsmMachine& spawner, int32_t entry, int32_t arg, int32_t stack);
+  // Waits for thread id to end. False if there is no such thread or it was
+  // already joined.
+  bool Join(int32_t id, int32_t* result);
+
+  // Blocks while *word == expected, until a Wake on word. Returns 1 without
+  // blocking if *word != expected. Like futex(2), it may return spuriously,
+  // so callers recheck their condition.
+  int32_t Wait(int32_t* word, int32_t expected);
+  // Wakes the threads waiting on word. Returns how many were waiting, up to
+  // count (all of them wake up, the extra ones spuriously).
+  int32_t Wake(int32_t* word, int32_t count);
+
+ private:
+  ThreadGroup(const ThreadGroup&);
+  ThreadGroup& operator = (const ThreadGroup&);
+
+  static const uint32_t kFutexBuckets = 64;
+
+  struct Thread {
+    AsmMachine* vm;
+    std::thread thread;
+    int32_t result;
+  };
+
+  struct Bucket {
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::map<int32_t*, int32_t> waiters;
+  };
+
+  static void Main(Thread* thread);
+  Bucket& bucket(int32_t* word);
+
+  AsmMachine* root_;
+  std::mutex mutex_;
+  // By id, until joined.
+  std::map<int32_t, Thread*> threads_;
+  int32_t last_id_;
+  Bucket buckets_[kFutexBuckets];
+};
+
+} // namespace asmvm
+
+#endif